@@ -0,0 +1,114 @@
+#include "zero/fiber.h"
+#include "zero/log.h"
+#include "zero/thread.h"
+#include "zero/util.h"
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <ucontext.h>
+#ifdef ZERO_HAS_FCONTEXT
+#include "zero/fcontext.h"
+#endif
+
+/// 测量一次往返切换(切入+切出)的耗时
+/// 用法: bench_context_switch [次数]
+
+static const size_t STACK_SIZE = 64 * 1024;
+static int s_count = 0;
+
+static ucontext_t s_uc_main;
+static ucontext_t s_uc_fiber;
+
+static void UContext_Func() {
+    while (true) {
+        swapcontext(&s_uc_fiber, &s_uc_main);
+    }
+}
+
+double Bench_UContext(int count) {
+    char* stack = new char[STACK_SIZE];
+    getcontext(&s_uc_fiber);
+    s_uc_fiber.uc_link = nullptr;
+    s_uc_fiber.uc_stack.ss_sp = stack;
+    s_uc_fiber.uc_stack.ss_size = STACK_SIZE;
+    makecontext(&s_uc_fiber, &UContext_Func, 0);
+
+    uint64_t start = zero::GetCurrentUS();
+    for (int i = 0; i < count; ++i) {
+        swapcontext(&s_uc_main, &s_uc_fiber);
+    }
+    uint64_t used = zero::GetCurrentUS() - start;
+    delete[] stack;
+    return used * 1000.0 / count;
+}
+
+#ifdef ZERO_HAS_FCONTEXT
+static zero::fcontext_t s_fc_main = nullptr;
+static zero::fcontext_t s_fc_fiber = nullptr;
+
+static void FContext_Func() {
+    while (true) {
+        zero::zero_jump_fcontext(&s_fc_fiber, s_fc_main);
+    }
+}
+
+double Bench_FContext(int count) {
+    char* stack = new char[STACK_SIZE];
+    s_fc_fiber = zero::zero_make_fcontext(stack + STACK_SIZE, STACK_SIZE, &FContext_Func);
+
+    uint64_t start = zero::GetCurrentUS();
+    for (int i = 0; i < count; ++i) {
+        zero::zero_jump_fcontext(&s_fc_main, s_fc_fiber);
+    }
+    uint64_t used = zero::GetCurrentUS() - start;
+    delete[] stack;
+    return used * 1000.0 / count;
+}
+#endif
+
+static zero::Fiber* s_fiber = nullptr;
+
+static void Fiber_Func() {
+    for (int i = 0; i < s_count; ++i) {
+        s_fiber->back();
+    }
+}
+
+double Bench_Fiber(int count) {
+    zero::Fiber::GetThis();
+    s_count = count;
+    zero::Fiber::ptr fiber(new zero::Fiber(&Fiber_Func, STACK_SIZE, true));
+    s_fiber = fiber.get();
+
+    uint64_t start = zero::GetCurrentUS();
+    for (int i = 0; i < count; ++i) {
+        fiber->call();
+    }
+    uint64_t used = zero::GetCurrentUS() - start;
+    /// 让协程执行完毕
+    fiber->call();
+    return used * 1000.0 / count;
+}
+
+void Run_Bench(int count) {
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "ucontext raw : " << Bench_UContext(count) << " ns/round-trip" << std::endl;
+#ifdef ZERO_HAS_FCONTEXT
+    std::cout << "fcontext raw : " << Bench_FContext(count) << " ns/round-trip" << std::endl;
+#endif
+#ifdef ZERO_USE_UCONTEXT
+    std::cout << "Fiber(ucontext) : ";
+#else
+    std::cout << "Fiber(fcontext) : ";
+#endif
+    std::cout << Bench_Fiber(count) << " ns/round-trip" << std::endl;
+}
+
+int main(int argc, char** argv) {
+    ZERO_LOG_NAME("system")->setLevel(zero::LogLevel::ERROR);
+    int count = argc > 1 ? atoi(argv[1]) : 1000000;
+    zero::Thread t(std::bind(&Run_Bench, count), "bench_switch");
+    t.join();
+    return 0;
+}
@@ -0,0 +1,60 @@
+#include "zero/fiber.h"
+#include "zero/log.h"
+#include "zero/stack_allocator.h"
+#include "zero/thread.h"
+#include "zero/util.h"
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+
+/// 测量每秒可以创建/运行/销毁多少个协程
+/// 用法: bench_fiber_create [次数]
+
+static uint64_t s_counter = 0;
+
+void Empty_Func() {
+    ++s_counter;
+}
+
+double Bench_Create(zero::StackAllocator* allocator, int count) {
+    zero::StackAllocator::SetDefault(allocator);
+    uint64_t start = zero::GetCurrentUS();
+    for (int i = 0; i < count; ++i) {
+        /// use_caller模式，执行完后回到线程主协程
+        zero::Fiber::ptr fiber(new zero::Fiber(&Empty_Func, 0, true));
+        fiber->call();
+    }
+    uint64_t used = zero::GetCurrentUS() - start;
+    zero::StackAllocator::SetDefault(nullptr);
+    return used ? count * 1000000.0 / used : 0;
+}
+
+void Run_Bench(int count) {
+    zero::Fiber::GetThis();
+
+    zero::MallocStackAllocator malloc_allocator;
+    zero::MmapStackAllocator mmap_allocator;
+    zero::PooledStackAllocator* pooled_allocator = zero::PooledStackAllocator::GetInstance();
+
+    /// 预热，让池里先有栈
+    Bench_Create(pooled_allocator, 100);
+
+    std::cout << std::fixed << std::setprecision(0);
+    std::cout << "malloc  (before): " << Bench_Create(&malloc_allocator, count) << " fibers/s" << std::endl;
+    std::cout << "mmap+guard      : " << Bench_Create(&mmap_allocator, count) << " fibers/s" << std::endl;
+    std::cout << "pooled  (after) : " << Bench_Create(pooled_allocator, count) << " fibers/s" << std::endl;
+
+    zero::PooledStackAllocator::Stats stats = pooled_allocator->getStats();
+    std::cout << "pool local_hits=" << stats.local_hits << " global_hits=" << stats.global_hits << " maps=" << stats.maps
+              << " unmaps=" << stats.unmaps << std::endl;
+}
+
+int main(int argc, char** argv) {
+    /// 关闭协程创建/销毁的日志，避免干扰测量
+    ZERO_LOG_NAME("system")->setLevel(zero::LogLevel::ERROR);
+    int count = argc > 1 ? atoi(argv[1]) : 200000;
+    zero::Thread t(std::bind(&Run_Bench, count), "bench_fiber");
+    t.join();
+    return 0;
+}
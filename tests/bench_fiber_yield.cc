@@ -0,0 +1,76 @@
+#include "zero/fiber.h"
+#include "zero/log.h"
+#include "zero/scheduler.h"
+#include "zero/util.h"
+#include <atomic>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+
+/// 调度器上的协程让出吞吐量
+/// yield: 每个协程循环YieldToReady，测调度+切换的开销
+/// spawn: 若干条回调链，每个回调让出一次后派生下一个，cb_fiber被带走后每个回调都需要一个Fiber对象
+/// 用法: bench_fiber_yield [每个协程让出次数] [每条链的回调数]
+
+static std::atomic<uint64_t> s_done{ 0 };
+
+static void Yield_Func(int count) {
+    for (int i = 0; i < count; ++i) {
+        zero::Fiber::YieldToReady();
+    }
+    ++s_done;
+}
+
+static void Spawn_Func(int remain) {
+    zero::Fiber::YieldToReady();
+    /// 执行完再派生下一个回调，同一时刻存活的回调数量固定，模拟稳定状态下的请求处理
+    if (--remain > 0) {
+        zero::Scheduler::GetThis()->schedule(std::bind(&Spawn_Func, remain));
+    }
+    ++s_done;
+}
+
+double Bench_Yield(int threads, int fibers, int count) {
+    zero::Scheduler sc(threads, false, "bench_yield");
+    sc.start();
+    uint64_t start = zero::GetCurrentUS();
+    for (int i = 0; i < fibers; ++i) {
+        sc.schedule(std::bind(&Yield_Func, count));
+    }
+    sc.stop();
+    uint64_t used = zero::GetCurrentUS() - start;
+    return used * 1000.0 / (( double )fibers * count);
+}
+
+double Bench_Spawn(int threads, int chains, int count) {
+    zero::Scheduler sc(threads, false, "bench_spawn");
+    sc.start();
+    uint64_t start = zero::GetCurrentUS();
+    for (int i = 0; i < chains; ++i) {
+        sc.schedule(std::bind(&Spawn_Func, count));
+    }
+    sc.stop();
+    uint64_t used = zero::GetCurrentUS() - start;
+    return used * 1000.0 / (( double )chains * count);
+}
+
+int main(int argc, char** argv) {
+    int count = argc > 1 ? atoi(argv[1]) : 20000;
+    int spawns = argc > 2 ? atoi(argv[2]) : 5000;
+    /// 屏蔽调度器内部的INFO日志
+    ZERO_LOG_NAME("system")->setLevel(zero::LogLevel::ERROR);
+
+    int threads[] = { 1, 4, 16 };
+    std::cout << std::fixed << std::setprecision(1);
+    for (int t : threads) {
+        int fibers = t * 4;
+        double yield = Bench_Yield(t, fibers, count);
+        double spawn = Bench_Spawn(t, fibers, spawns);
+        std::cout << "threads=" << std::setw(2) << t << " yield: " << std::setw(8) << yield << " ns/op ("
+                  << std::setw(10) << 1000.0 / yield << " M/s)"
+                  << "  spawn: " << std::setw(8) << spawn << " ns/op" << std::endl;
+    }
+    std::cout << "done=" << s_done << std::endl;
+    return 0;
+}
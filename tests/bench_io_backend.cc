@@ -0,0 +1,166 @@
+#include "zero/config.h"
+#include "zero/future.h"
+#include "zero/iomanager.h"
+#include "zero/log.h"
+#include "zero/macro.h"
+#include "zero/util.h"
+#include <arpa/inet.h>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+/// epoll(每次事件epoll_ctl)、常驻注册epoll与io_uring后端的回环TCP回显吞吐
+/// 每个连接一个客户端协程发送消息并等待回显，服务端每个连接一个协程回显，全部走hook的socket接口
+/// 用法: bench_io_backend [线程数] [连接数] [每个连接的消息数] [消息字节数]
+
+static zero::WaitGroup* s_wg = nullptr;
+
+static bool Read_Full(int fd, char* buf, size_t len) {
+    size_t got = 0;
+    while (got < len) {
+        ssize_t n = recv(fd, buf + got, len - got, 0);
+        if (n <= 0) {
+            return false;
+        }
+        got += n;
+    }
+    return true;
+}
+
+static bool Write_Full(int fd, const char* buf, size_t len) {
+    size_t sent = 0;
+    while (sent < len) {
+        ssize_t n = send(fd, buf + sent, len - sent, 0);
+        if (n <= 0) {
+            return false;
+        }
+        sent += n;
+    }
+    return true;
+}
+
+static void Echo_Conn(int fd) {
+    std::vector<char> buf(64 * 1024);
+    while (true) {
+        ssize_t n = recv(fd, &buf[0], buf.size(), 0);
+        if (n <= 0 || !Write_Full(fd, &buf[0], n)) {
+            break;
+        }
+    }
+    close(fd);
+}
+
+static void Accept_Loop(int listen_fd, int conns) {
+    zero::IOManager* iom = zero::IOManager::GetThis();
+    for (int i = 0; i < conns; ++i) {
+        int fd = accept(listen_fd, nullptr, nullptr);
+        ZERO_ASSERT2(fd >= 0, "accept errno=" << errno);
+        iom->schedule(std::bind(&Echo_Conn, fd));
+    }
+    close(listen_fd);
+}
+
+static void Client(const sockaddr_in& addr, int msgs, int size) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    int rt = connect(fd, ( const sockaddr* )&addr, sizeof(addr));
+    ZERO_ASSERT2(rt == 0, "connect errno=" << errno);
+    std::vector<char> msg(size, 'z');
+    std::vector<char> buf(size);
+    for (int i = 0; i < msgs; ++i) {
+        ZERO_ASSERT(Write_Full(fd, &msg[0], size));
+        ZERO_ASSERT(Read_Full(fd, &buf[0], size));
+    }
+    close(fd);
+    s_wg->done();
+}
+
+/**
+ * @brief 执行一轮测试
+ *
+ * @param io_uring 是否请求io_uring后端
+ * @param persistent 是否常驻注册epoll
+ * @param active 实际生效的后端
+ * @return double 耗时(秒)
+ */
+static double Bench(bool io_uring, bool persistent, int threads, int conns, int msgs, int size, std::string& active) {
+    zero::Config::Lookup<bool>("iomanager.io_uring")->setValue(io_uring);
+    zero::Config::Lookup<bool>("iomanager.persistent_epoll")->setValue(persistent);
+    zero::WaitGroup wg;
+    s_wg = &wg;
+    uint64_t used = 0;
+    {
+        zero::IOManager iom(threads, false, "bench_io");
+        active = iom.isIoUring() ? "io_uring" : iom.isPersistentEpoll() ? "epoll_pers" : "epoll";
+
+        int listen_fd = -1;
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        /// 监听socket在调度器线程上创建，才会注册到FdManager
+        zero::WaitGroup ready;
+        ready.add(1);
+        iom.schedule([&]() {
+            listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+            int one = 1;
+            setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            addr.sin_port = 0;
+            ZERO_ASSERT(bind(listen_fd, ( sockaddr* )&addr, sizeof(addr)) == 0);
+            socklen_t len = sizeof(addr);
+            getsockname(listen_fd, ( sockaddr* )&addr, &len);
+            ZERO_ASSERT(listen(listen_fd, 1024) == 0);
+            ready.done();
+        });
+        ready.wait();
+
+        wg.add(conns);
+        uint64_t start = zero::GetCurrentUS();
+        iom.schedule(std::bind(&Accept_Loop, listen_fd, conns));
+        for (int i = 0; i < conns; ++i) {
+            iom.schedule(std::bind(&Client, addr, msgs, size));
+        }
+        wg.wait();
+        used = zero::GetCurrentUS() - start;
+    }
+    zero::Config::Lookup<bool>("iomanager.io_uring")->setValue(false);
+    zero::Config::Lookup<bool>("iomanager.persistent_epoll")->setValue(false);
+    return used / 1000000.0;
+}
+
+int main(int argc, char** argv) {
+    int threads = argc > 1 ? atoi(argv[1]) : 2;
+    int conns = argc > 2 ? atoi(argv[2]) : 32;
+    int msgs = argc > 3 ? atoi(argv[3]) : 2000;
+    int size = argc > 4 ? atoi(argv[4]) : 512;
+    ZERO_LOG_NAME("system")->setLevel(zero::LogLevel::ERROR);
+
+    std::cout << "threads=" << threads << " conns=" << conns << " msgs=" << msgs << " size=" << size << std::endl;
+    std::cout << std::setw(12) << "backend" << std::setw(12) << "active" << std::setw(12) << "sec"
+              << std::setw(14) << "echo/s" << std::setw(12) << "MB/s" << std::endl;
+    std::cout << std::fixed << std::setprecision(2);
+    struct Backend {
+        const char* name;
+        bool io_uring;
+        bool persistent;
+    };
+    Backend backends[] = { { "epoll", false, false }, { "epoll_pers", false, true }, { "io_uring", true, false } };
+    for (auto& b : backends) {
+        std::string active;
+        double sec = Bench(b.io_uring, b.persistent, threads, conns, msgs, size, active);
+        double echos = ( double )conns * msgs;
+        /// 每次回显数据往返各一次
+        double mb = echos * size * 2 / 1024 / 1024;
+        std::cout << std::setw(12) << b.name << std::setw(12) << active << std::setw(12)
+                  << sec << std::setw(14) << echos / sec << std::setw(12) << mb / sec << std::endl;
+    }
+    return 0;
+}
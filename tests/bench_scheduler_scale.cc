@@ -0,0 +1,91 @@
+#include "zero/future.h"
+#include "zero/iomanager.h"
+#include "zero/log.h"
+#include "zero/util.h"
+#include <atomic>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+
+/// 调度器随线程数的扩展性
+/// spawn: 任务在工作线程上递归派生子任务(二叉树)，走本线程队列和窃取
+/// inject: 外部线程直接调度大量任务，走全局注入队列
+/// yield: 每个协程循环YieldToReady
+/// 只统计任务全部完成的时间，不包含调度器停止的时间
+/// 用法: bench_scheduler_scale [spawn树深度] [inject任务数] [每个协程让出次数]
+
+static zero::WaitGroup* s_wg = nullptr;
+
+static void Spawn_Func(int depth) {
+    if (depth > 0) {
+        zero::Scheduler* sc = zero::Scheduler::GetThis();
+        s_wg->add(2);
+        sc->schedule(std::bind(&Spawn_Func, depth - 1));
+        sc->schedule(std::bind(&Spawn_Func, depth - 1));
+    }
+    s_wg->done();
+}
+
+static void Inject_Func() {
+    s_wg->done();
+}
+
+static void Yield_Func(int count) {
+    for (int i = 0; i < count; ++i) {
+        zero::Fiber::YieldToReady();
+    }
+    s_wg->done();
+}
+
+/**
+ * @brief 执行一轮测试
+ *
+ * @param threads 线程数
+ * @param ops 总操作数
+ * @param fn 在调度器上派发任务，任务完成时调用s_wg->done()
+ * @return double ns/op
+ */
+static double Bench(int threads, uint64_t ops, std::function<void(zero::Scheduler*)> fn) {
+    zero::WaitGroup wg;
+    s_wg = &wg;
+    zero::IOManager iom(threads, false, "bench_scale");
+    uint64_t start = zero::GetCurrentUS();
+    fn(&iom);
+    wg.wait();
+    uint64_t used = zero::GetCurrentUS() - start;
+    return used * 1000.0 / ops;
+}
+
+int main(int argc, char** argv) {
+    int depth = argc > 1 ? atoi(argv[1]) : 16;
+    int injects = argc > 2 ? atoi(argv[2]) : 100000;
+    int yields = argc > 3 ? atoi(argv[3]) : 2000;
+    ZERO_LOG_NAME("system")->setLevel(zero::LogLevel::ERROR);
+
+    int threads[] = { 1, 2, 4, 8, 16, 32, 64 };
+    std::cout << std::fixed << std::setprecision(1);
+    for (int t : threads) {
+        double spawn = Bench(t, (2ull << depth) - 1, [depth](zero::Scheduler* sc) {
+            s_wg->add(1);
+            sc->schedule(std::bind(&Spawn_Func, depth));
+        });
+        double inject = Bench(t, injects, [injects](zero::Scheduler* sc) {
+            s_wg->add(injects);
+            for (int i = 0; i < injects; ++i) {
+                sc->schedule(&Inject_Func);
+            }
+        });
+        int fibers = t * 4;
+        double yield = Bench(t, ( uint64_t )fibers * yields, [fibers, yields](zero::Scheduler* sc) {
+            s_wg->add(fibers);
+            for (int i = 0; i < fibers; ++i) {
+                sc->schedule(std::bind(&Yield_Func, yields));
+            }
+        });
+        std::cout << "threads=" << std::setw(2) << t << " spawn: " << std::setw(8) << spawn << " ns/op"
+                  << "  inject: " << std::setw(8) << inject << " ns/op"
+                  << "  yield: " << std::setw(8) << yield << " ns/op" << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,100 @@
+#include "zero/channel.h"
+#include "zero/iomanager.h"
+#include "zero/log.h"
+#include "zero/macro.h"
+#include "zero/util.h"
+#include <atomic>
+#include <functional>
+#include <string>
+
+static zero::Logger::ptr g_logger = ZERO_LOG_ROOT();
+
+/// 生产者/消费者通过通道传递数据，不需要轮询
+
+static std::atomic<int> s_sum{ 0 };
+
+void Test_Producer(zero::Channel<int>* chan, int begin, int count) {
+    for (int i = begin; i < begin + count; ++i) {
+        ZERO_ASSERT(chan->send(i));
+    }
+}
+
+void Test_Consumer(zero::Channel<int>* chan) {
+    int v = 0;
+    while (chan->recv(v)) {
+        s_sum += v;
+    }
+}
+
+/// 同步通道、有界通道、无界通道
+void Test_Send_Recv(size_t capacity) {
+    s_sum = 0;
+    zero::Channel<int> chan(capacity);
+    {
+        zero::IOManager iom(2, false, "test_channel");
+        for (int i = 0; i < 3; ++i) {
+            iom.schedule(std::bind(&Test_Consumer, &chan));
+        }
+        for (int i = 0; i < 4; ++i) {
+            iom.schedule(std::bind(&Test_Producer, &chan, i * 1000, 1000));
+        }
+        /// 等所有数据被接收后关闭，唤醒挂起的接收方
+        iom.schedule([&chan]() {
+            while (s_sum != 7998000 || chan.size()) {
+                zero::Fiber::YieldToReady();
+            }
+            chan.close();
+        });
+    }
+    ZERO_ASSERT2(s_sum == 7998000, "s_sum=" << s_sum);
+    ZERO_LOG_INFO(g_logger) << "test_send_recv capacity=" << capacity << " sum=" << s_sum;
+}
+
+void Test_Try_Close() {
+    zero::Channel<std::string> chan(2);
+    ZERO_ASSERT(chan.trySend("a"));
+    ZERO_ASSERT(chan.trySend("b"));
+    ZERO_ASSERT(!chan.trySend("c"));
+    chan.close();
+    ZERO_ASSERT(!chan.send("d"));
+    std::string v;
+    /// 关闭后剩余的数据仍可以接收
+    ZERO_ASSERT(chan.tryRecv(v) && v == "a");
+    ZERO_ASSERT(chan.recv(v) && v == "b");
+    ZERO_ASSERT(!chan.recv(v));
+    ZERO_LOG_INFO(g_logger) << "test_try_close ok";
+}
+
+void Test_Timeout_Select() {
+    zero::Channel<int> a(1);
+    zero::Channel<int> b(1);
+    zero::IOManager iom(1, false, "test_select");
+    iom.schedule([&a, &b]() {
+        int v = 0;
+        uint64_t start = zero::GetCurrentMS();
+        ZERO_ASSERT(a.recvTimeout(v, 100) == zero::Channel<int>::TIMEOUT);
+        ZERO_LOG_INFO(g_logger) << "recv timeout used=" << zero::GetCurrentMS() - start << "ms";
+
+        std::vector<zero::Channel<int>*> chans = { &a, &b };
+        ZERO_ASSERT(zero::Channel<int>::Select(chans, v, 50) == -1);
+        /// 另一个协程100ms后向b发送
+        zero::IOManager::GetThis()->addTimer(100, [&b]() { b.send(42); });
+        int idx = zero::Channel<int>::Select(chans, v, 1000);
+        ZERO_ASSERT2(idx == 1 && v == 42, "idx=" << idx << " v=" << v);
+
+        a.close();
+        b.close();
+        ZERO_ASSERT(zero::Channel<int>::Select(chans, v) == -1);
+        ZERO_LOG_INFO(g_logger) << "test_timeout_select ok";
+    });
+}
+
+int main() {
+    ZERO_LOG_NAME("system")->setLevel(zero::LogLevel::ERROR);
+    Test_Send_Recv(0);
+    Test_Send_Recv(16);
+    Test_Send_Recv(zero::Channel<int>::UNBOUNDED);
+    Test_Try_Close();
+    Test_Timeout_Select();
+    return 0;
+}
@@ -0,0 +1,130 @@
+#include "zero/clock.h"
+#include "zero/config.h"
+#include "zero/iomanager.h"
+#include "zero/log.h"
+#include "zero/macro.h"
+#include "zero/thread.h"
+#include "zero/util.h"
+#include <atomic>
+#include <functional>
+#include <string>
+#include <unistd.h>
+
+static zero::Logger::ptr g_logger = ZERO_LOG_ROOT();
+
+/// 单调时钟不回退，粗粒度时钟与精确时钟相差不超过几个节拍
+void Test_Monotonic() {
+    uint64_t last = zero::Clock::MonotonicNS();
+    for (int i = 0; i < 100000; ++i) {
+        uint64_t now = zero::Clock::MonotonicNS();
+        ZERO_ASSERT(now >= last);
+        last = now;
+    }
+    uint64_t coarse = zero::Clock::CoarseMS();
+    uint64_t fine = zero::Clock::MonotonicMS();
+    ZERO_ASSERT2(coarse <= fine && fine - coarse <= 20, "coarse=" << coarse << " fine=" << fine);
+    ZERO_LOG_INFO(g_logger) << "test_monotonic ok";
+}
+
+static bool s_other_cached = true;
+
+/// 缓存只在刷新它的线程上生效，关闭后重新读时钟
+void Test_Cache() {
+    ZERO_ASSERT(!zero::Clock::IsCached());
+    uint64_t cached = zero::Clock::Refresh();
+    ZERO_ASSERT(zero::Clock::IsCached());
+    usleep(20 * 1000);
+    ZERO_ASSERT(zero::Clock::NowUS() == cached);
+    ZERO_ASSERT(zero::Clock::MonotonicUS() >= cached + 20 * 1000);
+
+    zero::Thread t([]() { s_other_cached = zero::Clock::IsCached(); }, "clock_other");
+    t.join();
+    ZERO_ASSERT(!s_other_cached);
+
+    zero::Clock::Invalidate();
+    ZERO_ASSERT(!zero::Clock::IsCached());
+    ZERO_ASSERT(zero::Clock::NowUS() >= cached + 20 * 1000);
+    ZERO_LOG_INFO(g_logger) << "test_cache ok";
+}
+
+static std::atomic<int> s_checked{ 0 };
+
+/// 调度器线程上每个任务开始时缓存已刷新；调用者线程离开调度循环后关闭缓存
+void Test_IOManager_Cache() {
+    {
+        zero::IOManager iom(2, true, "clock_iom");
+        for (int i = 0; i < 8; ++i) {
+            iom.schedule([]() {
+                ZERO_ASSERT(zero::Clock::IsCached());
+                uint64_t lag = zero::Clock::MonotonicUS() - zero::Clock::NowUS();
+                ZERO_ASSERT2(lag < 100 * 1000, "lag=" << lag);
+                ++s_checked;
+            });
+        }
+        /// 定时器按单调时钟计时
+        iom.addTimer(30, []() { ++s_checked; });
+    }
+    ZERO_ASSERT(s_checked == 9);
+    ZERO_ASSERT(!zero::Clock::IsCached());
+    ZERO_LOG_INFO(g_logger) << "test_iomanager_cache ok";
+}
+
+/// 开启TSC后NowNS与单调时钟走速一致
+void Test_Tsc() {
+    zero::Config::Lookup<bool>("clock.tsc")->setValue(true);
+    if (!zero::Clock::IsTscEnabled()) {
+        ZERO_LOG_INFO(g_logger) << "test_tsc skipped, invariant tsc not supported";
+        return;
+    }
+    uint64_t ns0 = zero::Clock::MonotonicNS();
+    uint64_t tsc0 = zero::Clock::NowNS();
+    usleep(50 * 1000);
+    uint64_t ns1 = zero::Clock::MonotonicNS();
+    uint64_t tsc1 = zero::Clock::NowNS();
+    int64_t diff = ( int64_t )(tsc1 - tsc0) - ( int64_t )(ns1 - ns0);
+    ZERO_ASSERT2(diff < 500 * 1000 && diff > -500 * 1000, "diff=" << diff);
+    zero::Config::Lookup<bool>("clock.tsc")->setValue(false);
+    ZERO_ASSERT(!zero::Clock::IsTscEnabled());
+    ZERO_LOG_INFO(g_logger) << "test_tsc ok diff_ns=" << diff;
+}
+
+/**
+ * @brief 各种取时间方式的单次开销
+ *
+ * @param name
+ * @param fn
+ */
+static void Bench(const std::string& name, const std::function<uint64_t()>& fn) {
+    const int loops = 1000000;
+    uint64_t sum = 0;
+    uint64_t start = zero::Clock::MonotonicNS();
+    for (int i = 0; i < loops; ++i) {
+        sum += fn();
+    }
+    uint64_t used = zero::Clock::MonotonicNS() - start;
+    ZERO_LOG_INFO(g_logger) << "bench " << name << " ns/op=" << used / ( double )loops << " sum=" << (sum & 1);
+}
+
+void Bench_Reads() {
+    Bench("gettimeofday", []() { return zero::GetCurrentUS(); });
+    Bench("monotonic", []() { return zero::Clock::MonotonicUS(); });
+    Bench("coarse", []() { return zero::Clock::CoarseMS(); });
+    zero::Clock::Refresh();
+    Bench("cached", []() { return zero::Clock::NowUS(); });
+    zero::Clock::Invalidate();
+    zero::Config::Lookup<bool>("clock.tsc")->setValue(true);
+    if (zero::Clock::IsTscEnabled()) {
+        Bench("tsc", []() { return zero::Clock::NowNS(); });
+    }
+    zero::Config::Lookup<bool>("clock.tsc")->setValue(false);
+}
+
+int main() {
+    Test_Monotonic();
+    Test_Cache();
+    Test_Tsc();
+    Bench_Reads();
+    /// use_caller的调度器结束后调用者线程仍开启hook，放在最后
+    Test_IOManager_Cache();
+    return 0;
+}
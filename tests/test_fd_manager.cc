@@ -0,0 +1,104 @@
+#include "zero/fd_manager.h"
+#include "zero/log.h"
+#include "zero/macro.h"
+#include "zero/thread.h"
+#include "zero/util.h"
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+static zero::Logger::ptr g_logger = ZERO_LOG_ROOT();
+
+/// 记录常驻在表中：删除后已取到的指针仍然有效且isClose，同号fd重新创建得到同一个对象
+void Test_Lifecycle() {
+    zero::FdManager* mgr = zero::FdMgr::GetInstance();
+    int fds[2];
+    ZERO_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    ZERO_ASSERT(!mgr->get(fds[0]));
+    zero::FdCtx* ctx = mgr->get(fds[0], true);
+    ZERO_ASSERT(ctx && ctx->isInit() && ctx->isSocket() && ctx->getSysNonblock() && !ctx->isClose());
+    ZERO_ASSERT(mgr->get(fds[0]) == ctx);
+    ZERO_ASSERT(mgr->getEventContext(fds[0])->fd == fds[0]);
+
+    mgr->del(fds[0]);
+    ZERO_ASSERT(ctx->isClose());
+    ZERO_ASSERT(!mgr->get(fds[0]));
+    ZERO_ASSERT(mgr->get(fds[0], true) == ctx && !ctx->isClose());
+    mgr->del(fds[0]);
+    close(fds[0]);
+    close(fds[1]);
+
+    /// 不是socket的fd也可以创建，超出表范围的返回空
+    int big = zero::FdManager::PAGE_SIZE * 100 + 7;
+    zero::FdCtx* big_ctx = mgr->get(big, true);
+    ZERO_ASSERT(big_ctx && !big_ctx->isInit() && !big_ctx->isSocket());
+    ZERO_ASSERT(mgr->getEventContext(big)->fd == big);
+    ZERO_ASSERT(!mgr->get(-1, true));
+    ZERO_ASSERT(!mgr->get(zero::FdManager::DIR_SIZE * zero::FdManager::PAGE_SIZE, true));
+    ZERO_ASSERT(!mgr->getEventContext(zero::FdManager::PAGE_SIZE * 200));
+    ZERO_LOG_INFO(g_logger) << "test_lifecycle ok";
+}
+
+/// 多个线程同时访问尚未分配的页，只有一页生效，所有线程拿到同一个记录
+static const int s_threads = 8;
+static const int s_pages = 64;
+static std::vector<zero::FdCtx*> s_seen[s_threads];
+static std::atomic<int> s_ready{ 0 };
+
+static void Race_Func(int idx) {
+    ++s_ready;
+    while (s_ready < s_threads) {
+    }
+    zero::FdManager* mgr = zero::FdMgr::GetInstance();
+    for (int p = 0; p < s_pages; ++p) {
+        int fd = (1000 + p) * zero::FdManager::PAGE_SIZE + idx % 3;
+        s_seen[idx].push_back(mgr->get(fd, true));
+    }
+}
+
+void Test_Concurrent_Page_Alloc() {
+    std::vector<std::unique_ptr<zero::Thread>> threads;
+    for (int i = 0; i < s_threads; ++i) {
+        threads.emplace_back(new zero::Thread(std::bind(&Race_Func, i), "fd_race_" + std::to_string(i)));
+    }
+    for (auto& t : threads) {
+        t->join();
+    }
+    for (int i = 0; i < s_threads; ++i) {
+        for (int p = 0; p < s_pages; ++p) {
+            ZERO_ASSERT(s_seen[i][p] == s_seen[i % 3][p]);
+            ZERO_ASSERT(s_seen[i][p] != s_seen[(i + 1) % 3][p]);
+        }
+    }
+    ZERO_LOG_INFO(g_logger) << "test_concurrent_page_alloc threads=" << s_threads << " pages=" << s_pages << " ok";
+}
+
+/// 热路径查找的开销
+void Bench_Lookup() {
+    zero::FdManager* mgr = zero::FdMgr::GetInstance();
+    const int fds = 1024;
+    for (int i = 0; i < fds; ++i) {
+        mgr->get(i + 3000, true);
+    }
+    const int loops = 2000;
+    uint64_t start = zero::GetCurrentUS();
+    size_t hits = 0;
+    for (int l = 0; l < loops; ++l) {
+        for (int i = 0; i < fds; ++i) {
+            hits += mgr->get(i + 3000) != nullptr;
+        }
+    }
+    uint64_t used = zero::GetCurrentUS() - start;
+    ZERO_ASSERT(hits == ( size_t )fds * loops);
+    ZERO_LOG_INFO(g_logger) << "bench_lookup ops=" << hits << " ns/op=" << used * 1000.0 / hits;
+}
+
+int main() {
+    Test_Lifecycle();
+    Test_Concurrent_Page_Alloc();
+    Bench_Lookup();
+    return 0;
+}
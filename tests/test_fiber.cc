@@ -1,9 +1,12 @@
+#include "zero/config.h"
 #include "zero/fiber.h"
 #include "zero/log.h"
 #include "zero/macro.h"
 #include "zero/thread.h"
 #include "zero/util.h"
 #include <functional>
+#include <iostream>
+#include <typeinfo>
 
 zero::Logger::ptr g_logger = ZERO_LOG_ROOT();
 
@@ -49,10 +52,61 @@ void Test_Usercaller_Fiber() {
     uc_fiber->call();
 }
 
+/// 按深度递归，每层在栈上占用约1K
+int Test_Stack_Depth(int depth) {
+    volatile char buf[1024];
+    buf[0] = (char)depth;
+    if (depth <= 0) {
+        return buf[0];
+    }
+    return Test_Stack_Depth(depth - 1) + buf[0];
+}
+
+/// 同一类型的回调按类型统计会合并，在回调中设置名称分开统计
+void Test_Stack_Site(const char* site, int depth) {
+    zero::Fiber::SetStackSite(site);
+    Test_Stack_Depth(depth);
+}
+
+void Test_Stack_Probe() {
+    /// 开启栈探测，协程结束时统计栈最高使用量
+    zero::Config::Lookup<bool>("fiber.stack_probe")->setValue(true);
+    zero::Fiber::GetThis();
+    auto small_cb = []() { Test_Stack_Depth(2); };
+    auto large_cb = std::bind(&Test_Stack_Depth, 48);
+    for (int i = 0; i < 10; ++i) {
+        zero::Fiber::ptr small(new zero::Fiber(small_cb, 128 * 1024, true));
+        small->call();
+        zero::Fiber::ptr large(new zero::Fiber(large_cb, 128 * 1024, true));
+        large->call();
+    }
+    zero::Fiber::DumpStackUsage(std::cout);
+    size_t small_max = zero::Fiber::GetStackUsageMax(typeid(small_cb));
+    size_t large_max = zero::Fiber::GetStackUsageMax(typeid(large_cb));
+    /// 48层递归约48K，2层只有几K
+    ZERO_ASSERT2(small_max > 0 && large_max > small_max, "small=" << small_max << " large=" << large_max);
+    ZERO_ASSERT2(large_max >= 48 * 1024, "large=" << large_max);
+    ZERO_ASSERT2(small_max <= 128 * 1024 && large_max <= 128 * 1024, "small=" << small_max << " large=" << large_max);
+
+    for (int i = 0; i < 10; ++i) {
+        zero::Fiber::ptr small(new zero::Fiber(std::bind(&Test_Stack_Site, "probe_small", 2), 128 * 1024, true));
+        small->call();
+        zero::Fiber::ptr large(new zero::Fiber(std::bind(&Test_Stack_Site, "probe_large", 48), 128 * 1024, true));
+        large->call();
+    }
+    small_max = zero::Fiber::GetStackUsageMax(std::string("probe_small"));
+    large_max = zero::Fiber::GetStackUsageMax(std::string("probe_large"));
+    ZERO_ASSERT2(small_max > 0 && large_max >= 48 * 1024 && small_max < large_max, "small=" << small_max << " large=" << large_max);
+    /// 设置了名称的不再计入回调类型
+    ZERO_ASSERT(zero::Fiber::GetStackUsageMax(typeid(std::bind(&Test_Stack_Site, "", 0))) == 0);
+}
+
 int main() {
     ZERO_LOG_INFO(g_logger) << "main start...";
     zero::Thread t(std::bind(&Test_Usercaller_Fiber), "test_thread");
     t.join();
+    zero::Thread t2(std::bind(&Test_Stack_Probe), "test_probe");
+    t2.join();
     ZERO_LOG_INFO(g_logger) << "main end...";
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,186 @@
+#include "zero/fiber_sync.h"
+#include "zero/log.h"
+#include "zero/macro.h"
+#include "zero/scheduler.h"
+#include "zero/util.h"
+#include <atomic>
+#include <functional>
+#include <queue>
+#include <unistd.h>
+
+static zero::Logger::ptr g_logger = ZERO_LOG_ROOT();
+
+/// 协程同步原语：等待时挂起协程而不是阻塞调度线程
+
+static zero::FiberMutex s_mutex;
+static int s_count = 0;
+
+void Test_Mutex_Func() {
+    for (int i = 0; i < 1000; ++i) {
+        zero::FiberMutex::Lock lock(s_mutex);
+        int v = s_count;
+        /// 持锁让出，其他协程会挂在锁上
+        if (i % 100 == 0) {
+            zero::Fiber::YieldToReady();
+        }
+        s_count = v + 1;
+    }
+}
+
+void Test_Mutex() {
+    zero::Scheduler sc(3, false, "test_mutex");
+    sc.start();
+    for (int i = 0; i < 20; ++i) {
+        sc.schedule(&Test_Mutex_Func);
+    }
+    /// 非协程线程也可以使用，退化为阻塞线程
+    for (int i = 0; i < 1000; ++i) {
+        zero::FiberMutex::Lock lock(s_mutex);
+        ++s_count;
+    }
+    sc.stop();
+    ZERO_ASSERT2(s_count == 21000, "s_count=" << s_count);
+    ZERO_LOG_INFO(g_logger) << "test_mutex count=" << s_count;
+}
+
+static zero::FiberMutex s_queue_mutex;
+static zero::FiberCondition s_queue_cond;
+static std::queue<int> s_queue;
+static std::atomic<int> s_consumed{ 0 };
+static std::atomic<int> s_exited{ 0 };
+
+void Test_Consumer() {
+    while (true) {
+        zero::FiberMutex::Lock lock(s_queue_mutex);
+        while (s_queue.empty()) {
+            s_queue_cond.wait(lock);
+        }
+        int v = s_queue.front();
+        s_queue.pop();
+        if (v < 0) {
+            ++s_exited;
+            return;
+        }
+        ++s_consumed;
+    }
+}
+
+void Test_Producer(int count) {
+    for (int i = 0; i < count; ++i) {
+        {
+            zero::FiberMutex::Lock lock(s_queue_mutex);
+            s_queue.push(i);
+        }
+        s_queue_cond.notify();
+        if (i % 10 == 0) {
+            zero::Fiber::YieldToReady();
+        }
+    }
+}
+
+void Test_Condition() {
+    zero::Scheduler sc(2, false, "test_condition");
+    sc.start();
+    for (int i = 0; i < 4; ++i) {
+        sc.schedule(&Test_Consumer);
+    }
+    for (int i = 0; i < 2; ++i) {
+        sc.schedule(std::bind(&Test_Producer, 500));
+    }
+    /// 有限等待，丢失唤醒时断言失败而不是卡住
+    uint64_t start = zero::GetCurrentMS();
+    while (s_consumed != 1000 && zero::GetCurrentMS() - start < 5000) {
+        usleep(1000);
+    }
+    ZERO_ASSERT2(s_consumed == 1000, "consumed=" << s_consumed);
+    {
+        zero::FiberMutex::Lock lock(s_queue_mutex);
+        for (int i = 0; i < 4; ++i) {
+            s_queue.push(-1);
+        }
+    }
+    s_queue_cond.notifyAll();
+    start = zero::GetCurrentMS();
+    while (s_exited != 4 && zero::GetCurrentMS() - start < 5000) {
+        usleep(1000);
+    }
+    ZERO_ASSERT2(s_exited == 4, "exited=" << s_exited);
+    sc.stop();
+    ZERO_ASSERT2(s_consumed == 1000 && s_queue.empty(), "consumed=" << s_consumed << " left=" << s_queue.size());
+    ZERO_LOG_INFO(g_logger) << "test_condition consumed=" << s_consumed;
+}
+
+static zero::FiberSemaphore s_sem(3);
+static std::atomic<int> s_inside{ 0 };
+
+void Test_Semaphore_Func() {
+    for (int i = 0; i < 100; ++i) {
+        s_sem.wait();
+        int inside = ++s_inside;
+        ZERO_ASSERT2(inside <= 3, "inside=" << inside);
+        zero::Fiber::YieldToReady();
+        --s_inside;
+        s_sem.notify();
+    }
+}
+
+void Test_Semaphore() {
+    zero::Scheduler sc(3, false, "test_semaphore");
+    sc.start();
+    for (int i = 0; i < 10; ++i) {
+        sc.schedule(&Test_Semaphore_Func);
+    }
+    sc.stop();
+    ZERO_ASSERT(s_sem.getCount() == 3);
+    ZERO_LOG_INFO(g_logger) << "test_semaphore count=" << s_sem.getCount();
+}
+
+static zero::FiberRWMutex s_rwmutex;
+static std::atomic<int> s_readers{ 0 };
+static std::atomic<int> s_writers{ 0 };
+static int s_value = 0;
+
+void Test_Reader() {
+    for (int i = 0; i < 200; ++i) {
+        zero::FiberRWMutex::ReadLock lock(s_rwmutex);
+        ++s_readers;
+        ZERO_ASSERT(s_writers == 0);
+        zero::Fiber::YieldToReady();
+        --s_readers;
+    }
+}
+
+void Test_Writer() {
+    for (int i = 0; i < 100; ++i) {
+        zero::FiberRWMutex::WriteLock lock(s_rwmutex);
+        int writers = ++s_writers;
+        ZERO_ASSERT(writers == 1 && s_readers == 0);
+        int v = s_value;
+        zero::Fiber::YieldToReady();
+        s_value = v + 1;
+        --s_writers;
+    }
+}
+
+void Test_RWMutex() {
+    zero::Scheduler sc(3, false, "test_rwmutex");
+    sc.start();
+    for (int i = 0; i < 8; ++i) {
+        sc.schedule(&Test_Reader);
+    }
+    for (int i = 0; i < 4; ++i) {
+        sc.schedule(&Test_Writer);
+    }
+    sc.stop();
+    ZERO_ASSERT2(s_value == 400, "s_value=" << s_value);
+    ZERO_LOG_INFO(g_logger) << "test_rwmutex value=" << s_value;
+}
+
+int main() {
+    ZERO_LOG_NAME("system")->setLevel(zero::LogLevel::ERROR);
+    Test_Mutex();
+    Test_Condition();
+    Test_Semaphore();
+    Test_RWMutex();
+    return 0;
+}
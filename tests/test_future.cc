@@ -0,0 +1,115 @@
+#include "zero/future.h"
+#include "zero/iomanager.h"
+#include "zero/log.h"
+#include "zero/macro.h"
+#include "zero/util.h"
+#include <atomic>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+
+static zero::Logger::ptr g_logger = ZERO_LOG_ROOT();
+
+/// 扇出多个任务，等待全部结果后汇总
+void Test_Fan_Out() {
+    zero::IOManager iom(2, false, "test_future");
+    iom.schedule([&iom]() {
+        std::vector<zero::Future<int>> futures;
+        for (int i = 0; i < 100; ++i) {
+            futures.push_back(zero::Async(&iom, [i]() {
+                zero::Fiber::YieldToReady();
+                return i * i;
+            }));
+        }
+        ZERO_ASSERT(zero::whenAll(futures));
+        int sum = 0;
+        for (auto& i : futures) {
+            sum += i.get();
+        }
+        ZERO_ASSERT2(sum == 328350, "sum=" << sum);
+        ZERO_LOG_INFO(g_logger) << "test_fan_out sum=" << sum;
+    });
+}
+
+void Test_Exception_Void() {
+    zero::IOManager iom(1, false, "test_future_ex");
+    iom.schedule([&iom]() {
+        zero::Future<void> f = zero::Async(&iom, []() { throw std::runtime_error("oops"); });
+        bool caught = false;
+        try {
+            f.get();
+        } catch (std::runtime_error& e) {
+            caught = std::string(e.what()) == "oops";
+        }
+        ZERO_ASSERT(caught);
+
+        zero::Future<std::string> broken;
+        {
+            zero::Promise<std::string> p;
+            broken = p.getFuture();
+        }
+        caught = false;
+        try {
+            broken.get();
+        } catch (std::runtime_error& e) {
+            caught = true;
+        }
+        ZERO_ASSERT(caught);
+        ZERO_LOG_INFO(g_logger) << "test_exception_void ok";
+    });
+}
+
+void Test_Timeout_Any() {
+    zero::IOManager iom(1, false, "test_future_any");
+    iom.schedule([]() {
+        std::shared_ptr<zero::Promise<int>> slow(new zero::Promise<int>);
+        std::shared_ptr<zero::Promise<int>> fast(new zero::Promise<int>);
+        std::vector<zero::Future<int>> futures = { slow->getFuture(), fast->getFuture() };
+
+        uint64_t start = zero::GetCurrentMS();
+        ZERO_ASSERT(!futures[0].waitFor(50));
+        ZERO_ASSERT(zero::whenAny(futures, 50) == -1);
+        ZERO_LOG_INFO(g_logger) << "timeout used=" << zero::GetCurrentMS() - start << "ms";
+
+        zero::IOManager::GetThis()->addTimer(50, [fast]() { fast->setValue(7); });
+        zero::IOManager::GetThis()->addTimer(200, [slow]() { slow->setValue(9); });
+        int idx = zero::whenAny(futures, 1000);
+        ZERO_ASSERT2(idx == 1 && futures[1].get() == 7, "idx=" << idx);
+        ZERO_ASSERT(zero::whenAll(futures, 1000));
+        ZERO_ASSERT(futures[0].get() == 9);
+        ZERO_LOG_INFO(g_logger) << "test_timeout_any ok";
+    });
+}
+
+void Test_WaitGroup() {
+    std::atomic<int> count{ 0 };
+    zero::WaitGroup wg;
+    {
+        zero::IOManager iom(2, false, "test_waitgroup");
+        wg.add(50);
+        for (int i = 0; i < 50; ++i) {
+            iom.schedule([&count, &wg]() {
+                usleep(1000);
+                ++count;
+                wg.done();
+            });
+        }
+        iom.schedule([&count, &wg]() {
+            ZERO_ASSERT(wg.wait());
+            ZERO_ASSERT2(count == 50, "count=" << count);
+        });
+        /// 主线程不在协程中，阻塞等待
+        ZERO_ASSERT(wg.wait());
+        ZERO_ASSERT(wg.getCount() == 0);
+    }
+    ZERO_LOG_INFO(g_logger) << "test_waitgroup count=" << count;
+}
+
+int main() {
+    ZERO_LOG_NAME("system")->setLevel(zero::LogLevel::ERROR);
+    Test_Fan_Out();
+    Test_Exception_Void();
+    Test_Timeout_Any();
+    Test_WaitGroup();
+    return 0;
+}
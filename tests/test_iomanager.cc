@@ -0,0 +1,331 @@
+#include "zero/clock.h"
+#include "zero/config.h"
+#include "zero/fd_manager.h"
+#include "zero/fiber.h"
+#include "zero/hook.h"
+#include "zero/iomanager.h"
+#include "zero/log.h"
+#include "zero/macro.h"
+#include "zero/thread.h"
+#include "zero/util.h"
+#include <atomic>
+#include <functional>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static zero::Logger::ptr g_logger = ZERO_LOG_ROOT();
+
+/// 多个连接并发回显，每个连接的两端各一个协程，读写在hook中挂起到IOManager上等待事件
+
+static std::atomic<int> s_done{ 0 };
+
+static bool Read_Full(int fd, char* buf, size_t len) {
+    size_t got = 0;
+    while (got < len) {
+        ssize_t n = read(fd, buf + got, len - got);
+        if (n <= 0) {
+            return false;
+        }
+        got += n;
+    }
+    return true;
+}
+
+void Echo_Server(int fd) {
+    char buf[64];
+    while (true) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n <= 0) {
+            break;
+        }
+        ZERO_ASSERT(write(fd, buf, n) == n);
+    }
+    close(fd);
+}
+
+void Echo_Client(int fd, int rounds) {
+    char msg[32];
+    char buf[32];
+    for (int i = 0; i < rounds; ++i) {
+        int len = snprintf(msg, sizeof(msg), "ping %d fd=%d", i, fd);
+        ZERO_ASSERT(write(fd, msg, len) == len);
+        ZERO_ASSERT(Read_Full(fd, buf, len));
+        ZERO_ASSERT2(memcmp(msg, buf, len) == 0, "fd=" << fd << " round=" << i);
+    }
+    close(fd);
+    ++s_done;
+}
+
+void Test_Echo(bool multi_reactor, bool io_uring = false, bool persistent = false) {
+    zero::Config::Lookup<bool>("iomanager.multi_reactor")->setValue(multi_reactor);
+    zero::Config::Lookup<bool>("iomanager.io_uring")->setValue(io_uring);
+    zero::Config::Lookup<bool>("iomanager.persistent_epoll")->setValue(persistent);
+    s_done = 0;
+    const int conns = 16;
+    const int rounds = 1000;
+    uint64_t start = zero::GetCurrentMS();
+    {
+        zero::IOManager iom(4, false, multi_reactor ? "test_multi_reactor" : "test_reactor");
+        /// io_uring后端强制多反应堆，内核不支持时回退到epoll
+        ZERO_ASSERT(iom.isMultiReactor() == (multi_reactor || iom.isIoUring()));
+        ZERO_ASSERT(iom.isIoUring() == (io_uring && zero::IoUring::IsSupported()));
+        ZERO_ASSERT(iom.isPersistentEpoll() == persistent);
+        /// 分两批，第二批复用第一批关闭的fd号，验证关闭时清理了fd上下文
+        for (int i = 0; i < conns; ++i) {
+            if (i == conns / 2) {
+                while (s_done < conns / 2) {
+                    usleep(1000);
+                }
+            }
+            int fds[2];
+            ZERO_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+            zero::FdMgr::GetInstance()->get(fds[0], true);
+            zero::FdMgr::GetInstance()->get(fds[1], true);
+            iom.schedule(std::bind(&Echo_Server, fds[0]));
+            iom.schedule(std::bind(&Echo_Client, fds[1], rounds));
+        }
+    }
+    zero::Config::Lookup<bool>("iomanager.io_uring")->setValue(false);
+    zero::Config::Lookup<bool>("iomanager.persistent_epoll")->setValue(false);
+    ZERO_ASSERT2(s_done == conns, "done=" << s_done);
+    ZERO_LOG_INFO(g_logger) << "test_echo multi_reactor=" << multi_reactor << " io_uring=" << io_uring
+                            << " persistent=" << persistent << " conns=" << conns << " rounds=" << rounds << " used=" << zero::GetCurrentMS() - start
+                            << "ms";
+}
+
+/// use_caller模式下caller线程只在stop时进入调度循环，非工作线程注册的fd不能分给它的reactor
+void Test_Use_Caller_Reactor() {
+    bool multi_reactor = zero::Config::Lookup<bool>("iomanager.multi_reactor")->getValue();
+    zero::Config::Lookup<bool>("iomanager.multi_reactor")->setValue(true);
+    s_done = 0;
+    const int conns = 6;
+    int fds[conns][2];
+    {
+        zero::IOManager iom(3, true, "test_use_caller_reactor");
+        ZERO_ASSERT(iom.isMultiReactor());
+        for (int i = 0; i < conns; ++i) {
+            ZERO_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds[i]) == 0);
+            zero::FdMgr::GetInstance()->get(fds[i][0], true);
+            ZERO_ASSERT(iom.addEvent(fds[i][0], zero::IOManager::READ, []() { ++s_done; }) == 0);
+            ZERO_ASSERT(write(fds[i][1], "x", 1) == 1);
+        }
+        /// 在stop之前事件就要全部触发
+        uint64_t start = zero::GetCurrentMS();
+        while (s_done < conns && zero::GetCurrentMS() - start < 2000) {
+            usleep(1000);
+        }
+        ZERO_ASSERT2(s_done == conns, "done=" << s_done);
+    }
+    /// caller线程在stop中进入过调度循环，hook仍处于开启状态，恢复后后面的用例在主线程上直接调用系统函数
+    zero::set_hook_enable(false);
+    for (int i = 0; i < conns; ++i) {
+        /// 未hook的close不会清理fd上下文，fd号被后面的用例复用时会拿到旧的上下文
+        zero::FdMgr::GetInstance()->del(fds[i][0]);
+        close(fds[i][0]);
+        close(fds[i][1]);
+    }
+    zero::Config::Lookup<bool>("iomanager.multi_reactor")->setValue(multi_reactor);
+    ZERO_LOG_INFO(g_logger) << "test_use_caller_reactor ok";
+}
+
+/// 常驻注册的fd绕过hook关闭，同号的新fd拿到旧的注册状态，仍要重新加入epoll
+void Test_Persistent_Reuse() {
+    zero::Config::Lookup<bool>("iomanager.persistent_epoll")->setValue(true);
+    s_done = 0;
+    int fds[2];
+    {
+        zero::IOManager iom(1, false, "test_persistent_reuse");
+        ZERO_ASSERT(iom.isPersistentEpoll());
+        iom.schedule([&iom, &fds]() {
+            int old[2];
+            ZERO_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, old) == 0);
+            zero::FdMgr::GetInstance()->get(old[0], true);
+            ZERO_ASSERT(iom.addEvent(old[0], zero::IOManager::READ, []() { ++s_done; }) == 0);
+            ZERO_ASSERT(write(old[1], "x", 1) == 1);
+            while (s_done < 1) {
+                usleep(1000);
+            }
+            close_f(old[0]);
+            close_f(old[1]);
+
+            ZERO_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+            ZERO_ASSERT2(fds[0] == old[0], "fd not reused old=" << old[0] << " new=" << fds[0]);
+            zero::FdMgr::GetInstance()->get(fds[0], true);
+            ZERO_ASSERT(iom.addEvent(fds[0], zero::IOManager::READ, []() { ++s_done; }) == 0);
+            usleep(10 * 1000);
+            ZERO_ASSERT(write(fds[1], "y", 1) == 1);
+        });
+        uint64_t start = zero::GetCurrentMS();
+        while (s_done < 2 && zero::GetCurrentMS() - start < 2000) {
+            usleep(1000);
+        }
+        ZERO_ASSERT2(s_done == 2, "done=" << s_done);
+        iom.cancelAll(fds[0]);
+    }
+    zero::FdMgr::GetInstance()->del(fds[0]);
+    close(fds[0]);
+    close(fds[1]);
+    zero::Config::Lookup<bool>("iomanager.persistent_epoll")->setValue(false);
+    ZERO_LOG_INFO(g_logger) << "test_persistent_reuse ok";
+}
+
+/// 带序号的取消只对那一次等待生效，超时回调晚到时不会取消fd上之后的等待
+void Test_Cancel_Seq() {
+    s_done = 0;
+    int fds[2];
+    ZERO_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    zero::FdMgr::GetInstance()->get(fds[0], true);
+    {
+        zero::IOManager iom(1, false, "test_cancel_seq");
+        iom.schedule([&iom, &fds]() {
+            uint64_t first = 0;
+            ZERO_ASSERT(iom.addEvent(fds[0], zero::IOManager::READ, []() { ++s_done; }, &first) == 0);
+            ZERO_ASSERT(iom.cancelEvent(fds[0], zero::IOManager::READ, first));
+            uint64_t second = 0;
+            ZERO_ASSERT(iom.addEvent(fds[0], zero::IOManager::READ, []() { s_done += 10; }, &second) == 0);
+            ZERO_ASSERT(second != first);
+            ZERO_ASSERT(!iom.cancelEvent(fds[0], zero::IOManager::READ, first));
+            ZERO_ASSERT(write(fds[1], "x", 1) == 1);
+        });
+        uint64_t start = zero::GetCurrentMS();
+        while (s_done < 11 && zero::GetCurrentMS() - start < 2000) {
+            usleep(1000);
+        }
+        ZERO_ASSERT2(s_done == 11, "done=" << s_done);
+    }
+    zero::FdMgr::GetInstance()->del(fds[0]);
+    close(fds[0]);
+    close(fds[1]);
+    ZERO_LOG_INFO(g_logger) << "test_cancel_seq ok";
+}
+
+/// 读超时和关闭时取消等待(io_uring后端为取消在途请求)
+void Test_Timeout_Cancel(bool io_uring, bool persistent) {
+    zero::Config::Lookup<bool>("iomanager.io_uring")->setValue(io_uring);
+    zero::Config::Lookup<bool>("iomanager.persistent_epoll")->setValue(persistent);
+    s_done = 0;
+    /// 两个用例各用一对socket，关闭一端会让另一端读到EOF
+    int fds[4];
+    ZERO_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    ZERO_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds + 2) == 0);
+    {
+        zero::IOManager iom(2, false, "test_timeout");
+        for (int fd : fds) {
+            zero::FdMgr::GetInstance()->get(fd, true);
+        }
+        iom.schedule([fds]() {
+            struct timeval tv = { 0, 100 * 1000 };
+            setsockopt(fds[0], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+            char buf[8];
+            uint64_t start = zero::GetCurrentMS();
+            ssize_t n = read(fds[0], buf, sizeof(buf));
+            uint64_t used = zero::GetCurrentMS() - start;
+            ZERO_ASSERT2(n == -1 && errno == ETIMEDOUT, "n=" << n << " errno=" << errno);
+            ZERO_ASSERT2(used >= 90 && used < 1000, "used=" << used);
+            ++s_done;
+        });
+        /// 协程阻塞在读上时定时器关闭fd，读以EBADF返回；设置了读超时也不能当成超时
+        iom.schedule([fds]() {
+            struct timeval tv = { 1, 0 };
+            setsockopt(fds[2], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+            char buf[8];
+            ssize_t n = read(fds[2], buf, sizeof(buf));
+            ZERO_ASSERT2(n == -1 && errno == EBADF, "n=" << n << " errno=" << errno);
+            ++s_done;
+        });
+        iom.addTimer(50, [fds]() { close(fds[2]); });
+    }
+    zero::Config::Lookup<bool>("iomanager.io_uring")->setValue(false);
+    zero::Config::Lookup<bool>("iomanager.persistent_epoll")->setValue(false);
+    close(fds[0]);
+    close(fds[1]);
+    close(fds[3]);
+    ZERO_ASSERT2(s_done == 2, "done=" << s_done);
+    ZERO_LOG_INFO(g_logger) << "test_timeout_cancel io_uring=" << io_uring << " persistent=" << persistent << " ok";
+}
+
+/// 协程截止时间：多次读共享一个时间预算，过了截止时间直接失败，休眠也不会超过截止时间
+void Test_Fiber_Deadline(bool io_uring) {
+    zero::Config::Lookup<bool>("iomanager.io_uring")->setValue(io_uring);
+    s_done = 0;
+    int fds[2];
+    ZERO_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    {
+        zero::IOManager iom(2, false, "test_deadline");
+        zero::FdMgr::GetInstance()->get(fds[0], true);
+        zero::FdMgr::GetInstance()->get(fds[1], true);
+        iom.schedule([fds]() {
+            struct timeval tv = { 0, 80 * 1000 };
+            setsockopt(fds[0], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+            char buf[8];
+            {
+                zero::DeadlineScope scope(150);
+                /// 每次读最多80ms，没有截止时间时5次要400ms
+                uint64_t start = zero::Clock::MonotonicMS();
+                for (int i = 0; i < 5; ++i) {
+                    ssize_t n = read(fds[0], buf, sizeof(buf));
+                    ZERO_ASSERT2(n == -1 && errno == ETIMEDOUT, "i=" << i << " n=" << n << " errno=" << errno);
+                }
+                uint64_t used = zero::Clock::MonotonicMS() - start;
+                ZERO_ASSERT2(used >= 140 && used < 300, "used=" << used);
+                /// 嵌套的更晚的截止时间不生效
+                {
+                    zero::DeadlineScope inner(1000);
+                    ZERO_ASSERT(zero::Fiber::GetRemainingUS() == 0);
+                }
+                /// 已经过了截止时间，数据就绪也直接失败
+                ZERO_ASSERT(write(fds[1], "x", 1) == -1 && errno == ETIMEDOUT);
+                ZERO_ASSERT(usleep(1000) == -1 && errno == ETIMEDOUT);
+            }
+            /// 离开作用域后恢复
+            ZERO_ASSERT(zero::Fiber::GetThis()->getDeadline() == ~0ull);
+            /// 超出范围的时长不设置截止时间，而不是溢出成一个很早的时刻
+            {
+                zero::DeadlineScope scope(~0ull);
+                ZERO_ASSERT(zero::Fiber::GetThis()->getDeadline() == ~0ull);
+                zero::DeadlineScope scope2(~0ull / 1000);
+                ZERO_ASSERT(zero::Fiber::GetThis()->getDeadline() == ~0ull);
+            }
+            ZERO_ASSERT(write(fds[1], "x", 1) == 1);
+            ZERO_ASSERT(read(fds[0], buf, sizeof(buf)) == 1);
+            {
+                zero::DeadlineScope scope(50);
+                uint64_t start = zero::Clock::MonotonicMS();
+                ZERO_ASSERT(usleep(1000 * 1000) == -1 && errno == ETIMEDOUT);
+                uint64_t used = zero::Clock::MonotonicMS() - start;
+                ZERO_ASSERT2(used >= 45 && used < 300, "used=" << used);
+            }
+            ++s_done;
+        });
+    }
+    zero::Config::Lookup<bool>("iomanager.io_uring")->setValue(false);
+    close(fds[0]);
+    close(fds[1]);
+    ZERO_ASSERT2(s_done == 1, "done=" << s_done);
+    /// 没有协程的线程上不生效
+    zero::Thread t([]() {
+        zero::DeadlineScope scope(10);
+        ZERO_ASSERT(zero::Fiber::GetRemainingUS() == ~0ull);
+    }, "test_no_fiber");
+    t.join();
+    ZERO_LOG_INFO(g_logger) << "test_fiber_deadline io_uring=" << io_uring << " ok";
+}
+
+int main() {
+    ZERO_LOG_NAME("system")->setLevel(zero::LogLevel::ERROR);
+    Test_Echo(false);
+    Test_Echo(true);
+    Test_Echo(false, true);
+    Test_Echo(false, false, true);
+    Test_Echo(true, false, true);
+    Test_Use_Caller_Reactor();
+    Test_Persistent_Reuse();
+    Test_Cancel_Seq();
+    Test_Timeout_Cancel(false, false);
+    Test_Timeout_Cancel(true, false);
+    Test_Timeout_Cancel(false, true);
+    Test_Fiber_Deadline(false);
+    Test_Fiber_Deadline(true);
+    return 0;
+}
@@ -0,0 +1,178 @@
+#include "zero/address.h"
+#include "zero/clock.h"
+#include "zero/config.h"
+#include "zero/fiber.h"
+#include "zero/hook.h"
+#include "zero/iomanager.h"
+#include "zero/log.h"
+#include "zero/macro.h"
+#include "zero/offload.h"
+#include <atomic>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static zero::Logger::ptr g_logger = ZERO_LOG_ROOT();
+
+/// 阻塞调用卸载：协程把阻塞调用交给线程池，调度线程继续运行其他协程
+
+static std::atomic<int> s_done{ 0 };
+
+void Test_Not_Stall() {
+    s_done = 0;
+    std::atomic<int> ticks{ 0 };
+    {
+        /// 只有一个调度线程，阻塞调用如果在调度线程上执行，计时协程在这期间不会运行
+        zero::IOManager iom(1, false, "test_not_stall");
+        iom.schedule([&ticks]() {
+            uint64_t start = zero::Clock::MonotonicMS();
+            /// usleep_f是未hook的系统调用，模拟阻塞的磁盘读写
+            zero::Offload::GetInstance()->run([]() { usleep_f(200 * 1000); });
+            uint64_t used = zero::Clock::MonotonicMS() - start;
+            ZERO_ASSERT2(used >= 190, "used=" << used);
+            ZERO_ASSERT2(ticks >= 5, "ticks=" << ticks);
+            ++s_done;
+        });
+        iom.schedule([&ticks]() {
+            for (int i = 0; i < 10; ++i) {
+                usleep(10 * 1000);
+                ++ticks;
+            }
+        });
+    }
+    ZERO_ASSERT2(s_done == 1, "done=" << s_done);
+    ZERO_LOG_INFO(g_logger) << "test_not_stall ticks=" << ticks << " ok";
+}
+
+void Test_File_IO() {
+    s_done = 0;
+    {
+        zero::IOManager iom(2, false, "test_file_io");
+        iom.schedule([]() {
+            zero::Offload* offload = zero::Offload::GetInstance();
+            uint64_t completed = offload->getCompleted();
+
+            /// errno带回提交的协程
+            errno = 0;
+            ZERO_ASSERT(open("/nonexistent/zero_offload", O_RDONLY) == -1 && errno == ENOENT);
+
+            char path[] = "/tmp/zero_offload_XXXXXX";
+            int tmp = mkstemp(path);
+            ZERO_ASSERT(tmp >= 0);
+            close(tmp);
+
+            int fd = open(path, O_RDWR | O_TRUNC);
+            ZERO_ASSERT(fd >= 0);
+            const char data[] = "hello offload";
+            ZERO_ASSERT(write(fd, data, sizeof(data)) == sizeof(data));
+            ZERO_ASSERT(fsync(fd) == 0);
+            struct stat st;
+            ZERO_ASSERT(stat(path, &st) == 0 && st.st_size == sizeof(data));
+
+            char buf[sizeof(data)] = { 0 };
+            ZERO_ASSERT(pread(fd, buf, sizeof(buf), 0) == sizeof(data));
+            ZERO_ASSERT(memcmp(buf, data, sizeof(data)) == 0);
+            ZERO_ASSERT(pwrite(fd, "H", 1, 0) == 1);
+            ZERO_ASSERT(lseek(fd, 0, SEEK_SET) == 0);
+            ZERO_ASSERT(read(fd, buf, sizeof(buf)) == sizeof(data));
+            ZERO_ASSERT(buf[0] == 'H');
+            close(fd);
+            unlink(path);
+
+            /// open(2次)、write、fsync、stat、pread、pwrite、read
+            uint64_t used = offload->getCompleted() - completed;
+            ZERO_ASSERT2(used >= 8, "used=" << used);
+            ++s_done;
+        });
+    }
+    ZERO_ASSERT2(s_done == 1, "done=" << s_done);
+    ZERO_LOG_INFO(g_logger) << "test_file_io threads=" << zero::Offload::GetInstance()->getThreadCount() << " ok";
+}
+
+/// 共享栈协程挂起后栈会被其他协程复用，不能交给池中线程回写，直接在调度线程上执行
+void Test_Shared_Stack() {
+    s_done = 0;
+    char path[] = "/tmp/zero_offload_XXXXXX";
+    int fd = mkstemp(path);
+    ZERO_ASSERT(fd >= 0);
+    const char data[] = "shared stack pread";
+    ZERO_ASSERT(write(fd, data, sizeof(data)) == sizeof(data));
+    uint64_t completed = zero::Offload::GetInstance()->getCompleted();
+    {
+        zero::IOManager iom(1, false, "test_shared_stack");
+        for (int i = 0; i < 4; ++i) {
+            iom.schedule(zero::Fiber::ptr(new zero::Fiber(
+                [fd, &data, i]() {
+                    char mark[256];
+                    memset(mark, i + 1, sizeof(mark));
+                    for (int j = 0; j < 10; ++j) {
+                        char buf[sizeof(data)] = { 0 };
+                        ZERO_ASSERT(pread(fd, buf, sizeof(buf), 0) == sizeof(data));
+                        ZERO_ASSERT(memcmp(buf, data, sizeof(data)) == 0);
+                        zero::Fiber::YieldToReady();
+                    }
+                    for (size_t j = 0; j < sizeof(mark); ++j) {
+                        ZERO_ASSERT2(mark[j] == (char)(i + 1), "shared stack corrupted i=" << i);
+                    }
+                    ++s_done;
+                },
+                0, false, true)));
+        }
+    }
+    close(fd);
+    unlink(path);
+    ZERO_ASSERT2(s_done == 4, "done=" << s_done);
+    ZERO_ASSERT(zero::Offload::GetInstance()->getCompleted() == completed);
+    ZERO_LOG_INFO(g_logger) << "test_shared_stack ok";
+}
+
+void Test_Lookup() {
+    s_done = 0;
+    {
+        zero::IOManager iom(1, false, "test_lookup");
+        iom.schedule([]() {
+            uint64_t completed = zero::Offload::GetInstance()->getCompleted();
+            zero::Address::ptr addr = zero::Address::LookupAny("localhost:80");
+            ZERO_ASSERT(addr);
+            ZERO_ASSERT(zero::Offload::GetInstance()->getCompleted() > completed);
+            ZERO_LOG_INFO(g_logger) << "localhost=" << addr->toString();
+            ++s_done;
+        });
+    }
+    ZERO_ASSERT2(s_done == 1, "done=" << s_done);
+    ZERO_LOG_INFO(g_logger) << "test_lookup ok";
+}
+
+void Test_Disabled() {
+    zero::Config::Lookup<uint32_t>("offload.threads")->setValue(0);
+    s_done = 0;
+    {
+        zero::IOManager iom(1, false, "test_disabled");
+        iom.schedule([]() {
+            /// 关闭后在当前线程直接执行
+            uint64_t completed = zero::Offload::GetInstance()->getCompleted();
+            struct stat st;
+            ZERO_ASSERT(stat("/tmp", &st) == 0);
+            ZERO_ASSERT(zero::Offload::GetInstance()->getCompleted() == completed);
+            ++s_done;
+        });
+    }
+    zero::Config::Lookup<uint32_t>("offload.threads")->setValue(4);
+    ZERO_ASSERT2(s_done == 1, "done=" << s_done);
+    ZERO_LOG_INFO(g_logger) << "test_disabled ok";
+}
+
+int main() {
+    ZERO_LOG_NAME("system")->setLevel(zero::LogLevel::ERROR);
+    /// 不在协程中，直接执行
+    zero::Offload::GetInstance()->run([]() { errno = 0; });
+    ZERO_ASSERT(zero::Offload::GetInstance()->getThreadCount() == 0);
+    Test_Not_Stall();
+    Test_File_IO();
+    Test_Shared_Stack();
+    Test_Lookup();
+    Test_Disabled();
+    return 0;
+}
@@ -1,9 +1,12 @@
 #include "zero/fiber.h"
 #include "zero/log.h"
+#include "zero/macro.h"
 #include "zero/scheduler.h"
 #include "zero/thread.h"
 #include "zero/util.h"
+#include <atomic>
 #include <functional>
+#include <string.h>
 #include <unistd.h>
 
 static zero::Logger::ptr g_logger = ZERO_LOG_ROOT();
@@ -76,7 +79,62 @@ void sylar_test() {
     ZERO_LOG_INFO(g_logger) << "over";
 }
 
+/// 共享栈协程：多个协程轮流使用同一块栈，切出时备份已用部分，切回时恢复，栈上数据不应被破坏
+void Test_Shared_Stack_Func(int val) {
+    char buf[4096];
+    memset(buf, val, sizeof(buf));
+    int tid = zero::GetThreadId();
+    for (int i = 0; i < 10; ++i) {
+        zero::Fiber::GetThis()->YieldToReady();
+        for (size_t j = 0; j < sizeof(buf); ++j) {
+            ZERO_ASSERT2(buf[j] == (char)val, "shared stack corrupted val=" << val);
+        }
+        /// 共享栈协程绑定在第一次运行的线程上
+        ZERO_ASSERT(tid == zero::GetThreadId());
+    }
+    ZERO_LOG_INFO(g_logger) << "shared stack fiber val=" << val << " ok";
+}
+
+void Test_Shared_Stack() {
+    zero::Scheduler sc(3, false, "test_shared_stack");
+    sc.start();
+    for (int i = 0; i < 20; ++i) {
+        sc.schedule(zero::Fiber::ptr(new zero::Fiber(std::bind(&Test_Shared_Stack_Func, i + 1), 0, false, true)));
+    }
+    sc.stop();
+    ZERO_LOG_INFO(g_logger) << "test_shared_stack end";
+}
+
+/// 指定线程的任务投递到目标线程的信箱，必须在目标线程上执行
+static std::atomic<int> s_last_tid{ 0 };
+static std::atomic<int> s_pinned_count{ 0 };
+
+void Test_Pinned_Func(int target, int remain) {
+    int tid = zero::GetThreadId();
+    ZERO_ASSERT2(target == -1 || target == tid, "target=" << target << " tid=" << tid);
+    ++s_pinned_count;
+    /// 下一跳指定到上一个记录的线程，可能是其他线程也可能是自己
+    int next = s_last_tid.exchange(tid);
+    if (--remain > 0) {
+        next = next ? next : tid;
+        zero::Scheduler::GetThis()->schedule(std::bind(&Test_Pinned_Func, next, remain), next);
+    }
+}
+
+void Test_Pinned() {
+    zero::Scheduler sc(3, false, "test_pinned");
+    sc.start();
+    for (int i = 0; i < 5; ++i) {
+        sc.schedule(std::bind(&Test_Pinned_Func, -1, 200));
+    }
+    sc.stop();
+    ZERO_ASSERT2(s_pinned_count == 1000, "count=" << s_pinned_count);
+    ZERO_LOG_INFO(g_logger) << "test_pinned count=" << s_pinned_count << " ok";
+}
+
 int main() {
+    Test_Shared_Stack();
+    Test_Pinned();
     Test_Not_User_Caller();
     sylar_test();
     // Test_User_Caller();  /// 会陷入忙等待
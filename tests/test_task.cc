@@ -0,0 +1,118 @@
+#include "zero/log.h"
+#include "zero/macro.h"
+#include "zero/scheduler.h"
+#include "zero/task.h"
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <new>
+#include <string>
+
+static zero::Logger::ptr g_logger = ZERO_LOG_ROOT();
+
+/// 统计本线程的堆分配次数
+static thread_local size_t t_alloc_count = 0;
+
+void* operator new(size_t size) {
+    ++t_alloc_count;
+    void* p = malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+static int s_value = 0;
+
+static void Add_Func() {
+    ++s_value;
+}
+
+/// 捕获不多的lambda就地存放，构造、移动、调用都不分配内存
+void Test_Inline() {
+    int a = 1;
+    int* b = &a;
+    std::string* c = nullptr;
+    size_t before = t_alloc_count;
+    zero::Task t1([a, b, c]() { s_value += a + *b + (c ? 1 : 0); });
+    zero::Task t2(std::move(t1));
+    zero::Task t3;
+    t3 = std::move(t2);
+    t3();
+    zero::Task t4(&Add_Func);
+    t4();
+    ZERO_ASSERT(!t1 && !t2 && t3 && t4);
+    ZERO_ASSERT2(t_alloc_count == before, "alloc=" << t_alloc_count - before);
+    ZERO_ASSERT(s_value == 3);
+    ZERO_LOG_INFO(g_logger) << "test_inline ok";
+}
+
+/// 超过SBO_SIZE的可调用对象放到堆上，移动时只转移指针
+void Test_Heap() {
+    char big[zero::Task::SBO_SIZE + 1] = { 1 };
+    size_t before = t_alloc_count;
+    zero::Task t1([big]() { s_value += big[0]; });
+    ZERO_ASSERT2(t_alloc_count == before + 1, "alloc=" << t_alloc_count - before);
+    zero::Task t2(std::move(t1));
+    t2();
+    ZERO_ASSERT(t_alloc_count == before + 1);
+    ZERO_ASSERT(s_value == 4);
+
+    /// 只能移动的对象也可以作为回调
+    std::unique_ptr<int> p(new int(5));
+    int* raw = p.get();
+    struct Owner {
+        std::unique_ptr<int> p;
+        void operator()() { s_value += *p; }
+    };
+    zero::Task t3(Owner{ std::move(p) });
+    t3();
+    ZERO_ASSERT(s_value == 9 && raw);
+
+    /// 空的函数指针和std::function得到空Task
+    void (*null_fn)() = nullptr;
+    ZERO_ASSERT(!zero::Task(null_fn));
+    ZERO_ASSERT(!zero::Task(std::function<void()>()));
+    ZERO_ASSERT(zero::Task(std::function<void()>(&Add_Func)).target_type() == typeid(std::function<void()>));
+    ZERO_LOG_INFO(g_logger) << "test_heap ok";
+}
+
+/// 工作线程上调度捕获不多的lambda，任务节点和协程都被复用，稳定后不再分配内存
+static const int s_chain = 10000;
+static const int s_warmup = 100;
+static size_t s_chain_alloc = 0;
+
+static void Chain_Func(zero::Scheduler* sc, int remain, size_t start) {
+    if (remain == s_chain - s_warmup) {
+        start = t_alloc_count;
+    }
+    if (remain == 0) {
+        s_chain_alloc = t_alloc_count - start;
+        return;
+    }
+    sc->schedule([sc, remain, start]() { Chain_Func(sc, remain - 1, start); });
+}
+
+void Test_Schedule_No_Alloc() {
+    zero::Scheduler sc(1, false, "test_task");
+    sc.start();
+    sc.schedule([&sc]() { Chain_Func(&sc, s_chain, 0); });
+    sc.stop();
+    ZERO_ASSERT2(s_chain_alloc == 0, "alloc=" << s_chain_alloc);
+    ZERO_LOG_INFO(g_logger) << "test_schedule_no_alloc tasks=" << s_chain - s_warmup << " alloc=" << s_chain_alloc;
+}
+
+int main() {
+    Test_Inline();
+    Test_Heap();
+    Test_Schedule_No_Alloc();
+    return 0;
+}
@@ -1,10 +1,20 @@
 #include "zero/timer.h"
+#include "zero/clock.h"
+#include "zero/config.h"
 #include "zero/log.h"
 #include "zero/iomanager.h"
+#include "zero/thread.h"
 #include "zero/util.h"
+#include "zero/macro.h"
+#include <algorithm>
+#include <atomic>
 #include <cstdint>
 #include <functional>
+#include <new>
+#include <stdlib.h>
 #include <unistd.h>
+#include <utility>
+#include <vector>
 
 zero::Logger::ptr g_logger = ZERO_LOG_ROOT();
 
@@ -20,21 +30,507 @@ void Test() {
     ZERO_LOG_INFO(g_logger) << "Test start...";
     zero::Timer::ptr timer1 = iom.addTimer(2000, std::bind(&Test_Timer_Func1,3),false);
     sleep(3);
-    ZERO_LOG_INFO(g_logger) << (int64_t)(zero::GetCurrentMS() - timer1->getAccurateTime());
+    ZERO_LOG_INFO(g_logger) << (int64_t)(zero::Clock::MonotonicMS() - timer1->getAccurateTime());
 
 
     zero::Timer::ptr timer2 = iom.addTimer(3000, std::bind(&Test_Timer_Func1,3),false);
-    ZERO_LOG_INFO(g_logger) << zero::GetCurrentMS() - timer2->getAccurateTime();
+    ZERO_LOG_INFO(g_logger) << zero::Clock::MonotonicMS() - timer2->getAccurateTime();
 
     zero::Timer::ptr timer3 = iom.addTimer(3000, std::bind(&Test_Timer_Func1,3),false);
-    ZERO_LOG_INFO(g_logger) << zero::GetCurrentMS() - timer3->getAccurateTime();    
-    std::vector<std::function<void ()>> cbs;
+    ZERO_LOG_INFO(g_logger) << zero::Clock::MonotonicMS() - timer3->getAccurateTime();    
+    std::vector<zero::Task> cbs;
     iom.listExpiredCb(cbs);
     ZERO_LOG_INFO(g_logger) << timer1.get();
     ZERO_LOG_INFO(g_logger) << "Test end...";
 }
 
+/// 手动驱动的定时器管理器，不依赖IOManager
+class Test_Manager : public zero::TimerManager {
+public:
+    int fronts = 0;
+    /// 取到了到期回调的次数
+    int wakeups = 0;
+
+    /**
+     * @brief 按getNextTimerUS休眠并执行到期回调，直到没有定时器或超过max_ms
+     * 
+     * @param max_ms 
+     */
+    void runUntilEmpty(uint64_t max_ms) {
+        uint64_t end = zero::Clock::MonotonicMS() + max_ms;
+        while (zero::Clock::MonotonicMS() < end) {
+            uint64_t next = getNextTimerUS();
+            if (next == ~0ull) {
+                break;
+            }
+            usleep(std::min<uint64_t>(next, 20 * 1000));
+            std::vector<zero::Task> cbs;
+            listExpiredCb(cbs);
+            wakeups += !cbs.empty();
+            for (auto& cb : cbs) {
+                cb();
+            }
+        }
+    }
+
+protected:
+    void onTimerInsertedAtFront(size_t shard) override { ++fronts; }
+};
+
+static std::vector<std::pair<int, uint64_t>> s_fired;
+
+/// 跨越第0层和第1层的定时器按到期时间顺序执行，不早于设定时间
+void Test_Wheel_Order() {
+    Test_Manager mgr;
+    s_fired.clear();
+    int delays[] = { 300, 0, 20, 256, 3, 700, 255, 1, 257, 70 };
+    std::vector<zero::Timer::ptr> timers;
+    for (int d : delays) {
+        timers.push_back(mgr.addTimer(d, [d]() { s_fired.emplace_back(d, zero::Clock::MonotonicMS()); }));
+    }
+    ZERO_ASSERT(mgr.fronts >= 1);
+    mgr.runUntilEmpty(2000);
+    ZERO_ASSERT2(s_fired.size() == timers.size(), "fired=" << s_fired.size());
+    int last = -1;
+    for (size_t i = 0; i < s_fired.size(); ++i) {
+        int d = s_fired[i].first;
+        ZERO_ASSERT2(d >= last, "order " << last << " then " << d);
+        last = d;
+        auto it = std::find(delays, delays + timers.size(), d);
+        uint64_t expect = timers[it - delays]->getAccurateTime();
+        ZERO_ASSERT2(s_fired[i].second >= expect && s_fired[i].second <= expect + 50,
+                     "delay=" << d << " late=" << ( int64_t )(s_fired[i].second - expect));
+    }
+    ZERO_ASSERT(!mgr.hasTimer());
+    ZERO_LOG_INFO(g_logger) << "test_wheel_order ok";
+}
+
+static int s_count = 0;
+
+/// cancel/refresh/reset语义与原来一致
+void Test_Wheel_Cancel_Reset() {
+    Test_Manager mgr;
+    s_count = 0;
+    zero::Timer::ptr t = mgr.addTimer(50, []() { ++s_count; });
+    ZERO_ASSERT(t->cancel());
+    ZERO_ASSERT(!t->cancel());
+    ZERO_ASSERT(!t->refresh());
+    ZERO_ASSERT(!t->reset(10, true));
+    ZERO_ASSERT(!mgr.hasTimer() && mgr.getNextTimer() == ~0ull);
+
+    /// 远处的定时器按槽的起始时间返回，不晚于实际时间
+    zero::Timer::ptr far = mgr.addTimer(20000, []() { ++s_count; });
+    uint64_t next = mgr.getNextTimer();
+    ZERO_ASSERT2(next > 0 && next <= 20000, "next=" << next);
+    zero::Timer::ptr near = mgr.addTimer(100, []() { ++s_count; });
+    next = mgr.getNextTimer();
+    ZERO_ASSERT2(next > 90 && next <= 100, "next=" << next);
+    ZERO_ASSERT(far->cancel());
+    ZERO_ASSERT(near->reset(10, true));
+    next = mgr.getNextTimer();
+    ZERO_ASSERT2(next <= 10, "next=" << next);
+    ZERO_ASSERT(near->refresh());
+    mgr.runUntilEmpty(1000);
+    ZERO_ASSERT(s_count == 1);
+    /// 已执行的一次性定时器不能再取消
+    ZERO_ASSERT(!near->cancel());
+
+    /// 循环定时器每次到期重新挂回时间轮，取消后停止
+    zero::Timer::ptr rec = mgr.addTimer(10, []() { ++s_count; }, true);
+    mgr.runUntilEmpty(65);
+    ZERO_ASSERT2(s_count >= 4 && s_count <= 8, "count=" << s_count);
+    ZERO_ASSERT(rec->cancel());
+    ZERO_ASSERT(!mgr.hasTimer());
+
+    /// 已经交给调度器但还没开始执行的循环回调，取消后不再执行
+    s_count = 0;
+    rec = mgr.addTimer(10, []() { ++s_count; }, true);
+    usleep(20 * 1000);
+    std::vector<zero::Task> cbs;
+    mgr.listExpiredCb(cbs);
+    ZERO_ASSERT(cbs.size() == 1);
+    ZERO_ASSERT(rec->cancel());
+    cbs[0]();
+    ZERO_ASSERT2(s_count == 0, "count=" << s_count);
+    ZERO_LOG_INFO(g_logger) << "test_wheel_cancel_reset ok";
+}
+
+/// 大量定时器的插入和取消开销
+void Test_Wheel_Scale() {
+    Test_Manager mgr;
+    const int count = 200000;
+    std::vector<zero::Timer::ptr> timers;
+    timers.reserve(count);
+    srand(1);
+    uint64_t start = zero::GetCurrentUS();
+    for (int i = 0; i < count; ++i) {
+        timers.push_back(mgr.addTimer(1000 + rand() % 60000, []() {}));
+    }
+    uint64_t add_us = zero::GetCurrentUS() - start;
+    start = zero::GetCurrentUS();
+    for (auto& t : timers) {
+        ZERO_ASSERT(t->cancel());
+    }
+    uint64_t cancel_us = zero::GetCurrentUS() - start;
+    ZERO_ASSERT(!mgr.hasTimer());
+    ZERO_LOG_INFO(g_logger) << "test_wheel_scale timers=" << count << " add ns/op=" << add_us * 1000.0 / count
+                            << " cancel ns/op=" << cancel_us * 1000.0 / count;
+}
+
+/// 同一毫秒内和相邻毫秒的微秒定时器按微秒顺序执行，不早于设定时间
+void Test_Wheel_US() {
+    Test_Manager mgr;
+    std::vector<std::pair<uint64_t, uint64_t>> fired;
+    uint64_t delays[] = { 1300, 150, 600, 300, 2500, 999, 1000, 1001 };
+    std::vector<zero::Timer::ptr> timers;
+    for (uint64_t d : delays) {
+        timers.push_back(mgr.addTimerUS(d, [&fired, d]() { fired.emplace_back(d, zero::Clock::MonotonicUS()); }));
+    }
+    ZERO_ASSERT(mgr.getNextTimerUS() <= 150);
+    ZERO_ASSERT(mgr.getNextTimer() <= 1);
+    mgr.runUntilEmpty(1000);
+    ZERO_ASSERT2(fired.size() == timers.size(), "fired=" << fired.size());
+    uint64_t late_sum = 0;
+    for (size_t i = 0; i < fired.size(); ++i) {
+        uint64_t d = fired[i].first;
+        ZERO_ASSERT2(i == 0 || d >= fired[i - 1].first, "order " << fired[i - 1].first << " then " << d);
+        auto it = std::find(delays, delays + timers.size(), d);
+        uint64_t expect = timers[it - delays]->getAccurateTimeUS();
+        ZERO_ASSERT2(fired[i].second >= expect, "delay=" << d << " early=" << expect - fired[i].second);
+        late_sum += fired[i].second - expect;
+    }
+    ZERO_ASSERT(!mgr.hasTimer());
+    ZERO_LOG_INFO(g_logger) << "test_wheel_us ok avg_late_us=" << late_sum / fired.size();
+}
+
+/**
+ * @brief hook的usleep/nanosleep在协程中按微秒精度休眠
+ * 
+ * @param pwait2 是否使用epoll_pwait2，否则使用timerfd
+ */
+void Test_Precise_Sleep(bool pwait2) {
+    zero::Config::Lookup<bool>("iomanager.epoll_pwait2")->setValue(pwait2);
+    /// 关闭自旋，只靠休眠的超时唤醒
+    zero::Config::Lookup<uint32_t>("iomanager.idle.spin_us")->setValue(0);
+    static const int rounds = 50;
+    uint64_t usleep_late = 0;
+    uint64_t nanosleep_late = 0;
+    bool used_pwait2 = false;
+    {
+        zero::IOManager iom(1, false, "test_sleep");
+        used_pwait2 = iom.isEpollPwait2();
+        iom.schedule([&]() {
+            for (int i = 0; i < rounds; ++i) {
+                uint64_t req = 100 + i * 10;
+                uint64_t start = zero::Clock::MonotonicUS();
+                usleep(req);
+                uint64_t used = zero::Clock::MonotonicUS() - start;
+                ZERO_ASSERT2(used >= req, "usleep req=" << req << " used=" << used);
+                usleep_late += used > req ? used - req : 0;
+
+                timespec ts = { 0, ( long )req * 1000 };
+                start = zero::Clock::MonotonicUS();
+                nanosleep(&ts, nullptr);
+                used = zero::Clock::MonotonicUS() - start;
+                ZERO_ASSERT2(used >= req, "nanosleep req=" << req << " used=" << used);
+                nanosleep_late += used > req ? used - req : 0;
+            }
+        });
+    }
+    zero::Config::Lookup<bool>("iomanager.epoll_pwait2")->setValue(true);
+    zero::Config::Lookup<uint32_t>("iomanager.idle.spin_us")->setValue(50);
+    /// 毫秒精度时100~590微秒的休眠要么立即返回要么晚到毫秒级，这里只做宽松的检查
+    ZERO_ASSERT2(usleep_late / rounds < 1000, "avg usleep late=" << usleep_late / rounds);
+    ZERO_LOG_INFO(g_logger) << "test_precise_sleep pwait2=" << used_pwait2 << " avg late usleep=" << usleep_late / rounds
+                            << "us nanosleep=" << nanosleep_late / rounds << "us";
+}
+
+/// 任务先运行一段时间再休眠：缓存时间已经落后，定时器的起点仍是当前时刻，休眠不会缩短
+void Test_Sleep_After_Work() {
+    uint64_t used = 0;
+    {
+        zero::IOManager iom(1, false, "test_sleep_after_work");
+        iom.schedule([&used]() {
+            uint64_t start = zero::Clock::MonotonicUS();
+            while (zero::Clock::MonotonicUS() - start < 50 * 1000) {
+            }
+            start = zero::Clock::MonotonicUS();
+            usleep(20 * 1000);
+            used = zero::Clock::MonotonicUS() - start;
+        });
+    }
+    ZERO_ASSERT2(used >= 20 * 1000, "used=" << used);
+    ZERO_LOG_INFO(g_logger) << "test_sleep_after_work used=" << used << "us ok";
+}
+
+/// 到期时间分散在100毫秒内的定时器，设置松弛后合并成少数几次唤醒，且都在[设定时间, 设定时间+松弛]内执行
+void Test_Slack() {
+    const int count = 2000;
+    int wakeups[2] = { 0, 0 };
+    for (int slack = 0; slack <= 1; ++slack) {
+        Test_Manager mgr;
+        std::vector<zero::Timer::ptr> timers;
+        std::vector<uint64_t> fired(count, 0);
+        for (int i = 0; i < count; ++i) {
+            timers.push_back(mgr.addTimer(100 + i % 100, [&fired, i]() { fired[i] = zero::Clock::MonotonicUS(); }, false,
+                                          slack ? 100 : 0));
+        }
+        mgr.runUntilEmpty(2000);
+        for (int i = 0; i < count; ++i) {
+            uint64_t expect = timers[i]->getAccurateTimeUS();
+            ZERO_ASSERT2(fired[i] >= expect && fired[i] <= expect + timers[i]->getSlackUS() + 30 * 1000,
+                         "slack=" << slack << " late=" << ( int64_t )(fired[i] - expect));
+        }
+        wakeups[slack] = mgr.wakeups;
+    }
+    ZERO_ASSERT2(wakeups[1] * 5 < wakeups[0], "wakeups without slack=" << wakeups[0] << " with slack=" << wakeups[1]);
+    ZERO_LOG_INFO(g_logger) << "test_slack ok wakeups without slack=" << wakeups[0] << " with slack=" << wakeups[1];
+}
+
+static std::atomic<uint64_t> s_allocs{ 0 };
+
+void* operator new(size_t size) {
+    ++s_allocs;
+    void* p = malloc(size);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+/// 池化一次性定时器：回调执行一次、取消的不执行，节点复用后旧句柄失效，添加和取消不分配内存
+void Test_Once_Timer() {
+    Test_Manager mgr;
+    int fired = 0;
+    zero::TimerHandle first = mgr.addOnceTimer(0, [&fired]() { ++fired; });
+    mgr.runUntilEmpty(100);
+    ZERO_ASSERT(fired == 1);
+    ZERO_ASSERT(!first.cancel());
+    /// 复用了first的节点，first的句柄不能取消它
+    zero::TimerHandle reused = mgr.addOnceTimer(0, [&fired]() { fired += 10; });
+    ZERO_ASSERT(!first.cancel());
+    mgr.runUntilEmpty(100);
+    ZERO_ASSERT(fired == 11);
+    ZERO_ASSERT(!reused.cancel());
+
+    const int count = 10000;
+    std::vector<zero::TimerHandle> handles(count);
+    for (int round = 0; round < 2; ++round) {
+        uint64_t allocs = s_allocs;
+        uint64_t start = zero::Clock::MonotonicNS();
+        for (int i = 0; i < count; ++i) {
+            handles[i] = mgr.addOnceTimer(1000 + i % 100, [&fired]() { ++fired; });
+        }
+        for (auto& h : handles) {
+            ZERO_ASSERT(h.cancel());
+        }
+        uint64_t used = zero::Clock::MonotonicNS() - start;
+        allocs = s_allocs - allocs;
+        /// 第一轮填充节点池
+        if (round == 1) {
+            ZERO_ASSERT2(allocs == 0, "allocs=" << allocs);
+            std::vector<zero::Timer::ptr> timers(count);
+            uint64_t shared_start = zero::Clock::MonotonicNS();
+            for (int i = 0; i < count; ++i) {
+                timers[i] = mgr.addTimer(1000 + i % 100, [&fired]() { ++fired; });
+            }
+            for (auto& t : timers) {
+                t->cancel();
+            }
+            uint64_t shared_used = zero::Clock::MonotonicNS() - shared_start;
+            ZERO_LOG_INFO(g_logger) << "test_once_timer ok add+cancel ns/op once=" << ( double )used / count
+                                    << " shared_ptr=" << ( double )shared_used / count;
+        }
+    }
+    ZERO_ASSERT(!mgr.hasTimer());
+    ZERO_ASSERT(fired == 11);
+}
+
+/// 当前线程驱动的分片
+static thread_local int t_shard = -1;
+
+/// 按线程分片的定时器管理器，由测试线程各自驱动
+class Sharded_Manager : public zero::TimerManager {
+public:
+    std::atomic<int> wakes{ 0 };
+
+    /**
+     * @brief 
+     * 
+     * @param shards 0表示不分片
+     */
+    explicit Sharded_Manager(size_t shards) {
+        if (shards) {
+            initTimerShards(shards);
+        }
+    }
+
+protected:
+    void onTimerInsertedAtFront(size_t shard) override { ++wakes; }
+    int getTimerShard() override { return t_shard; }
+};
+
+static const int s_shards = 4;
+static const int s_local = 500;
+static std::atomic<int> s_local_fired[s_shards][s_local];
+static std::atomic<int> s_foreign_fired{ 0 };
+static std::atomic<int> s_wrong_thread{ 0 };
+static std::atomic<int> s_added{ 0 };
+static std::atomic<bool> s_stop{ false };
+static std::vector<zero::Timer::ptr> s_local_timers[s_shards];
+static const int s_once = 1000;
+static std::atomic<int> s_once_fired[s_once];
+
+/// 本分片添加定时器，然后不断执行到期回调，直到s_stop
+static void Shard_Driver(Sharded_Manager* mgr, int shard) {
+    t_shard = shard;
+    for (int i = 0; i < s_local; ++i) {
+        s_local_timers[shard].push_back(mgr->addTimer(20 + i % 40, [shard, i]() {
+            if (t_shard != shard) {
+                ++s_wrong_thread;
+            }
+            ++s_local_fired[shard][i];
+        }));
+    }
+    ++s_added;
+    while (!s_stop) {
+        uint64_t next = mgr->getNextTimerUS();
+        usleep(std::min<uint64_t>(next, 1000));
+        std::vector<zero::Task> cbs;
+        mgr->listExpiredCb(cbs);
+        for (auto& cb : cbs) {
+            cb();
+        }
+    }
+}
+
+/// 跨线程取消同步生效、被取消的不执行、未取消的各执行一次且在所属线程执行；其他线程添加的定时器投递到某个分片执行
+void Test_Sharded() {
+    Sharded_Manager mgr(s_shards);
+    std::vector<std::unique_ptr<zero::Thread>> threads;
+    for (int i = 0; i < s_shards; ++i) {
+        threads.emplace_back(new zero::Thread(std::bind(&Shard_Driver, &mgr, i), "timer_shard_" + std::to_string(i)));
+    }
+    while (s_added < s_shards) {
+        usleep(100);
+    }
+    const int foreign = 1000;
+    for (int i = 0; i < foreign; ++i) {
+        mgr.addTimer(5 + i % 30, []() {
+            if (t_shard < 0) {
+                ++s_wrong_thread;
+            }
+            ++s_foreign_fired;
+        });
+    }
+    ZERO_ASSERT(mgr.wakes >= foreign);
+    /// 池化的一次性定时器，取消走句柄
+    std::vector<bool> once_cancelled;
+    for (int i = 0; i < s_once; ++i) {
+        zero::TimerHandle h = mgr.addOnceTimer(10 + i % 30, [i]() {
+            if (t_shard < 0) {
+                ++s_wrong_thread;
+            }
+            ++s_once_fired[i];
+        });
+        zero::TimerHandle copy = h;
+        bool c = i % 2 && h.cancel();
+        once_cancelled.push_back(c);
+        /// 已经取消的，其他句柄副本也取消不了
+        ZERO_ASSERT(!c || !copy.cancel());
+    }
+    /// 主线程不拥有分片，取消走消息
+    int cancelled = 0;
+    std::vector<bool> was_cancelled[s_shards];
+    for (int s = 0; s < s_shards; ++s) {
+        for (int i = 0; i < s_local; ++i) {
+            bool c = i % 2 && s_local_timers[s][i]->cancel();
+            cancelled += c;
+            was_cancelled[s].push_back(c);
+        }
+    }
+    uint64_t end = zero::Clock::MonotonicMS() + 2000;
+    while (mgr.hasTimer() && zero::Clock::MonotonicMS() < end) {
+        usleep(1000);
+    }
+    s_stop = true;
+    for (auto& t : threads) {
+        t->join();
+    }
+    ZERO_ASSERT(!mgr.hasTimer());
+    ZERO_ASSERT2(s_foreign_fired == foreign, "foreign fired=" << s_foreign_fired);
+    ZERO_ASSERT2(s_wrong_thread == 0, "wrong thread=" << s_wrong_thread);
+    for (int i = 0; i < s_once; ++i) {
+        ZERO_ASSERT2(s_once_fired[i] == (once_cancelled[i] ? 0 : 1), "once i=" << i << " fired=" << s_once_fired[i]);
+    }
+    for (int s = 0; s < s_shards; ++s) {
+        for (int i = 0; i < s_local; ++i) {
+            int expect = was_cancelled[s][i] ? 0 : 1;
+            ZERO_ASSERT2(s_local_fired[s][i] == expect, "shard=" << s << " i=" << i << " fired=" << s_local_fired[s][i]);
+            ZERO_ASSERT(!s_local_timers[s][i]->cancel());
+        }
+        s_local_timers[s].clear();
+    }
+    ZERO_LOG_INFO(g_logger) << "test_sharded ok cancelled=" << cancelled;
+}
+
+static std::atomic<bool> s_go{ false };
+
+/// 每个线程在自己的分片上添加并取消定时器
+static void Scale_Func(Sharded_Manager* mgr, int shard, int count) {
+    t_shard = shard;
+    std::vector<zero::Timer::ptr> timers;
+    timers.reserve(count);
+    while (!s_go) {
+    }
+    for (int i = 0; i < count; ++i) {
+        timers.push_back(mgr->addTimer(10000 + i % 5000, []() {}));
+    }
+    for (auto& t : timers) {
+        t->cancel();
+    }
+}
+
+/// 单分片加锁与按线程分片在多线程下添加、取消的吞吐
+void Test_Sharded_Scale() {
+    const int count = 50000;
+    for (int sharded = 0; sharded <= 1; ++sharded) {
+        for (int n : { 1, 2, 4 }) {
+            Sharded_Manager mgr(sharded ? n : 0);
+            std::vector<std::unique_ptr<zero::Thread>> threads;
+            s_go = false;
+            for (int i = 0; i < n; ++i) {
+                threads.emplace_back(new zero::Thread(std::bind(&Scale_Func, &mgr, sharded ? i : -1, count), "timer_scale"));
+            }
+            uint64_t start = zero::Clock::MonotonicUS();
+            s_go = true;
+            for (auto& t : threads) {
+                t->join();
+            }
+            uint64_t used = zero::Clock::MonotonicUS() - start;
+            ZERO_ASSERT(!mgr.hasTimer());
+            ZERO_LOG_INFO(g_logger) << "test_sharded_scale sharded=" << sharded << " threads=" << n
+                                    << " add+cancel Mops/s=" << ( double )count * n / used;
+        }
+    }
+}
+
 int main() {
+    Test_Once_Timer();
+    Test_Slack();
+    Test_Sharded();
+    Test_Sharded_Scale();
+    Test_Wheel_US();
+    Test_Precise_Sleep(true);
+    Test_Precise_Sleep(false);
+    Test_Sleep_After_Work();
+    Test_Wheel_Order();
+    Test_Wheel_Cancel_Reset();
+    Test_Wheel_Scale();
     Test();
 
 
@@ -0,0 +1,452 @@
+#ifndef __ZERO_CHANNEL_H__
+#define __ZERO_CHANNEL_H__
+
+#include "clock.h"
+#include "fiber_sync.h"
+#include "iomanager.h"
+#include "macro.h"
+#include "mutex.h"
+#include "noncopyable.h"
+#include "timer.h"
+#include "util.h"
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+namespace zero {
+
+/**
+ * @brief 协程间的通道(参考go channel)
+ *        容量为0时为同步通道，发送方挂起直到接收方取走数据；容量为UNBOUNDED时发送永不挂起
+ *        有挂起的接收方时发送直接把数据交给它，不经过缓冲区；同一调度器线程上的唤醒走runnext，不经过全局任务队列
+ *        关闭后不能再发送，缓冲区中剩余的数据仍可以接收
+ *
+ * @tparam T 数据类型，需可移动
+ */
+template <class T>
+class Channel : Noncopyable {
+public:
+    typedef std::shared_ptr<Channel> ptr;
+
+    /// 无界通道的容量
+    static const size_t UNBOUNDED = ( size_t )-1;
+
+    /**
+     * @brief 带超时的接收结果
+     *
+     */
+    enum Status {
+        /// 收到数据
+        OK = 0,
+        /// 通道已关闭且没有数据
+        CLOSED = 1,
+        /// 超时
+        TIMEOUT = 2
+    };
+
+    /**
+     * @brief Construct a new Channel object
+     *
+     * @param capacity 缓冲区容量，0为同步通道，UNBOUNDED为无界通道
+     */
+    Channel(size_t capacity = 0) : m_capacity(capacity) {}
+
+    /**
+     * @brief 发送数据，缓冲区满时挂起
+     *
+     * @param value
+     * @return true 发送成功
+     * @return false 通道已关闭
+     */
+    bool send(const T& value) {
+        T tmp(value);
+        return send(std::move(tmp));
+    }
+
+    bool send(T&& value) {
+        m_mutex.lock();
+        if (m_closed) {
+            m_mutex.unlock();
+            return false;
+        }
+        Entry entry;
+        if (popLocked(m_recvq, entry)) {
+            entry.waiter->value.reset(new T(std::move(value)));
+            entry.waiter->status = OK;
+            entry.waiter->index = entry.index;
+            m_mutex.unlock();
+            entry.waiter->waiter.notify(true);
+            return true;
+        }
+        if (m_capacity == UNBOUNDED || m_buffer.size() < m_capacity) {
+            m_buffer.push_back(std::move(value));
+            m_mutex.unlock();
+            return true;
+        }
+
+        WaiterPtr waiter(new Waiter);
+        waiter->value.reset(new T(std::move(value)));
+        m_sendq.push_back(Entry{ waiter, -1 });
+        m_mutex.unlock();
+        waiter->waiter.park();
+        return waiter->status == OK;
+    }
+
+    /**
+     * @brief 尝试发送，不挂起，失败时value不变
+     *
+     * @param value
+     * @return true 发送成功
+     * @return false 缓冲区已满(同步通道没有等待的接收方)或通道已关闭
+     */
+    bool trySend(T&& value) {
+        m_mutex.lock();
+        if (m_closed) {
+            m_mutex.unlock();
+            return false;
+        }
+        Entry entry;
+        if (popLocked(m_recvq, entry)) {
+            entry.waiter->value.reset(new T(std::move(value)));
+            entry.waiter->status = OK;
+            entry.waiter->index = entry.index;
+            m_mutex.unlock();
+            entry.waiter->waiter.notify(true);
+            return true;
+        }
+        if (m_capacity == UNBOUNDED || m_buffer.size() < m_capacity) {
+            m_buffer.push_back(std::move(value));
+            m_mutex.unlock();
+            return true;
+        }
+        m_mutex.unlock();
+        return false;
+    }
+
+    bool trySend(const T& value) {
+        T tmp(value);
+        return trySend(std::move(tmp));
+    }
+
+    /**
+     * @brief 接收数据，没有数据时挂起
+     *
+     * @param value 接收到的数据
+     * @return true 接收成功
+     * @return false 通道已关闭且没有数据
+     */
+    bool recv(T& value) {
+        return recvTimeout(value, ~0ull) == OK;
+    }
+
+    /**
+     * @brief 尝试接收，不挂起
+     *
+     * @param value
+     * @return true 接收成功
+     * @return false 没有数据
+     */
+    bool tryRecv(T& value) {
+        WaiterPtr sender;
+        m_mutex.lock();
+        bool rt = takeLocked(value, sender);
+        m_mutex.unlock();
+        if (sender) {
+            sender->waiter.notify(true);
+        }
+        return rt;
+    }
+
+    /**
+     * @brief 带超时的接收，超时由当前线程的IOManager定时器实现
+     *
+     * @param value
+     * @param timeout_ms 超时时间(毫秒)，~0ull表示不超时
+     * @return Status
+     */
+    Status recvTimeout(T& value, uint64_t timeout_ms) {
+        WaiterPtr sender;
+        m_mutex.lock();
+        if (takeLocked(value, sender)) {
+            m_mutex.unlock();
+            if (sender) {
+                sender->waiter.notify(true);
+            }
+            return OK;
+        }
+        if (m_closed) {
+            m_mutex.unlock();
+            return CLOSED;
+        }
+        if (timeout_ms == 0) {
+            m_mutex.unlock();
+            return TIMEOUT;
+        }
+        WaiterPtr waiter(new Waiter);
+        pushRecvLocked(waiter, 0);
+        m_mutex.unlock();
+
+        TimerHandle timer = StartTimer(waiter, timeout_ms);
+        waiter->waiter.park();
+        timer.cancel();
+        if (waiter->status == OK) {
+            value = std::move(*waiter->value);
+        }
+        return waiter->status;
+    }
+
+    /**
+     * @brief 关闭通道，唤醒所有挂起的发送方(发送失败)和接收方(返回CLOSED)
+     *
+     */
+    void close() {
+        std::deque<Entry> recvq;
+        std::deque<Entry> sendq;
+        m_mutex.lock();
+        if (m_closed) {
+            m_mutex.unlock();
+            return;
+        }
+        m_closed = true;
+        recvq.swap(m_recvq);
+        sendq.swap(m_sendq);
+        m_mutex.unlock();
+        for (auto& i : recvq) {
+            if (i.waiter->claim()) {
+                i.waiter->status = CLOSED;
+                i.waiter->waiter.notify();
+            }
+        }
+        for (auto& i : sendq) {
+            if (i.waiter->claim()) {
+                i.waiter->status = CLOSED;
+                i.waiter->waiter.notify();
+            }
+        }
+    }
+
+    bool isClosed() {
+        Spinlock::Lock lock(m_mutex);
+        return m_closed;
+    }
+
+    /**
+     * @brief 缓冲区中的数据数量
+     *
+     * @return size_t
+     */
+    size_t size() {
+        Spinlock::Lock lock(m_mutex);
+        return m_buffer.size();
+    }
+
+    size_t getCapacity() const { return m_capacity; }
+
+    /**
+     * @brief 同时等待多个通道，从最先有数据的通道接收
+     *        多个通道同时有数据时按顺序优先；关闭的通道不再参与等待
+     *
+     * @param chans 通道列表
+     * @param value 接收到的数据
+     * @param timeout_ms 超时时间(毫秒)，~0ull表示不超时
+     * @return int 收到数据的通道下标，超时或所有通道都已关闭返回-1
+     */
+    static int Select(const std::vector<Channel*>& chans, T& value, uint64_t timeout_ms = ~0ull) {
+        uint64_t deadline = timeout_ms == ~0ull ? ~0ull : Clock::MonotonicMS() + timeout_ms;
+        while (true) {
+            WaiterPtr waiter(new Waiter);
+            WaiterPtr sender;
+            int ready = -1;
+            bool registered = false;
+            for (size_t i = 0; i < chans.size(); ++i) {
+                Channel* chan = chans[i];
+                chan->m_mutex.lock();
+                if (waiter->claimed) {
+                    /// 已被前面注册过的通道唤醒
+                    chan->m_mutex.unlock();
+                    break;
+                }
+                if (!chan->m_buffer.empty() || !chan->m_sendq.empty()) {
+                    /// 先占住等待者，防止同时被已注册的通道交付数据
+                    if (waiter->claim()) {
+                        chan->takeLocked(value, sender);
+                        ready = i;
+                    }
+                    chan->m_mutex.unlock();
+                    break;
+                }
+                if (!chan->m_closed) {
+                    chan->pushRecvLocked(waiter, i);
+                    registered = true;
+                }
+                chan->m_mutex.unlock();
+            }
+            if (sender) {
+                sender->waiter.notify(true);
+            }
+            if (ready >= 0) {
+                return ready;
+            }
+            if (!registered && waiter->claim()) {
+                /// 所有通道都已关闭
+                return -1;
+            }
+
+            uint64_t now = deadline == ~0ull ? 0 : Clock::MonotonicMS();
+            TimerHandle timer;
+            if (deadline != ~0ull) {
+                timer = StartTimer(waiter, deadline > now ? deadline - now : 0);
+            }
+            waiter->waiter.park();
+            timer.cancel();
+            if (waiter->status == OK) {
+                value = std::move(*waiter->value);
+                return waiter->index;
+            }
+            if (waiter->status == TIMEOUT) {
+                return -1;
+            }
+            /// 有通道被关闭，重新检查剩余的通道
+        }
+    }
+
+private:
+    /**
+     * @brief 挂起在通道上的发送方/接收方
+     *        放在堆上，共享栈协程挂起时栈上的数据会被换出，不能让其他协程直接访问
+     *
+     */
+    struct Waiter {
+        /// 挂起的协程或线程
+        FiberWaiter waiter;
+        /// 是否已被交付数据/关闭/超时，只有占住等待者的一方能唤醒它
+        std::atomic<bool> claimed{ false };
+        /// 唤醒原因
+        Status status = OK;
+        /// 交付数据的通道在Select中的下标
+        int index = -1;
+        /// 发送的数据或收到的数据
+        std::unique_ptr<T> value;
+
+        bool claim() {
+            bool expected = false;
+            return claimed.compare_exchange_strong(expected, true);
+        }
+    };
+    typedef std::shared_ptr<Waiter> WaiterPtr;
+
+    /**
+     * @brief 等待队列中的一项，同一个Select等待者会出现在多个通道的队列中
+     *
+     */
+    struct Entry {
+        WaiterPtr waiter;
+        int index;
+    };
+
+    /**
+     * @brief 取出第一个还能占住的等待者，跳过已被其他通道唤醒或超时的
+     *
+     * @param queue
+     * @param entry
+     * @return true
+     * @return false
+     */
+    static bool popLocked(std::deque<Entry>& queue, Entry& entry) {
+        while (!queue.empty()) {
+            entry = std::move(queue.front());
+            queue.pop_front();
+            if (entry.waiter->claim()) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * @brief 接收方入队，顺便清理已失效的等待者，避免没有发送方时队列一直增长
+     *
+     * @param waiter
+     * @param index
+     */
+    void pushRecvLocked(const WaiterPtr& waiter, int index) {
+        if (m_recvq.size() >= 32) {
+            m_recvq.erase(std::remove_if(m_recvq.begin(), m_recvq.end(), [](const Entry& e) { return e.waiter->claimed.load(); }),
+                          m_recvq.end());
+        }
+        m_recvq.push_back(Entry{ waiter, index });
+    }
+
+    /**
+     * @brief 从缓冲区或挂起的发送方取一个数据
+     *
+     * @param value
+     * @param sender 需要唤醒的发送方
+     * @return true
+     * @return false 没有数据
+     */
+    bool takeLocked(T& value, WaiterPtr& sender) {
+        Entry entry;
+        if (!m_buffer.empty()) {
+            value = std::move(m_buffer.front());
+            m_buffer.pop_front();
+            /// 缓冲区空出位置，把一个挂起的发送方的数据移入
+            if (popLocked(m_sendq, entry)) {
+                m_buffer.push_back(std::move(*entry.waiter->value));
+                entry.waiter->status = OK;
+                sender = entry.waiter;
+            }
+            return true;
+        }
+        if (popLocked(m_sendq, entry)) {
+            value = std::move(*entry.waiter->value);
+            entry.waiter->status = OK;
+            sender = entry.waiter;
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     * @brief 为挂起的接收方启动超时定时器
+     *
+     * @param waiter
+     * @param timeout_ms ~0ull表示不超时
+     * @return TimerHandle
+     */
+    static TimerHandle StartTimer(const WaiterPtr& waiter, uint64_t timeout_ms) {
+        if (timeout_ms == ~0ull) {
+            return TimerHandle();
+        }
+        IOManager* iom = IOManager::GetThis();
+        ZERO_ASSERT2(iom, "Channel timeout requires IOManager");
+        std::weak_ptr<Waiter> weak_waiter(waiter);
+        return iom->addOnceTimer(timeout_ms, [weak_waiter]() {
+            WaiterPtr waiter = weak_waiter.lock();
+            if (waiter && waiter->claim()) {
+                waiter->status = TIMEOUT;
+                waiter->waiter.notify();
+            }
+        });
+    }
+
+private:
+    /// 缓冲区容量
+    size_t m_capacity;
+    /// 是否已关闭
+    bool m_closed = false;
+    Spinlock m_mutex;
+    /// 缓冲区
+    std::deque<T> m_buffer;
+    /// 挂起的接收方
+    std::deque<Entry> m_recvq;
+    /// 挂起的发送方(缓冲区已满)
+    std::deque<Entry> m_sendq;
+};
+
+}  // namespace zero
+
+#endif
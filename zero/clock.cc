@@ -0,0 +1,119 @@
+#include "clock.h"
+#include "config.h"
+#include "log.h"
+#include <atomic>
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+
+namespace zero {
+
+static zero::Logger::ptr g_logger = ZERO_LOG_NAME("system");
+
+thread_local uint64_t Clock::t_cachedUS = 0;
+
+/// 高精度计时是否使用TSC
+static ConfigVar<bool>::ptr g_clock_tsc =
+    Config::Lookup<bool>("clock.tsc", false, "use calibrated invariant TSC for Clock::NowNS");
+
+/**
+ * @brief TSC到纳秒的换算参数，ns = base_ns + ((tsc - base_tsc) * mult) >> 32
+ *
+ */
+struct TscCalibration {
+    bool ok = false;
+    uint64_t baseTsc = 0;
+    uint64_t baseNs = 0;
+    uint64_t mult = 0;
+};
+
+static std::atomic<bool> s_tsc_enabled{ false };
+
+#if defined(__x86_64__)
+/**
+ * @brief CPU是否支持恒定TSC(频率不随变频和休眠变化)
+ *
+ * @return true
+ * @return false
+ */
+static bool HasInvariantTsc() {
+    unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+    if (!__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) || eax < 0x80000007) {
+        return false;
+    }
+    __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+    return edx & (1u << 8);
+}
+#endif
+
+/**
+ * @brief 只校准一次，之后所有线程共用
+ *
+ * @return const TscCalibration&
+ */
+static const TscCalibration& GetTscCalibration() {
+    static const TscCalibration s_calibration = []() {
+        TscCalibration c;
+#if defined(__x86_64__)
+        if (!HasInvariantTsc()) {
+            ZERO_LOG_INFO(g_logger) << "invariant tsc not supported, Clock::NowNS uses CLOCK_MONOTONIC";
+            return c;
+        }
+        uint64_t ns0 = Clock::MonotonicNS();
+        uint64_t tsc0 = __rdtsc();
+        /// 忙等而不是usleep，避免在开启hook的协程里被切走
+        uint64_t ns1 = ns0;
+        while (ns1 - ns0 < 10 * 1000 * 1000) {
+            ns1 = Clock::MonotonicNS();
+        }
+        uint64_t tsc1 = __rdtsc();
+        if (tsc1 <= tsc0 || ns1 <= ns0) {
+            return c;
+        }
+        c.mult = (( unsigned __int128 )(ns1 - ns0) << 32) / (tsc1 - tsc0);
+        c.baseTsc = tsc1;
+        c.baseNs = ns1;
+        c.ok = c.mult != 0;
+        ZERO_LOG_INFO(g_logger) << "tsc calibrated freq=" << (tsc1 - tsc0) * 1000 / (ns1 - ns0) << "MHz";
+#endif
+        return c;
+    }();
+    return s_calibration;
+}
+
+uint64_t Clock::NowNS() {
+#if defined(__x86_64__)
+    if (s_tsc_enabled.load(std::memory_order_relaxed)) {
+        const TscCalibration& c = GetTscCalibration();
+        return c.baseNs + ((( unsigned __int128 )(__rdtsc() - c.baseTsc) * c.mult) >> 32);
+    }
+#endif
+    return MonotonicNS();
+}
+
+bool Clock::IsTscEnabled() {
+    return s_tsc_enabled.load(std::memory_order_relaxed);
+}
+
+bool Clock::SetTscEnabled(bool v) {
+    bool enable = v && GetTscCalibration().ok;
+    s_tsc_enabled.store(enable, std::memory_order_relaxed);
+    return enable;
+}
+
+struct _ClockIniter {
+    _ClockIniter() {
+        if (g_clock_tsc->getValue()) {
+            Clock::SetTscEnabled(true);
+        }
+        g_clock_tsc->addListener([](const bool& old_value, const bool& new_value) {
+            ZERO_LOG_INFO(g_logger) << "clock tsc changed from " << old_value << " to " << new_value;
+            Clock::SetTscEnabled(new_value);
+        });
+    }
+};
+
+static _ClockIniter s_clock_initer;
+
+}  // namespace zero
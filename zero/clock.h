@@ -0,0 +1,134 @@
+#ifndef __ZERO_CLOCK_H__
+#define __ZERO_CLOCK_H__
+
+#include <stdint.h>
+#include <time.h>
+
+namespace zero {
+
+/**
+ * @brief 时钟
+ *        定时器、超时和耗时统计统一使用CLOCK_MONOTONIC，不受系统时间调整影响
+ *        墙上时间(日志中的日期)仍然使用time()/GetCurrentMS()
+ *
+ *        事件循环线程可以缓存"当前时间"：IOManager每次epoll_wait返回和每次调度任务前刷新一次，
+ *        之后NowMS/NowUS只读线程局部变量。缓存的时间最多落后当前任务已经运行的时长，
+ *        与libuv的uv_now语义相同；没有开启缓存的线程每次都直接读单调时钟
+ *        缓存值只用于到期检查；定时器、超时和截止时间的起点必须读MonotonicUS，否则任务运行得越久到期得越早
+ *
+ */
+class Clock {
+public:
+    /**
+     * @brief 单调时钟纳秒
+     *
+     * @return uint64_t
+     */
+    static uint64_t MonotonicNS() {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    }
+
+    /**
+     * @brief 单调时钟微秒
+     *
+     * @return uint64_t
+     */
+    static uint64_t MonotonicUS() { return MonotonicNS() / 1000; }
+
+    /**
+     * @brief 单调时钟毫秒
+     *
+     * @return uint64_t
+     */
+    static uint64_t MonotonicMS() { return MonotonicNS() / 1000000; }
+
+    /**
+     * @brief 粗粒度单调时钟毫秒，精度为一个时钟节拍(通常1~4ms)，读取只有几纳秒
+     *        所有线程读到的值一致且不回退，适合日志耗时这类不要求精度的场景
+     *
+     * @return uint64_t
+     */
+    static uint64_t CoarseMS() {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+        return ts.tv_sec * 1000ull + ts.tv_nsec / 1000000;
+    }
+
+    /**
+     * @brief 当前时间毫秒，开启缓存的线程返回缓存值
+     *
+     * @return uint64_t
+     */
+    static uint64_t NowMS() { return NowUS() / 1000; }
+
+    /**
+     * @brief 当前时间微秒，开启缓存的线程返回缓存值
+     *
+     * @return uint64_t
+     */
+    static uint64_t NowUS() {
+        uint64_t cached = t_cachedUS;
+        return cached ? cached : MonotonicUS();
+    }
+
+    /**
+     * @brief 刷新本线程的缓存时间，同时开启本线程的缓存
+     *
+     * @return uint64_t 刷新后的时间(微秒)
+     */
+    static uint64_t Refresh() {
+        t_cachedUS = MonotonicUS();
+        return t_cachedUS;
+    }
+
+    /**
+     * @brief 关闭本线程的缓存，之后NowMS/NowUS直接读时钟
+     *        离开事件循环的线程必须调用，否则会一直读到旧值
+     *
+     */
+    static void Invalidate() { t_cachedUS = 0; }
+
+    /**
+     * @brief 本线程是否开启了缓存
+     *
+     * @return true
+     * @return false
+     */
+    static bool IsCached() { return t_cachedUS != 0; }
+
+    /**
+     * @brief 高精度纳秒时间，开启clock.tsc且CPU支持恒定TSC时由rdtsc换算，否则等同MonotonicNS
+     *        TSC按单调时钟校准，长时间会有微小漂移，只用于测量短区间(自旋预算、压测)，不要用于定时器
+     *
+     * @return uint64_t
+     */
+    static uint64_t NowNS();
+
+    /**
+     * @brief 当前是否使用TSC
+     *
+     * @return true
+     * @return false
+     */
+    static bool IsTscEnabled();
+
+    /**
+     * @brief 开启或关闭TSC，首次开启时校准(约10ms)，CPU不支持恒定TSC时保持关闭
+     *        一般通过配置clock.tsc设置
+     *
+     * @param v
+     * @return true 设置后TSC是否生效
+     * @return false
+     */
+    static bool SetTscEnabled(bool v);
+
+private:
+    /// 本线程缓存的单调时间(微秒)，0表示未开启缓存
+    static thread_local uint64_t t_cachedUS;
+};
+
+}  // namespace zero
+
+#endif
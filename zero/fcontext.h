@@ -0,0 +1,35 @@
+#ifndef __ZERO_FCONTEXT_H__
+#define __ZERO_FCONTEXT_H__
+
+#include <cstddef>
+
+namespace zero {
+
+/// 协程上下文，指向保存在协程栈上的寄存器区
+typedef void* fcontext_t;
+
+extern "C" {
+
+/**
+ * @brief 保存当前上下文到from，并切换到to，只保存callee-saved寄存器
+ *        实现见 zero/context/fcontext_*.S
+ *
+ * @param from 保存当前上下文
+ * @param to 目标上下文
+ */
+void zero_jump_fcontext(fcontext_t* from, fcontext_t to);
+
+/**
+ * @brief 在栈上构造初始上下文，第一次切换进去时执行fn，fn不能返回
+ *
+ * @param sp 栈顶(高地址)
+ * @param size 栈大小
+ * @param fn 入口函数
+ * @return fcontext_t
+ */
+fcontext_t zero_make_fcontext(void* sp, size_t size, void (*fn)());
+}
+
+}  // namespace zero
+
+#endif
@@ -2,26 +2,30 @@
 #include "hook.h"
 #include <cstdint>
 #include <fcntl.h>
+#include <new>
+#include <stdlib.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
 namespace zero {
 
-FdCtx::FdCtx(int fd) 
+FdCtx::FdCtx() 
     : m_isInit(false)
     , m_isSocket(false)
+    , m_isFile(false)
     , m_sysNonblock(false)
     , m_userNonblock(false)
     , m_isClosed(false)
-    , m_fd(fd)
+    , m_fd(-1)
     , m_recvTimeout(-1)
     , m_sendTimeout(-1) {
-    init();        
 }
 
-FdCtx::~FdCtx() {
-
+void FdCtx::reset(int fd) {
+    m_fd = fd;
+    m_isInit = false;
+    init();
 }
 
 bool FdCtx::init() {
@@ -35,9 +39,11 @@ bool FdCtx::init() {
     if(-1 == fstat(m_fd, &fd_stat)) {
         m_isInit = false;
         m_isSocket = false;
+        m_isFile = false;
     } else {
         m_isInit = true;
         m_isSocket = S_ISSOCK(fd_stat.st_mode);
+        m_isFile = S_ISREG(fd_stat.st_mode) || S_ISBLK(fd_stat.st_mode);
     }
 
     /// 如果该fd是socket类型，默认为系统非阻塞
@@ -72,40 +78,71 @@ uint64_t FdCtx::getTimeout(int type) {
 }
 
 FdManager::FdManager() {
-    m_datas.resize(64);
+    for(size_t i = 0; i < DIR_SIZE; ++i) {
+        m_pages[i].store(nullptr, std::memory_order_relaxed);
+    }
 }
 
-FdCtx::ptr FdManager::get(int fd, bool auto_create) {
-    if(fd == -1) {
+FdManager::~FdManager() {
+    for(size_t i = 0; i < DIR_SIZE; ++i) {
+        Page* page = m_pages[i].load(std::memory_order_relaxed);
+        if(page) {
+            page->~Page();
+            free(page);
+        }
+    }
+}
+
+FdManager::Page* FdManager::allocPage(size_t index) {
+    /// 记录按缓存行对齐，C++11的new不保证超过max_align_t的对齐
+    void* mem = nullptr;
+    int rt = posix_memalign(&mem, alignof(Record), sizeof(Page));
+    ZERO_ASSERT2(rt == 0, "posix_memalign size=" << sizeof(Page));
+    Page* page = new (mem) Page;
+    for(size_t i = 0; i < PAGE_SIZE; ++i) {
+        page->records[i].event.fd = index * PAGE_SIZE + i;
+    }
+
+    Page* expected = nullptr;
+    if(!m_pages[index].compare_exchange_strong(expected, page, std::memory_order_acq_rel)) {
+        /// 其他线程先分配了
+        page->~Page();
+        free(page);
+        return expected;
+    }
+    return page;
+}
+
+FdCtx* FdManager::get(int fd, bool auto_create) {
+    Record* rec = record(fd, auto_create);
+    if(!rec) {
         return nullptr;
     }
-    RWMutexType::ReadLock lock(m_mutex);
-    if((int)m_datas.size() <= fd) {
-        if(auto_create == false) {
-            return nullptr;
-        }
-    } else {
-        if(m_datas[fd] || !auto_create) {
-            return m_datas[fd];
-        }
+    if(ZERO_LIKELY(rec->valid.load(std::memory_order_acquire))) {
+        return &rec->ctx;
+    }
+    if(!auto_create) {
+        return nullptr;
     }
-    lock.unlock();
 
-    RWMutexType::WriteLock lock2(m_mutex);
-    FdCtx::ptr ctx(new FdCtx(fd));
-    if(fd >= (int)m_datas.size()) {
-        m_datas.resize(fd * 1.5);
+    Spinlock::Lock lock(rec->mutex);
+    if(!rec->valid.load(std::memory_order_relaxed)) {
+        rec->ctx.reset(fd);
+        rec->valid.store(true, std::memory_order_release);
     }
-    m_datas[fd] = ctx;
-    return ctx;
+    return &rec->ctx;
 }
 
 void FdManager::del(int fd) {
-    RWMutexType::WriteLock lock(m_mutex);
-    if((int)m_datas.size() <= fd) {
+    Record* rec = record(fd, false);
+    if(!rec) {
         return;
     }
-    m_datas[fd].reset();
+    Spinlock::Lock lock(rec->mutex);
+    if(rec->valid.load(std::memory_order_relaxed)) {
+        rec->ctx.m_isClosed = true;
+        rec->valid.store(false, std::memory_order_release);
+    }
 }
 
 }
\ No newline at end of file
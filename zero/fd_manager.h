@@ -1,31 +1,28 @@
 #ifndef __FD_MANAGER_H__
 #define __FD_MANAGER_H__
 
+#include <atomic>
+#include <cstddef>
 #include <cstdint>
-#include <memory>
-#include <vector>
+#include "iomanager.h"
+#include "macro.h"
 #include "thread.h"
 #include "singleton.h"
 #include "zero/mutex.h"
 
 namespace zero {
 
+class FdManager;
+
 /**
  * @brief 文件句柄上下文，验证文件句柄信息
+ *        常驻在FdManager的fd表中，地址不变，不再引用计数；关闭后isClose()为true，同号的新fd复用同一个对象
  * 
  */
-class FdCtx : public std::enable_shared_from_this<FdCtx> {
+class FdCtx {
+friend class FdManager;
 public:
-    typedef std::shared_ptr<FdCtx> ptr;
-
-    /**
-     * @brief 通过文件句柄构造FdCtx
-     * 
-     * @param fd 
-     */
-    FdCtx(int fd);
-
-    ~FdCtx();
+    FdCtx();
 
     /**
      * @brief 是否初始化完成
@@ -43,6 +40,14 @@ public:
      */
     bool isSocket() const { return m_isSocket; }
 
+    /**
+     * @brief 是否是普通文件或块设备，读写没有就绪事件可等，hook时交给卸载线程池
+     * 
+     * @return true 
+     * @return false 
+     */
+    bool isFile() const { return m_isFile; }
+
     /**
      * @brief 是否已关闭
      * 
@@ -106,18 +111,27 @@ private:
      */
     bool init();
 
+    /**
+     * @brief 重新绑定到fd并初始化，由FdManager在创建时调用
+     * 
+     * @param fd 
+     */
+    void reset(int fd);
+
 private:
+    /// 标志位不用位域，关闭时写m_isClosed不会和其他线程写相邻的标志互相覆盖
     /// 是否初始化
-    /// 指定位数
-    bool m_isInit: 1;
+    bool m_isInit;
     /// 是否为socket
-    bool m_isSocket: 1;
+    bool m_isSocket;
+    /// 是否为普通文件或块设备
+    bool m_isFile;
     /// 是否hook非阻塞
-    bool m_sysNonblock: 1;
+    bool m_sysNonblock;
     /// s是否用户主动设置非阻塞模式
-    bool m_userNonblock: 1;
+    bool m_userNonblock;
     /// 是否关闭
-    bool m_isClosed: 1;
+    bool m_isClosed;
     /// 文件句柄
     int m_fd;
     /// 读超时时间 毫秒
@@ -128,35 +142,101 @@ private:
 
 /**
  * @brief 文件句柄管理类
+ *        两级fd表：目录中每项指向一页固定数量的记录，页按需分配、进程内不释放也不搬移，查找只有两次加载，不加锁
+ *        一条记录同时存放hook用的FdCtx和IOManager的事件上下文
  * 
  */
 class FdManager {
 public:
-    typedef RWMutex RWMutexType;
+    /// 每页记录数的位数
+    static const size_t PAGE_BITS = 8;
+    static const size_t PAGE_SIZE = 1 << PAGE_BITS;
+    /// 目录项数，可管理的最大fd为DIR_SIZE * PAGE_SIZE - 1
+    static const size_t DIR_SIZE = 4096;
 
     FdManager();
 
+    ~FdManager();
+
     /**
      * @brief 获取/创建文件句柄类FdCtx
      * 
      * @param fd 
      * @param auto_create 是否自动创建
-     * @return FdCtx::ptr 
+     * @return FdCtx* 不存在或超出表的范围返回nullptr
      */
-    FdCtx::ptr get(int fd, bool auto_create = false);
+    FdCtx* get(int fd, bool auto_create = false);
 
     /**
-     * @brief 删除文件句柄类
+     * @brief 删除文件句柄类，已经取到的FdCtx*仍然有效，isClose()为true
+     *        同号的新fd创建后复用同一个对象并重新初始化，isClose()又为false，不能用它判断原来的fd是否已关闭
      * 
      * @param fd 
      */
     void del(int fd);
 
+    /**
+     * @brief 获取fd的IOManager事件上下文，与FdCtx在同一条记录中
+     * 
+     * @param fd 
+     * @param auto_create 所在页不存在时是否分配
+     * @return IOManager::FdContext* 超出表的范围返回nullptr
+     */
+    IOManager::FdContext* getEventContext(int fd, bool auto_create = false) {
+        Record* rec = record(fd, auto_create);
+        return rec ? &rec->event : nullptr;
+    }
+
+private:
+    /**
+     * @brief 一个fd的全部上下文，按缓存行对齐，相邻fd不共享缓存行
+     * 
+     */
+    struct alignas(64) Record {
+        /// 只在创建、删除FdCtx时加锁
+        Spinlock mutex;
+        /// FdCtx是否存在
+        std::atomic<bool> valid = { false };
+        FdCtx ctx;
+        IOManager::FdContext event;
+    };
+
+    struct Page {
+        Record records[PAGE_SIZE];
+    };
+
+    /**
+     * @brief 查找fd所在的记录
+     * 
+     * @param fd 
+     * @param auto_create 所在页不存在时是否分配
+     * @return Record* 
+     */
+    Record* record(int fd, bool auto_create) {
+        if (ZERO_UNLIKELY(fd < 0 || ( size_t )fd >= DIR_SIZE * PAGE_SIZE)) {
+            return nullptr;
+        }
+        Page* page = m_pages[fd >> PAGE_BITS].load(std::memory_order_acquire);
+        if (ZERO_UNLIKELY(!page)) {
+            if (!auto_create) {
+                return nullptr;
+            }
+            page = allocPage(fd >> PAGE_BITS);
+        }
+        return &page->records[fd & (PAGE_SIZE - 1)];
+    }
+
+    /**
+     * @brief 分配目录项对应的页，并发分配时只有一个生效
+     * 
+     * @param index 
+     * @return Page* 
+     */
+    Page* allocPage(size_t index);
+
 private:
-    /// 读写锁
-    RWMutexType m_mutex;
-    /// 文件句柄集合
-    std::vector<FdCtx::ptr> m_datas;
+    /// 页目录
+    std::atomic<Page*> m_pages[DIR_SIZE];
 };
 
 /// 文件句柄单例
@@ -1,18 +1,25 @@
 #include "fiber.h"
+#include "clock.h"
 #include "config.h"
 #include "log.h"
 #include "macro.h"
+#include "mutex.h"
 #include "zero/util.h"
 #include "scheduler.h"
+#include "stack_allocator.h"
 #include <atomic>
+#include <cxxabi.h>
 #include <bits/stdint-uintn.h>
 #include <bits/types/FILE.h>
 #include <cstddef>
 #include <cstdlib>
 #include <exception>
 #include <functional>
+#include <map>
 #include <ostream>
-#include <ucontext.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <vector>
 
 namespace zero {
 
@@ -30,18 +37,159 @@ static thread_local Fiber::ptr t_threadFiber = nullptr;
 /// 配置文件中读取协程栈大小，默认128k
 static ConfigVar<uint32_t>::ptr g_fiber_static_size = Config::Lookup<uint32_t>("fiber.stack_size", 128 * 1024, "fiber stack size");
 
-class MallocStackAllocator {
+/// 每个线程的共享栈数量和大小，共享栈只保留虚拟地址空间，可以给得大一些
+static ConfigVar<uint32_t>::ptr g_fiber_shared_stack_count =
+    Config::Lookup<uint32_t>("fiber.shared_stack.count", 4, "shared fiber stack count per thread");
+static ConfigVar<uint32_t>::ptr g_fiber_shared_stack_size =
+    Config::Lookup<uint32_t>("fiber.shared_stack.size", 1024 * 1024, "shared fiber stack size");
+
+/**
+ * @brief 线程共享的执行栈，同一时刻栈上只保存一个协程(owner)的数据
+ * 
+ */
+struct SharedStack {
+    /// 栈低地址
+    void* stack = nullptr;
+    /// 栈大小
+    size_t size = 0;
+    /// 当前栈上数据所属的协程
+    Fiber* owner = nullptr;
+};
+
+/**
+ * @brief 线程本地的共享栈集合，协程依次轮流分配
+ * 
+ */
+class SharedStackPool {
 public:
-    static void* Alloc(size_t size) {
-        return malloc(size);
+    SharedStackPool() {
+        m_size = MmapStackAllocator::RoundUp(g_fiber_shared_stack_size->getValue());
+        size_t count = g_fiber_shared_stack_count->getValue();
+        m_stacks.resize(count ? count : 1);
+        for (auto& i : m_stacks) {
+            i.stack = MmapStackAllocator::Map(m_size);
+            i.size = m_size;
+        }
+    }
+
+    ~SharedStackPool() {
+        for (auto& i : m_stacks) {
+            MmapStackAllocator::Unmap(i.stack, i.size);
+        }
+    }
+
+    SharedStack* next() {
+        SharedStack* rt = &m_stacks[m_next];
+        m_next = (m_next + 1) % m_stacks.size();
+        return rt;
     }
 
-    static void Dealloc(void* vp, size_t size) {
-        return free(vp);
+private:
+    std::vector<SharedStack> m_stacks;
+    size_t m_size = 0;
+    size_t m_next = 0;
+};
+
+static SharedStackPool& GetSharedStackPool() {
+    static thread_local SharedStackPool t_pool;
+    return t_pool;
+}
+
+/// 每个线程最多缓存的已结束协程数量
+static ConfigVar<uint32_t>::ptr g_fiber_freelist_cap =
+    Config::Lookup<uint32_t>("fiber.freelist.cap", 64, "max terminated fibers cached per thread for reuse");
+
+static uint32_t s_fiber_freelist_cap = 64;
+
+/**
+ * @brief 线程本地的已结束协程链表，复用协程对象及其栈
+ * 
+ * @return std::vector<Fiber::ptr>& 
+ */
+static std::vector<Fiber::ptr>& GetFreeList() {
+    static thread_local std::vector<Fiber::ptr> t_free_fibers;
+    return t_free_fibers;
+}
+
+/// 协程结束时是否探测栈的最高使用量
+static ConfigVar<bool>::ptr g_fiber_stack_probe =
+    Config::Lookup<bool>("fiber.stack_probe", false, "probe fiber stack high-water mark when fiber terminates");
+
+static bool s_fiber_stack_probe = false;
+
+struct _FiberIniter {
+    _FiberIniter() {
+        s_fiber_stack_probe = g_fiber_stack_probe->getValue();
+        s_fiber_freelist_cap = g_fiber_freelist_cap->getValue();
+        g_fiber_freelist_cap->addListener([](const uint32_t& old_value, const uint32_t& new_value) {
+            s_fiber_freelist_cap = new_value;
+        });
+        g_fiber_stack_probe->addListener([](const bool& old_value, const bool& new_value) {
+            ZERO_LOG_INFO(g_logger) << "fiber stack probe changed from " << old_value << " to " << new_value;
+            s_fiber_stack_probe = new_value;
+        });
     }
 };
 
-using StackAllocator = MallocStackAllocator;
+static _FiberIniter s_fiber_initer;
+
+/**
+ * @brief 单个回调点的栈使用量统计，按2的幂分桶，第一个桶为<=4K
+ * 
+ */
+struct StackUsageStat {
+    static const size_t BUCKETS = 10;
+
+    /// 结束的协程数
+    uint64_t count = 0;
+    /// 使用量总和
+    uint64_t total = 0;
+    /// 最大使用量
+    size_t max = 0;
+    /// 最近一次的栈大小
+    size_t stacksize = 0;
+    /// 直方图
+    uint64_t buckets[BUCKETS] = { 0 };
+};
+
+static Mutex& GetStackUsageMutex() {
+    static Mutex s_mutex;
+    return s_mutex;
+}
+
+/// 回调点名称到统计的映射
+static std::map<std::string, StackUsageStat>& GetStackUsage() {
+    static std::map<std::string, StackUsageStat> s_usage;
+    return s_usage;
+}
+
+/**
+ * @brief 没有设置回调点名称时用回调的类型名
+ * 
+ * @param type 
+ * @return std::string 
+ */
+static std::string StackSiteName(const std::type_info& type) {
+    int status = 0;
+    char* name = abi::__cxa_demangle(type.name(), nullptr, nullptr, &status);
+    std::string rt = status == 0 && name ? name : type.name();
+    free(name);
+    return rt;
+}
+
+static void RecordStackUsage(const std::string& site, size_t used, size_t stacksize) {
+    size_t idx = 0;
+    while (idx + 1 < StackUsageStat::BUCKETS && used > (( size_t )4096 << idx)) {
+        ++idx;
+    }
+    Mutex::Lock lock(GetStackUsageMutex());
+    StackUsageStat& stat = GetStackUsage()[site];
+    ++stat.count;
+    stat.total += used;
+    stat.max = std::max(stat.max, used);
+    stat.stacksize = stacksize;
+    ++stat.buckets[idx];
+}
 
 uint64_t Fiber::GetFiberId() {
     if (t_fiber) {
@@ -54,33 +202,41 @@ Fiber::Fiber() {
     m_state = EXEC;
     SetThis(this);
 
+#ifdef ZERO_USE_UCONTEXT
     if (getcontext(&m_ctx)) {
         ZERO_ASSERT2(false, "getcontext");
     }
+#endif
     ++s_fiber_count;
     ZERO_LOG_INFO(g_logger) << "Fiber::Fiber main";
 }
 
-Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool use_caller) : m_id(++s_fiber_id), m_cb(cb) {
+Fiber::Fiber(Task cb, size_t stacksize, bool use_caller, bool shared_stack) : m_id(++s_fiber_id), m_cb(std::move(cb)) {
     ++s_fiber_count;
-    m_stacksize = stacksize ? stacksize : g_fiber_static_size->getValue();
-
-    m_stack = StackAllocator::Alloc(m_stacksize);
-    if (getcontext(&m_ctx)) {
-        ZERO_ASSERT2(false, "getcontext");
+    m_site = &m_cb.target_type();
+#ifdef ZERO_USE_UCONTEXT
+    /// ucontext拿不到切出时的栈指针，共享栈模式退化为独立栈
+    shared_stack = false;
+#endif
+    if (shared_stack) {
+        /// 共享栈在第一次切入时才分配并初始化上下文
+        ZERO_ASSERT2(!use_caller, "shared stack fiber must be scheduled");
+        m_useSharedStack = true;
+        ZERO_LOG_INFO(g_logger) << "Fiber::Fiber id = " << m_id << " shared stack";
+        return;
     }
+    m_stacksize = stacksize ? stacksize : g_fiber_static_size->getValue();
 
-    /// 由调度器来调度切换
-    m_ctx.uc_link = nullptr;
-    m_ctx.uc_stack.ss_sp = m_stack;
-    m_ctx.uc_stack.ss_size = m_stacksize;
+    /// 栈分配器由StackAllocator::GetDefault()决定，默认从池中取带保护页的mmap栈
+    m_allocator = StackAllocator::GetDefault();
+    m_stack = m_allocator->alloc(m_stacksize);
 
     if (!use_caller) {
         /// 调度器调度
-        makecontext(&m_ctx, &Fiber::MainFunc, 0);
+        initContext(&Fiber::MainFunc);
     } else {
         /// 自己调度
-        makecontext(&m_ctx, &Fiber::CallerMainFunc, 0);
+        initContext(&Fiber::CallerMainFunc);
     }
     ZERO_LOG_INFO(g_logger) << "Fiber::Fiber id = " << m_id;
 }
@@ -93,9 +249,13 @@ Fiber::~Fiber() {
     } else {
         ZERO_LOG_INFO(g_logger) << "Fiber::~Fiber id = " << m_id << " total = " << s_fiber_count;
     }
-    if (m_stack) {
+    if (m_useSharedStack) {
+        /// 结束时已在swapIn中释放了共享栈，这里只需释放备份
+        ZERO_ASSERT(m_state == TERM || m_state == EXCEPT || m_state == INIT);
+        free(m_saveBuf);
+    } else if (m_stack) {
         ZERO_ASSERT(m_state == TERM || m_state == EXCEPT || m_state == INIT);
-        StackAllocator::Dealloc(m_stack, m_stacksize);
+        m_allocator->dealloc(m_stack, m_stacksize);
     } else {
         /// 没用到栈，即主协程
         ZERO_ASSERT(!m_cb);
@@ -108,45 +268,209 @@ Fiber::~Fiber() {
     }
 }
 
-void Fiber::reset(std::function<void()> cb) {
-    ZERO_ASSERT(m_stack);
+void Fiber::reset(Task cb) {
+    ZERO_ASSERT(m_stack || m_useSharedStack);
     ZERO_ASSERT(m_state == TERM || m_state == EXCEPT || m_state == INIT);
-    m_cb = cb;
+    m_cb = std::move(cb);
+    m_site = &m_cb.target_type();
+    m_siteTag = nullptr;
+    /// 复用的协程不继承上一个任务的截止时间
+    m_deadline = ~0ull;
+    if (m_useSharedStack) {
+        /// 下次切入时重新初始化上下文
+        m_ctx = nullptr;
+        m_saveSize = 0;
+    } else {
+        initContext(&Fiber::MainFunc);
+    }
+    m_state = INIT;
+}
+
+void Fiber::initContext(void (*func)()) {
+#ifdef ZERO_USE_UCONTEXT
     if (getcontext(&m_ctx)) {
         ZERO_ASSERT2(false, "getcontext");
     }
 
+    /// 由调度器来调度切换
     m_ctx.uc_link = nullptr;
     m_ctx.uc_stack.ss_sp = m_stack;
     m_ctx.uc_stack.ss_size = m_stacksize;
 
-    makecontext(&m_ctx, &Fiber::MainFunc, 0);
-    m_state = INIT;
+    makecontext(&m_ctx, func, 0);
+#else
+    /// 栈向低地址增长，从栈顶开始构造初始上下文
+    m_ctx = zero_make_fcontext(( char* )m_stack + m_stacksize, m_stacksize, func);
+#endif
+}
+
+void Fiber::swapContext(Fiber* to) {
+#ifdef ZERO_USE_UCONTEXT
+    /// swapcontext每次都会有一次rt_sigprocmask系统调用
+    if (swapcontext(&m_ctx, &to->m_ctx)) {
+        ZERO_ASSERT2(false, "swapcontext");
+    }
+#else
+    zero_jump_fcontext(&m_ctx, to->m_ctx);
+#endif
+}
+
+void Fiber::restoreSharedStack() {
+#ifndef ZERO_USE_UCONTEXT
+    /// 共享栈上的数据包含指向栈内的指针，只能恢复到原来的地址，所以协程绑定在第一次运行的线程上
+    if (m_thread == -1) {
+        m_thread = zero::GetThreadId();
+    }
+    ZERO_ASSERT2(m_thread == zero::GetThreadId(), "shared stack fiber id=" << m_id << " bound to thread " << m_thread);
+
+    if (!m_sharedStack) {
+        m_sharedStack = GetSharedStackPool().next();
+        m_stack = m_sharedStack->stack;
+        m_stacksize = m_sharedStack->size;
+    }
+
+    Fiber* owner = m_sharedStack->owner;
+    if (owner == this) {
+        /// 栈上还是自己的数据，无需拷贝
+        return;
+    }
+    if (owner) {
+        owner->saveSharedStack();
+    }
+    m_sharedStack->owner = this;
+
+    if (!m_ctx) {
+        initContext(&Fiber::MainFunc);
+    } else if (m_saveSize) {
+        memcpy(m_ctx, m_saveBuf, m_saveSize);
+    }
+#endif
+}
+
+void Fiber::saveSharedStack() {
+#ifndef ZERO_USE_UCONTEXT
+    /// 切出时m_ctx即栈指针，[m_ctx, 栈顶)为已用部分
+    char* top = ( char* )m_stack + m_stacksize;
+    size_t used = top - ( char* )m_ctx;
+    /// 缓冲区按实际使用大小分配，避免长期空闲的协程占用过多内存
+    if (used > m_saveCap || used < m_saveCap / 4) {
+        free(m_saveBuf);
+        m_saveBuf = ( char* )malloc(used);
+        ZERO_ASSERT(m_saveBuf);
+        m_saveCap = used;
+    }
+    memcpy(m_saveBuf, m_ctx, used);
+    m_saveSize = used;
+#endif
+}
+
+void Fiber::probeStack() {
+    /// 共享栈上的数据随时会被换出，探测没有意义
+    if (!m_stack || m_useSharedStack) {
+        return;
+    }
+    size_t page = MmapStackAllocator::PageSize();
+    uintptr_t top = ( uintptr_t )m_stack + m_stacksize;
+    uintptr_t begin = (( uintptr_t )m_stack + page - 1) & ~(page - 1);
+    uintptr_t end = top & ~(page - 1);
+    if (end <= begin) {
+        return;
+    }
+    size_t pages = (end - begin) / page;
+    static thread_local std::vector<unsigned char> t_vec;
+    t_vec.resize(pages);
+    if (mincore(( void* )begin, end - begin, t_vec.data())) {
+        ZERO_LOG_ERROR(g_logger) << "mincore fiber stack errno=" << errno << " errstr=" << strerror(errno);
+        return;
+    }
+    /// 栈向低地址增长，最低的已提交页即最高使用位置
+    size_t i = 0;
+    while (i < pages && !(t_vec[i] & 1)) {
+        ++i;
+    }
+    uintptr_t low = begin + i * page;
+    RecordStackUsage(m_siteTag ? std::string(m_siteTag) : StackSiteName(*m_site), top - low, m_stacksize);
+
+    /// 保留最高一页(池化分配器的空闲链表节点在那里)，其余归还系统，
+    /// 栈回到池中后不再占用RSS，复用时也不会把上一个协程的页算进来
+    if (low + page < end && madvise(( void* )low, end - page - low, MADV_DONTNEED)) {
+        ZERO_LOG_ERROR(g_logger) << "madvise fiber stack errno=" << errno << " errstr=" << strerror(errno);
+    }
+}
+
+void Fiber::DumpStackUsage(std::ostream& os) {
+    std::map<std::string, StackUsageStat> usage;
+    {
+        Mutex::Lock lock(GetStackUsageMutex());
+        usage = GetStackUsage();
+    }
+    os << "[FiberStackUsage probe=" << s_fiber_stack_probe << " sites=" << usage.size() << "]" << std::endl;
+    for (auto& i : usage) {
+        const StackUsageStat& stat = i.second;
+        os << "    site=" << i.first << std::endl
+           << "        count=" << stat.count << " avg=" << (stat.count ? stat.total / stat.count : 0)
+           << " max=" << stat.max << " stack_size=" << stat.stacksize << std::endl
+           << "       ";
+        for (size_t j = 0; j < StackUsageStat::BUCKETS; ++j) {
+            if (j + 1 < StackUsageStat::BUCKETS) {
+                os << " <=" << (4 << j) << "K:" << stat.buckets[j];
+            } else {
+                os << " >" << (4 << (j - 1)) << "K:" << stat.buckets[j];
+            }
+        }
+        os << std::endl;
+    }
+}
+
+size_t Fiber::GetStackUsageMax(const std::type_info& site) {
+    return GetStackUsageMax(StackSiteName(site));
+}
+
+size_t Fiber::GetStackUsageMax(const std::string& site) {
+    Mutex::Lock lock(GetStackUsageMutex());
+    auto it = GetStackUsage().find(site);
+    return it == GetStackUsage().end() ? 0 : it->second.max;
+}
+
+void Fiber::SetStackSite(const char* site) {
+    if (t_fiber) {
+        t_fiber->m_siteTag = site;
+    }
 }
 
 /// 主协程上下文保存在调用该函数的地方
 void Fiber::call() {
     SetThis(this);
     m_state = EXEC;
-    if (swapcontext(&t_threadFiber->m_ctx, &m_ctx)) {
-        ZERO_ASSERT2(false, "swapcontext");
+    t_threadFiber->swapContext(this);
+    if (s_fiber_stack_probe && (m_state == TERM || m_state == EXCEPT)) {
+        probeStack();
     }
 }
 
 void Fiber::back() {
     SetThis(t_threadFiber.get());
-    if (swapcontext(&m_ctx, &t_threadFiber->m_ctx)) {
-        ZERO_ASSERT2(false, "swapcontext");
-    }
+    swapContext(t_threadFiber.get());
 }
 
 /// 主协程上下文保存在调用该函数的地方
 void Fiber::swapIn() {
-    SetThis(this);
     ZERO_ASSERT(m_state != EXEC);
+    if (m_useSharedStack) {
+        restoreSharedStack();
+    }
+    SetThis(this);
     m_state = EXEC;
-    if(swapcontext(&Scheduler::GetMainFiber()->m_ctx, &m_ctx)) {
-        ZERO_ASSERT2(false, "swapcontext");
+    Scheduler::GetMainFiber()->swapContext(this);
+    if (s_fiber_stack_probe && (m_state == TERM || m_state == EXCEPT)) {
+        probeStack();
+    }
+    if (m_useSharedStack && (m_state == TERM || m_state == EXCEPT)) {
+        /// 执行完毕，栈上数据作废，让出共享栈
+        m_sharedStack->owner = nullptr;
+        free(m_saveBuf);
+        m_saveBuf = nullptr;
+        m_saveSize = m_saveCap = 0;
     }
 }
 
@@ -154,9 +478,7 @@ void Fiber::swapIn() {
 void Fiber::swapOut() {
     /// 多线程情况下，切换到执行线程的主协程中去
     SetThis(Scheduler::GetMainFiber());
-    if(swapcontext(&m_ctx, &Scheduler::GetMainFiber()->m_ctx)) {
-        ZERO_ASSERT2(false, "swapcontext");
-    }
+    swapContext(Scheduler::GetMainFiber());
 }
 
 void Fiber::SetThis(Fiber* f) {
@@ -175,15 +497,57 @@ Fiber::ptr Fiber::GetThis() {
     return t_fiber->shared_from_this();
 }
 
+Fiber* Fiber::GetThisRaw() {
+    if (t_fiber) {
+        return t_fiber;
+    }
+    return GetThis().get();
+}
+
+Fiber::ptr Fiber::Alloc(Task cb) {
+    std::vector<Fiber::ptr>& free_fibers = GetFreeList();
+    if (!free_fibers.empty()) {
+        Fiber::ptr fiber = std::move(free_fibers.back());
+        free_fibers.pop_back();
+        fiber->reset(std::move(cb));
+        return fiber;
+    }
+    return Fiber::ptr(new Fiber(std::move(cb)));
+}
+
+bool Fiber::Recycle(Fiber::ptr& fiber) {
+    if (fiber.use_count() != 1 || (fiber->m_state != TERM && fiber->m_state != EXCEPT)) {
+        return false;
+    }
+    /// 只复用默认规格的协程，Alloc出来的协程不会和调用方指定的栈大小不符
+    if (!fiber->m_stack || fiber->m_useSharedStack || fiber->m_stacksize != g_fiber_static_size->getValue()) {
+        return false;
+    }
+    std::vector<Fiber::ptr>& free_fibers = GetFreeList();
+    if (free_fibers.size() >= s_fiber_freelist_cap) {
+        return false;
+    }
+    /// 异常结束的协程还持有回调，及时释放回调绑定的资源
+    fiber->m_cb = nullptr;
+    free_fibers.push_back(std::move(fiber));
+    return true;
+}
+
+void Fiber::ClearFreeList() {
+    std::vector<Fiber::ptr> free_fibers;
+    free_fibers.swap(GetFreeList());
+}
+
 void Fiber::YieldToReady() {
-    Fiber::ptr cur = GetThis();
+    /// 当前协程一定被调度器或调用者持有，不需要再增加引用计数
+    Fiber* cur = GetThisRaw();
     ZERO_ASSERT(cur->m_state == EXEC);
     cur->m_state = READY;
     cur->swapOut();
 }
 
 void Fiber::YieldToHold() {
-    Fiber::ptr cur = GetThis();
+    Fiber* cur = GetThisRaw();
     ZERO_ASSERT(cur->m_state == EXEC);
     cur->swapOut();
 }
@@ -193,7 +557,8 @@ uint64_t Fiber::TotalFibers() {
 }
 
 void Fiber::MainFunc() {
-    Fiber::ptr cur = GetThis();
+    /// 调度器在swapIn期间持有协程的引用，这里只用裸指针，协程结束后由持有者决定释放还是回收
+    Fiber* cur = GetThisRaw();
     ZERO_ASSERT(cur);
     try {
         cur->m_cb();
@@ -210,18 +575,14 @@ void Fiber::MainFunc() {
                                  << zero::BacktraceToString();
     }
 
-    auto raw_ptr = cur.get();
-    /// 让子协程引用计数减1
-    /// 当外部函数执行完，引用计数为0时，自动释放
-    cur.reset();  
-    raw_ptr->swapOut();
+    cur->swapOut();
 
-    ZERO_ASSERT2(false, "never reach fiber_id=" + std::to_string(raw_ptr->getId()));
+    ZERO_ASSERT2(false, "never reach fiber_id=" + std::to_string(cur->getId()));
 }
 
 void Fiber::CallerMainFunc() {
-    /// 子协程引用计数会加1
-    Fiber::ptr cur = GetThis();
+    /// 调用者在call期间持有协程的引用
+    Fiber* cur = GetThisRaw();
     ZERO_ASSERT(cur);
     try {
         cur->m_cb();
@@ -238,12 +599,41 @@ void Fiber::CallerMainFunc() {
                                  << zero::BacktraceToString();
     }
 
-    auto raw_ptr = cur.get();
-    /// 让子协程引用计数减1
-    /// 当外部函数执行完，引用计数为0时，自动释放
-    cur.reset();
-    raw_ptr->back();
-    ZERO_ASSERT2(false, "never reach fiber_id=" + std::to_string(raw_ptr->getId()));
+    cur->back();
+    ZERO_ASSERT2(false, "never reach fiber_id=" + std::to_string(cur->getId()));
+}
+
+uint64_t Fiber::GetRemainingUS() {
+    /// 不用GetThisRaw，没有协程的线程不为此创建主协程
+    uint64_t deadline = t_fiber ? t_fiber->m_deadline : ~0ull;
+    if (deadline == ~0ull) {
+        return ~0ull;
+    }
+    uint64_t now = Clock::MonotonicUS();
+    return deadline > now ? deadline - now : 0;
+}
+
+DeadlineScope::DeadlineScope(uint64_t timeout_ms) : m_fiber(t_fiber), m_old(~0ull) {
+    /// 线程还没有协程时没有可以设置的对象，作用域不生效
+    if (!m_fiber) {
+        return;
+    }
+    m_old = m_fiber->getDeadline();
+    uint64_t now = Clock::MonotonicUS();
+    /// 超出范围(包括~0ull)按没有截止时间处理
+    if (timeout_ms >= (~0ull - now) / 1000) {
+        return;
+    }
+    uint64_t deadline = now + timeout_ms * 1000;
+    if (deadline < m_old) {
+        m_fiber->setDeadline(deadline);
+    }
+}
+
+DeadlineScope::~DeadlineScope() {
+    if (m_fiber) {
+        m_fiber->setDeadline(m_old);
+    }
 }
 
-}  // namespace zero
\ No newline at end of file
+}  // namespace zero
@@ -5,12 +5,22 @@
 #include <cstddef>
 #include <functional>
 #include <memory>
+#include <ostream>
+#include <string>
+#include <typeinfo>
+#ifdef ZERO_USE_UCONTEXT
 #include <sys/ucontext.h>
 #include <ucontext.h>
+#else
+#include "fcontext.h"
+#endif
+#include "task.h"
 
 namespace zero {
 
 class Scheduler;
+class StackAllocator;
+struct SharedStack;
 /// enable_shared_from_this即只有this指针时，如何安全得到this的shared_ptr
 class Fiber : public std::enable_shared_from_this<Fiber> {
 friend class Scheduler;
@@ -46,8 +56,10 @@ public:
      * @param cb 协程执行函数
      * @param stacksize 协程栈大小 
      * @param use_caller 是否在MainFiber上调度
+     * @param shared_stack 是否运行在线程共享栈上(切出时只备份栈上已用部分，适合大量空闲连接)，
+     *                     第一次运行后协程绑定到该线程，stacksize无效
      */
-    Fiber(std::function<void()> cb, size_t stacksize = 0, bool use_caller = false);
+    Fiber(Task cb, size_t stacksize = 0, bool use_caller = false, bool shared_stack = false);
 
     ~Fiber();
 
@@ -56,7 +68,7 @@ public:
      * 
      * @param cb 
      */
-    void reset(std::function<void()> cb);
+    void reset(Task cb);
 
     /**
      * @brief 将当前协程切换到运行状态
@@ -100,6 +112,53 @@ public:
         return m_state;
     }
 
+    /**
+     * @brief 是否运行在共享栈上
+     * 
+     * @return true 
+     * @return false 
+     */
+    bool isSharedStack() const {
+        return m_useSharedStack;
+    }
+
+    /**
+     * @brief 协程绑定的线程id，-1表示可以在任意线程上执行
+     * 
+     * @return int 
+     */
+    int getThread() const {
+        return m_thread;
+    }
+
+    /**
+     * @brief 共享栈模式下切出时备份的栈数据大小
+     * 
+     * @return size_t 
+     */
+    size_t getSavedStackSize() const {
+        return m_saveSize;
+    }
+
+    /**
+     * @brief 截止时间，Clock单调时钟微秒
+     * 
+     * @return uint64_t ~0ull表示没有截止时间
+     */
+    uint64_t getDeadline() const {
+        return m_deadline;
+    }
+
+    /**
+     * @brief 设置截止时间，hook的IO、connect和sleep等待时都不会超过它，过了之后直接以ETIMEDOUT失败
+     *        一般通过DeadlineScope设置
+     * 
+     * @param deadline_us Clock单调时钟微秒，~0ull表示取消
+     */
+    void setDeadline(uint64_t deadline_us) {
+        m_deadline = deadline_us;
+    }
+
 public:
     /**
      * @brief 设置当前线程的运行协程
@@ -115,6 +174,36 @@ public:
      */
     static Fiber::ptr GetThis();
 
+    /**
+     * @brief 返回当前所在协程的裸指针，不增加引用计数，用于让出/切换等热路径
+     * 
+     * @return Fiber* 
+     */
+    static Fiber* GetThisRaw();
+
+    /**
+     * @brief 创建一个由调度器调度的协程，优先复用当前线程空闲链表中已结束的协程
+     * 
+     * @param cb 协程执行函数
+     * @return Fiber::ptr 
+     */
+    static Fiber::ptr Alloc(Task cb);
+
+    /**
+     * @brief 回收已结束且没有其他引用的协程到当前线程的空闲链表(默认栈大小、独立栈)
+     * 
+     * @param fiber 回收成功后置空
+     * @return true 已回收
+     * @return false 不满足条件，交由引用计数释放
+     */
+    static bool Recycle(Fiber::ptr& fiber);
+
+    /**
+     * @brief 释放当前线程空闲链表中的协程，调度线程退出前调用
+     * 
+     */
+    static void ClearFreeList();
+
     /**
      * @brief 当前协程让出CPU切换到后台,并设置READY状态
      * 
@@ -134,6 +223,38 @@ public:
      */
     static uint64_t TotalFibers();
 
+    /**
+     * @brief 输出按回调点统计的协程栈最高使用量直方图(需开启fiber.stack_probe)
+     * 
+     * @param os 
+     */
+    static void DumpStackUsage(std::ostream& os);
+
+    /**
+     * @brief 回调点的栈最高使用量(需开启fiber.stack_probe)
+     * 
+     * @param site 回调的类型，即typeid(cb)
+     * @return size_t 没有记录时返回0
+     */
+    static size_t GetStackUsageMax(const std::type_info& site);
+
+    /**
+     * @brief 按SetStackSite设置的名称查询栈最高使用量
+     * 
+     * @param site 
+     * @return size_t 没有记录时返回0
+     */
+    static size_t GetStackUsageMax(const std::string& site);
+
+    /**
+     * @brief 为当前协程设置统计栈使用量的回调点名称，覆盖默认的回调类型
+     *        同类型的回调(std::function、std::bind)按类型统计会合并成一个点，在回调里调用以区分
+     *        名称需在程序运行期间一直有效(如字符串字面量)
+     * 
+     * @param site 
+     */
+    static void SetStackSite(const char* site);
+
     /**
      * @brief 协程执行函数,执行完返回到线程的主协程
      * 
@@ -152,6 +273,46 @@ public:
      */
     static uint64_t GetFiberId();
 
+    /**
+     * @brief 当前协程距截止时间还剩的微秒数
+     * 
+     * @return uint64_t 没有截止时间返回~0ull，已经过了返回0
+     */
+    static uint64_t GetRemainingUS();
+
+private:
+    /**
+     * @brief 在协程栈上初始化上下文，切入后从func开始执行
+     * 
+     * @param func 
+     */
+    void initContext(void (*func)());
+
+    /**
+     * @brief 保存当前上下文到本协程，并切换到to的上下文
+     * 
+     * @param to 
+     */
+    void swapContext(Fiber* to);
+
+    /**
+     * @brief 协程结束后探测栈的最高使用量(mincore统计已提交的页)，计入回调点直方图，并释放已提交的页
+     * 
+     */
+    void probeStack();
+
+    /**
+     * @brief 共享栈模式，切入前在调度协程上执行：必要时备份当前占用者的栈，再恢复本协程的栈
+     * 
+     */
+    void restoreSharedStack();
+
+    /**
+     * @brief 共享栈模式，把栈上已用部分备份到堆上
+     * 
+     */
+    void saveSharedStack();
+
 private:
     /// 协程id
     uint64_t m_id = 0;
@@ -160,11 +321,62 @@ private:
     /// 协程状态
     State m_state = INIT;
     /// 协程上下文
+#ifdef ZERO_USE_UCONTEXT
     ucontext_t m_ctx;
+#else
+    fcontext_t m_ctx = nullptr;
+#endif
     /// 协程运行栈指针
     void* m_stack = nullptr;
+    /// 分配协程栈的分配器
+    StackAllocator* m_allocator = nullptr;
     /// 协程运行函数
-    std::function<void()> m_cb;
+    Task m_cb;
+    /// 回调点(执行函数的类型)，用于按回调点统计栈使用量
+    const std::type_info* m_site = nullptr;
+    /// SetStackSite设置的回调点名称，为空时按m_site统计
+    const char* m_siteTag = nullptr;
+    /// 是否运行在共享栈上
+    bool m_useSharedStack = false;
+    /// 绑定的线程id，共享栈协程第一次运行后绑定
+    int m_thread = -1;
+    /// 使用的共享栈
+    SharedStack* m_sharedStack = nullptr;
+    /// 共享栈模式下栈上已用部分的备份
+    char* m_saveBuf = nullptr;
+    /// 备份数据大小
+    size_t m_saveSize = 0;
+    /// 备份缓冲区容量
+    size_t m_saveCap = 0;
+    /// 截止时间 微秒，~0ull表示没有
+    uint64_t m_deadline = ~0ull;
+};
+
+/**
+ * @brief 作用域内为当前协程设置截止时间，请求处理函数入口设置一次，之后每次hook的IO、connect、sleep
+ *        都只能用剩余的时间，整个请求的耗时因此有上界，不会是每次调用的超时之和
+ *        嵌套时取更早的截止时间，离开作用域恢复原来的
+ * 
+ */
+class DeadlineScope {
+public:
+    /**
+     * @brief Construct a new Deadline Scope object
+     * 
+     * @param timeout_ms 从现在起的时长，过大(如~0ull)时不设置截止时间；当前线程没有协程时不生效
+     */
+    explicit DeadlineScope(uint64_t timeout_ms);
+
+    ~DeadlineScope();
+
+    DeadlineScope(const DeadlineScope&) = delete;
+
+    DeadlineScope& operator=(const DeadlineScope&) = delete;
+
+private:
+    Fiber* m_fiber;
+    /// 进入作用域前的截止时间
+    uint64_t m_old;
 };
 
 }  // namespace zero
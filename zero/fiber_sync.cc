@@ -0,0 +1,257 @@
+#include "fiber_sync.h"
+#include "macro.h"
+#include "scheduler.h"
+
+namespace zero {
+
+FiberWaiter::FiberWaiter() {
+    Scheduler* scheduler = Scheduler::GetThis();
+    /// 主协程和调度协程不能被挂起，只能阻塞线程
+    if (scheduler && Fiber::GetFiberId() != 0 && Fiber::GetThisRaw() != Scheduler::GetMainFiber()) {
+        m_scheduler = scheduler;
+        m_fiber = Fiber::GetThis();
+    } else {
+        m_sem.reset(new Semaphore(0));
+    }
+}
+
+void FiberWaiter::park() {
+    if (m_fiber) {
+        Fiber::YieldToHold();
+    } else {
+        m_sem->wait();
+    }
+}
+
+void FiberWaiter::notify(bool handoff) {
+    if (m_fiber) {
+        if (handoff) {
+            m_scheduler->scheduleNext(m_fiber);
+        } else {
+            m_scheduler->schedule(m_fiber);
+        }
+    } else {
+        m_sem->notify();
+    }
+}
+
+void FiberMutex::lock() {
+    int expected = 0;
+    if (m_state.compare_exchange_strong(expected, 1, std::memory_order_acquire)) {
+        return;
+    }
+
+    FiberWaiter waiter;
+    m_mutex.lock();
+    /// 置为2后持有者解锁时一定会走慢路径检查等待队列
+    if (m_state.exchange(2, std::memory_order_acquire) == 0) {
+        /// 锁恰好被释放了，解锁时会直接移交，所以此时队列一定为空
+        m_state.store(1, std::memory_order_relaxed);
+        m_mutex.unlock();
+        return;
+    }
+    m_waiters.push_back(waiter);
+    m_mutex.unlock();
+    /// 被唤醒时锁已经移交给自己
+    waiter.park();
+}
+
+bool FiberMutex::tryLock() {
+    int expected = 0;
+    return m_state.compare_exchange_strong(expected, 1, std::memory_order_acquire);
+}
+
+void FiberMutex::unlock() {
+    int expected = 1;
+    if (m_state.compare_exchange_strong(expected, 0, std::memory_order_release)) {
+        return;
+    }
+    ZERO_ASSERT2(expected == 2, "FiberMutex unlock state=" << expected);
+
+    m_mutex.lock();
+    if (m_waiters.empty()) {
+        m_state.store(0, std::memory_order_release);
+        m_mutex.unlock();
+        return;
+    }
+    /// 不释放锁，直接交给队首的等待者，避免被新来的加锁者抢走导致等待者饿死
+    FiberWaiter waiter = m_waiters.front();
+    m_waiters.pop_front();
+    m_state.store(m_waiters.empty() ? 1 : 2, std::memory_order_release);
+    m_mutex.unlock();
+    waiter.notify();
+}
+
+void FiberCondition::notify() {
+    m_mutex.lock();
+    if (m_waiters.empty()) {
+        m_mutex.unlock();
+        return;
+    }
+    FiberWaiter waiter = m_waiters.front();
+    m_waiters.pop_front();
+    m_mutex.unlock();
+    waiter.notify();
+}
+
+void FiberCondition::notifyAll() {
+    FiberWaitQueue waiters;
+    m_mutex.lock();
+    waiters.swap(m_waiters);
+    m_mutex.unlock();
+    for (auto& i : waiters) {
+        i.notify();
+    }
+}
+
+void FiberSemaphore::wait() {
+    if (m_count.fetch_sub(1, std::memory_order_acquire) > 0) {
+        return;
+    }
+
+    FiberWaiter waiter;
+    m_mutex.lock();
+    if (m_wakeups) {
+        /// notify先于入队到达
+        --m_wakeups;
+        m_mutex.unlock();
+        return;
+    }
+    m_waiters.push_back(waiter);
+    m_mutex.unlock();
+    waiter.park();
+}
+
+bool FiberSemaphore::tryWait() {
+    int32_t count = m_count.load(std::memory_order_relaxed);
+    while (count > 0) {
+        if (m_count.compare_exchange_weak(count, count - 1, std::memory_order_acquire)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void FiberSemaphore::notify() {
+    if (m_count.fetch_add(1, std::memory_order_release) >= 0) {
+        return;
+    }
+
+    m_mutex.lock();
+    if (m_waiters.empty()) {
+        /// 等待者已扣减计数但还没入队
+        ++m_wakeups;
+        m_mutex.unlock();
+        return;
+    }
+    FiberWaiter waiter = m_waiters.front();
+    m_waiters.pop_front();
+    m_mutex.unlock();
+    waiter.notify();
+}
+
+void FiberRWMutex::rdlock() {
+    uint32_t s = m_state.load(std::memory_order_relaxed);
+    if (!(s & (WRITER | WAITERS)) && m_state.compare_exchange_strong(s, s + 1, std::memory_order_acquire)) {
+        return;
+    }
+
+    FiberWaiter waiter;
+    m_mutex.lock();
+    while (true) {
+        s = m_state.load(std::memory_order_relaxed);
+        if (!(s & WRITER) && m_writers.empty()) {
+            if (m_state.compare_exchange_weak(s, s + 1, std::memory_order_acquire)) {
+                m_mutex.unlock();
+                return;
+            }
+            continue;
+        }
+        /// 设置等待者标记后，持有者解锁时一定会走慢路径
+        if ((s & WAITERS) || m_state.compare_exchange_weak(s, s | WAITERS, std::memory_order_relaxed)) {
+            break;
+        }
+    }
+    m_readers.push_back(waiter);
+    m_mutex.unlock();
+    waiter.park();
+}
+
+void FiberRWMutex::wrlock() {
+    uint32_t s = 0;
+    if (m_state.compare_exchange_strong(s, WRITER, std::memory_order_acquire)) {
+        return;
+    }
+
+    FiberWaiter waiter;
+    m_mutex.lock();
+    while (true) {
+        s = m_state.load(std::memory_order_relaxed);
+        if (!(s & (WRITER | READERS))) {
+            if (m_state.compare_exchange_weak(s, s | WRITER, std::memory_order_acquire)) {
+                m_mutex.unlock();
+                return;
+            }
+            continue;
+        }
+        if ((s & WAITERS) || m_state.compare_exchange_weak(s, s | WAITERS, std::memory_order_relaxed)) {
+            break;
+        }
+    }
+    m_writers.push_back(waiter);
+    m_mutex.unlock();
+    waiter.park();
+}
+
+void FiberRWMutex::unlock() {
+    uint32_t s = m_state.load(std::memory_order_relaxed);
+    if (s & WRITER) {
+        s = WRITER;
+        if (m_state.compare_exchange_strong(s, 0, std::memory_order_release)) {
+            return;
+        }
+    } else {
+        while (!(s & WAITERS)) {
+            ZERO_ASSERT(s & READERS);
+            if (m_state.compare_exchange_weak(s, s - 1, std::memory_order_release)) {
+                return;
+            }
+        }
+    }
+
+    /// 有等待者时状态只在持有m_mutex时改变
+    FiberWaitQueue wake;
+    m_mutex.lock();
+    s = m_state.load(std::memory_order_relaxed);
+    if (s & WRITER) {
+        m_state.fetch_and(~WRITER, std::memory_order_release);
+        handoff(true, wake);
+    } else {
+        ZERO_ASSERT(s & READERS);
+        s = m_state.fetch_sub(1, std::memory_order_release) - 1;
+        if (!(s & READERS)) {
+            handoff(false, wake);
+        }
+    }
+    m_mutex.unlock();
+    for (auto& i : wake) {
+        i.notify();
+    }
+}
+
+void FiberRWMutex::handoff(bool prefer_reader, FiberWaitQueue& wake) {
+    if (!m_writers.empty() && (!prefer_reader || m_readers.empty())) {
+        wake.push_back(m_writers.front());
+        m_writers.pop_front();
+        m_state.store(WRITER | (m_writers.empty() && m_readers.empty() ? 0 : WAITERS), std::memory_order_release);
+    } else if (!m_readers.empty()) {
+        /// 唤醒所有排队的读者，替它们加上读锁
+        uint32_t count = m_readers.size();
+        wake.swap(m_readers);
+        m_state.store(count | (m_writers.empty() ? 0 : WAITERS), std::memory_order_release);
+    } else {
+        m_state.store(0, std::memory_order_release);
+    }
+}
+
+}  // namespace zero
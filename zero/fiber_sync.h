@@ -0,0 +1,220 @@
+#ifndef __ZERO_FIBER_SYNC_H__
+#define __ZERO_FIBER_SYNC_H__
+
+#include "fiber.h"
+#include "mutex.h"
+#include "noncopyable.h"
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <stdint.h>
+
+namespace zero {
+
+class Scheduler;
+
+/**
+ * @brief 同步原语上的等待者
+ *        在调度器的协程中等待时挂起协程(YieldToHold)，唤醒时通过Scheduler::schedule重新调度，不阻塞线程；
+ *        不在协程中(普通线程、调度协程)时退化为信号量阻塞线程
+ *
+ */
+class FiberWaiter {
+public:
+    /**
+     * @brief 绑定当前的执行环境(协程或线程)
+     *
+     */
+    FiberWaiter();
+
+    /**
+     * @brief 挂起直到被notify
+     *        调用前需已把自己的拷贝放入等待队列，并释放保护队列的锁
+     *
+     */
+    void park();
+
+    /**
+     * @brief 唤醒等待者
+     *        可能早于park被调用：协程仍处于EXEC状态时调度器会跳过它，等它让出后再执行
+     *
+     * @param handoff 唤醒者在同一调度器的线程上时，放入该线程的runnext槽位，唤醒者让出后立即执行
+     */
+    void notify(bool handoff = false);
+
+private:
+    /// 协程所在的调度器
+    Scheduler* m_scheduler = nullptr;
+    /// 等待的协程
+    Fiber::ptr m_fiber;
+    /// 非协程环境下阻塞线程用的信号量
+    std::shared_ptr<Semaphore> m_sem;
+};
+
+/// 等待队列，由各同步原语自己的锁保护
+typedef std::deque<FiberWaiter> FiberWaitQueue;
+
+/**
+ * @brief 协程互斥量
+ *        无竞争时加锁、解锁各只有一次CAS；有竞争时挂起协程，解锁时把锁直接交给队首的等待者
+ *
+ */
+class FiberMutex : Noncopyable {
+public:
+    typedef ScopedLockImpl<FiberMutex> Lock;
+
+    void lock();
+
+    /**
+     * @brief 尝试加锁
+     *
+     * @return true 加锁成功
+     * @return false 锁已被占用
+     */
+    bool tryLock();
+
+    void unlock();
+
+private:
+    /// 0 未加锁，1 加锁且没有等待者，2 加锁且可能有等待者
+    std::atomic<int> m_state{ 0 };
+    /// 保护等待队列
+    Spinlock m_mutex;
+    FiberWaitQueue m_waiters;
+};
+
+/**
+ * @brief 协程条件变量
+ *
+ */
+class FiberCondition : Noncopyable {
+public:
+    /**
+     * @brief 释放锁并挂起，被唤醒后重新加锁
+     *        可能被虚假唤醒，调用方需要在循环中检查条件
+     *
+     * @tparam LockType 带lock/unlock的锁，如FiberMutex、FiberMutex::Lock
+     * @param lock 已加锁的锁
+     */
+    template <class LockType>
+    void wait(LockType& lock) {
+        FiberWaiter waiter;
+        m_mutex.lock();
+        m_waiters.push_back(waiter);
+        m_mutex.unlock();
+        /// 先入队再解锁，解锁后的notify不会丢失
+        lock.unlock();
+        waiter.park();
+        lock.lock();
+    }
+
+    /**
+     * @brief 唤醒一个等待者
+     *
+     */
+    void notify();
+
+    /**
+     * @brief 唤醒所有等待者
+     *
+     */
+    void notifyAll();
+
+private:
+    Spinlock m_mutex;
+    FiberWaitQueue m_waiters;
+};
+
+/**
+ * @brief 协程信号量
+ *        m_count为负时表示等待者数量，wait/notify无竞争时各只有一次原子操作
+ *
+ */
+class FiberSemaphore : Noncopyable {
+public:
+    /**
+     * @brief Construct a new Fiber Semaphore object
+     *
+     * @param count 初始信号量值
+     */
+    FiberSemaphore(int32_t count = 0) : m_count(count) {}
+
+    /**
+     * @brief 获取信号量，不足时挂起
+     *
+     */
+    void wait();
+
+    /**
+     * @brief 尝试获取信号量
+     *
+     * @return true
+     * @return false
+     */
+    bool tryWait();
+
+    /**
+     * @brief 释放信号量，有等待者时唤醒一个
+     *
+     */
+    void notify();
+
+    /**
+     * @brief 当前信号量值，为负时表示等待者数量
+     *
+     * @return int32_t
+     */
+    int32_t getCount() const { return m_count; }
+
+private:
+    std::atomic<int32_t> m_count;
+    Spinlock m_mutex;
+    FiberWaitQueue m_waiters;
+    /// notify时等待者已扣减计数但还未入队，留给它的唤醒次数
+    uint32_t m_wakeups = 0;
+};
+
+/**
+ * @brief 协程读写锁
+ *        无竞争时加锁、解锁各只有一次CAS；有等待者时新的读锁也要排队，避免写者饿死
+ *        写锁释放时优先唤醒读者，读锁全部释放时优先唤醒写者
+ *
+ */
+class FiberRWMutex : Noncopyable {
+public:
+    typedef ReadScopedLockImpl<FiberRWMutex> ReadLock;
+    typedef WriteScopedLockImpl<FiberRWMutex> WriteLock;
+
+    void rdlock();
+
+    void wrlock();
+
+    void unlock();
+
+private:
+    /// 写锁标记
+    static const uint32_t WRITER = 1u << 31;
+    /// 有等待者标记，设置后加解锁都走慢路径
+    static const uint32_t WAITERS = 1u << 30;
+    /// 读者数量掩码
+    static const uint32_t READERS = WAITERS - 1;
+
+    /**
+     * @brief 锁空闲后把锁交给等待者，需持有m_mutex
+     *
+     * @param prefer_reader 是否优先交给读者
+     * @param wake 需要唤醒的等待者
+     */
+    void handoff(bool prefer_reader, FiberWaitQueue& wake);
+
+private:
+    /// 写锁标记 | 等待者标记 | 读者数量
+    std::atomic<uint32_t> m_state{ 0 };
+    Spinlock m_mutex;
+    FiberWaitQueue m_readers;
+    FiberWaitQueue m_writers;
+};
+
+}  // namespace zero
+
+#endif
@@ -0,0 +1,155 @@
+#include "future.h"
+#include "clock.h"
+#include "iomanager.h"
+#include "macro.h"
+#include "util.h"
+
+namespace zero {
+
+bool FutureWaitNode::Park(const ptr& node, uint64_t timeout_ms) {
+    TimerHandle timer;
+    if (timeout_ms != ~0ull) {
+        IOManager* iom = IOManager::GetThis();
+        ZERO_ASSERT2(iom, "Future timeout requires IOManager");
+        std::weak_ptr<FutureWaitNode> weak_node(node);
+        timer = iom->addOnceTimer(timeout_ms, [weak_node]() {
+            FutureWaitNode::ptr node = weak_node.lock();
+            if (node && node->claim()) {
+                node->timeout = true;
+                node->waiter.notify();
+            }
+        });
+    }
+    node->waiter.park();
+    timer.cancel();
+    return !node->timeout;
+}
+
+bool FutureStateBase::wait(uint64_t timeout_ms) {
+    if (isReady()) {
+        return true;
+    }
+    FutureWaitNode::ptr node(new FutureWaitNode);
+    if (!addWaiter(node, 0)) {
+        return true;
+    }
+    return FutureWaitNode::Park(node, timeout_ms);
+}
+
+bool FutureStateBase::addWaiter(const FutureWaitNode::ptr& node, int index) {
+    Spinlock::Lock lock(m_mutex);
+    if (isReady()) {
+        return false;
+    }
+    /// 超时或被其他Future唤醒的等待者留在队列里，攒多了清理一次
+    if (m_waiters.size() >= 32) {
+        auto it = m_waiters.begin();
+        for (auto& i : m_waiters) {
+            if (!i.node->claimed) {
+                *it++ = std::move(i);
+            }
+        }
+        m_waiters.erase(it, m_waiters.end());
+    }
+    m_waiters.push_back({ node, index });
+    return true;
+}
+
+void FutureStateBase::setException(std::exception_ptr error) {
+    satisfy();
+    m_error = error;
+    markReady();
+}
+
+void FutureStateBase::satisfy() {
+    bool expected = false;
+    ZERO_ASSERT2(m_satisfied.compare_exchange_strong(expected, true), "Promise already satisfied");
+}
+
+void FutureStateBase::markReady() {
+    std::vector<Entry> waiters;
+    m_mutex.lock();
+    m_ready.store(true, std::memory_order_release);
+    waiters.swap(m_waiters);
+    m_mutex.unlock();
+    for (auto& i : waiters) {
+        if (i.node->claim()) {
+            i.node->index = i.index;
+            i.node->waiter.notify();
+        }
+    }
+}
+
+void WaitGroup::add(int n) {
+    int count = m_count.fetch_add(n, std::memory_order_relaxed) + n;
+    ZERO_ASSERT2(count >= 0, "WaitGroup negative count=" << count);
+    if (count > 0) {
+        return;
+    }
+    std::vector<FutureWaitNode::ptr> waiters;
+    m_mutex.lock();
+    waiters.swap(m_waiters);
+    m_mutex.unlock();
+    for (auto& i : waiters) {
+        if (i->claim()) {
+            i->waiter.notify();
+        }
+    }
+}
+
+void WaitGroup::done() {
+    add(-1);
+}
+
+bool WaitGroup::wait(uint64_t timeout_ms) {
+    if (m_count.load(std::memory_order_acquire) == 0) {
+        return true;
+    }
+    FutureWaitNode::ptr node(new FutureWaitNode);
+    m_mutex.lock();
+    /// 在锁内再检查一次，计数归零的唤醒一定在入队之后
+    if (m_count.load(std::memory_order_acquire) == 0) {
+        m_mutex.unlock();
+        return true;
+    }
+    m_waiters.push_back(node);
+    m_mutex.unlock();
+    return FutureWaitNode::Park(node, timeout_ms);
+}
+
+bool WhenAll(const std::vector<FutureStateBase::ptr>& states, uint64_t timeout_ms) {
+    uint64_t deadline = timeout_ms == ~0ull ? ~0ull : Clock::MonotonicMS() + timeout_ms;
+    for (auto& i : states) {
+        uint64_t left = ~0ull;
+        if (deadline != ~0ull) {
+            uint64_t now = Clock::MonotonicMS();
+            left = deadline > now ? deadline - now : 0;
+        }
+        if (!i->wait(left)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int WhenAny(const std::vector<FutureStateBase::ptr>& states, uint64_t timeout_ms) {
+    if (states.empty()) {
+        return -1;
+    }
+    FutureWaitNode::ptr node(new FutureWaitNode);
+    for (size_t i = 0; i < states.size(); ++i) {
+        if (!states[i]->addWaiter(node, i)) {
+            if (node->claim()) {
+                return i;
+            }
+            /// 已经被先前注册的Future占住，它的唤醒一定会到达
+            break;
+        }
+    }
+    if (!FutureWaitNode::Park(node, timeout_ms)) {
+        return -1;
+    }
+    return node->index;
+}
+
+}  // namespace zero
@@ -0,0 +1,394 @@
+#ifndef __ZERO_FUTURE_H__
+#define __ZERO_FUTURE_H__
+
+#include "fiber_sync.h"
+#include "mutex.h"
+#include "noncopyable.h"
+#include "scheduler.h"
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <stdexcept>
+#include <stdint.h>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace zero {
+
+/**
+ * @brief Future/WaitGroup上挂起的等待者
+ *        whenAny会把同一个等待者注册到多个Future上，最先占住它的一方(完成的Future或超时定时器)负责唤醒
+ *
+ */
+struct FutureWaitNode {
+    typedef std::shared_ptr<FutureWaitNode> ptr;
+
+    /// 挂起的协程或线程
+    FiberWaiter waiter;
+    /// 是否已被占住
+    std::atomic<bool> claimed{ false };
+    /// 唤醒它的Future在whenAny中的下标
+    int index = -1;
+    /// 是否因超时被唤醒
+    bool timeout = false;
+
+    bool claim() {
+        bool expected = false;
+        return claimed.compare_exchange_strong(expected, true);
+    }
+
+    /**
+     * @brief 挂起直到被唤醒或超时
+     *        超时由当前线程IOManager的条件定时器实现，等待者释放后定时器自动失效
+     *
+     * @param node
+     * @param timeout_ms ~0ull表示不超时
+     * @return true 被唤醒
+     * @return false 超时
+     */
+    static bool Park(const ptr& node, uint64_t timeout_ms);
+};
+
+/**
+ * @brief Future共享状态中与值类型无关的部分
+ *
+ */
+class FutureStateBase : Noncopyable {
+public:
+    typedef std::shared_ptr<FutureStateBase> ptr;
+
+    bool isReady() const { return m_ready.load(std::memory_order_acquire); }
+
+    /**
+     * @brief 挂起直到完成
+     *
+     * @param timeout_ms ~0ull表示不超时
+     * @return true 已完成
+     * @return false 超时
+     */
+    bool wait(uint64_t timeout_ms = ~0ull);
+
+    /**
+     * @brief 注册等待者，完成时唤醒
+     *
+     * @param node
+     * @param index 唤醒时写入node->index
+     * @return true 已注册
+     * @return false 已经完成，没有注册
+     */
+    bool addWaiter(const FutureWaitNode::ptr& node, int index);
+
+    /**
+     * @brief 以异常结束
+     *
+     * @param error
+     */
+    void setException(std::exception_ptr error);
+
+    /**
+     * @brief 是否已经设置过结果
+     *
+     * @return true
+     * @return false
+     */
+    bool isSatisfied() const { return m_satisfied; }
+
+protected:
+    /**
+     * @brief 占住设置结果的权利，只能设置一次
+     *
+     */
+    void satisfy();
+
+    /**
+     * @brief 结果已写入，唤醒所有等待者
+     *
+     */
+    void markReady();
+
+    /**
+     * @brief 有异常时抛出
+     *
+     */
+    void rethrow() const {
+        if (m_error) {
+            std::rethrow_exception(m_error);
+        }
+    }
+
+private:
+    struct Entry {
+        FutureWaitNode::ptr node;
+        int index;
+    };
+
+    Spinlock m_mutex;
+    /// 结果是否已写入
+    std::atomic<bool> m_ready{ false };
+    /// 是否已被Promise占住
+    std::atomic<bool> m_satisfied{ false };
+    std::exception_ptr m_error;
+    std::vector<Entry> m_waiters;
+};
+
+/**
+ * @brief 带值的Future共享状态
+ *
+ * @tparam T
+ */
+template <class T>
+class FutureState : public FutureStateBase {
+public:
+    typedef std::shared_ptr<FutureState> ptr;
+    typedef const T& GetType;
+
+    template <class... Args>
+    void setValue(Args&&... args) {
+        satisfy();
+        m_value.reset(new T(std::forward<Args>(args)...));
+        markReady();
+    }
+
+    GetType get() const {
+        rethrow();
+        return *m_value;
+    }
+
+private:
+    std::unique_ptr<T> m_value;
+};
+
+template <>
+class FutureState<void> : public FutureStateBase {
+public:
+    typedef std::shared_ptr<FutureState> ptr;
+    typedef void GetType;
+
+    void setValue() {
+        satisfy();
+        markReady();
+    }
+
+    void get() const {
+        rethrow();
+    }
+};
+
+/**
+ * @brief 异步结果，等待时挂起协程，完成后通过原调度器恢复
+ *        可拷贝，多个协程可以等待同一个结果
+ *
+ * @tparam T 值类型，可以为void
+ */
+template <class T>
+class Future {
+public:
+    typedef typename FutureState<T>::GetType GetType;
+
+    Future() {}
+
+    Future(typename FutureState<T>::ptr state) : m_state(state) {}
+
+    bool valid() const { return m_state != nullptr; }
+
+    bool isReady() const { return m_state->isReady(); }
+
+    /**
+     * @brief 挂起直到完成
+     *
+     */
+    void wait() const { m_state->wait(); }
+
+    /**
+     * @brief 挂起直到完成或超时
+     *
+     * @param timeout_ms
+     * @return true 已完成
+     * @return false 超时
+     */
+    bool waitFor(uint64_t timeout_ms) const { return m_state->wait(timeout_ms); }
+
+    /**
+     * @brief 等待并获取结果，以异常结束时抛出该异常
+     *
+     * @return GetType
+     */
+    GetType get() const {
+        m_state->wait();
+        return m_state->get();
+    }
+
+    const FutureStateBase::ptr getState() const { return m_state; }
+
+private:
+    typename FutureState<T>::ptr m_state;
+};
+
+/**
+ * @brief 异步结果的写入端
+ *        未设置结果就析构时，Future以std::runtime_error("broken promise")结束
+ *
+ * @tparam T
+ */
+template <class T>
+class Promise : Noncopyable {
+public:
+    Promise() : m_state(new FutureState<T>) {}
+
+    ~Promise() {
+        if (m_state && !m_state->isSatisfied() && m_state.use_count() > 1) {
+            m_state->setException(std::make_exception_ptr(std::runtime_error("broken promise")));
+        }
+    }
+
+    Future<T> getFuture() { return Future<T>(m_state); }
+
+    /**
+     * @brief 设置结果，唤醒所有等待者，只能设置一次
+     *
+     * @tparam Args
+     * @param args
+     */
+    template <class... Args>
+    void setValue(Args&&... args) {
+        m_state->setValue(std::forward<Args>(args)...);
+    }
+
+    void setException(std::exception_ptr error) { m_state->setException(error); }
+
+private:
+    typename FutureState<T>::ptr m_state;
+};
+
+/**
+ * @brief 等待一组任务完成(参考go sync.WaitGroup)
+ *
+ */
+class WaitGroup : Noncopyable {
+public:
+    /**
+     * @brief 增加计数
+     *
+     * @param n
+     */
+    void add(int n = 1);
+
+    /**
+     * @brief 一个任务完成，计数为0时唤醒所有等待者
+     *
+     */
+    void done();
+
+    /**
+     * @brief 挂起直到计数为0
+     *
+     * @param timeout_ms ~0ull表示不超时
+     * @return true 计数已为0
+     * @return false 超时
+     */
+    bool wait(uint64_t timeout_ms = ~0ull);
+
+    int getCount() const { return m_count; }
+
+private:
+    std::atomic<int> m_count{ 0 };
+    Spinlock m_mutex;
+    std::vector<FutureWaitNode::ptr> m_waiters;
+};
+
+/**
+ * @brief 等待所有共享状态完成，whenAll的非模板实现
+ *
+ * @param states
+ * @param timeout_ms
+ * @return true
+ * @return false
+ */
+bool WhenAll(const std::vector<FutureStateBase::ptr>& states, uint64_t timeout_ms);
+
+/**
+ * @brief 等待任意一个共享状态完成，whenAny的非模板实现
+ *        同一个等待者注册到所有状态上，只挂起一次
+ *
+ * @param states
+ * @param timeout_ms
+ * @return int
+ */
+int WhenAny(const std::vector<FutureStateBase::ptr>& states, uint64_t timeout_ms);
+
+/**
+ * @brief 等待所有Future完成
+ *
+ * @tparam T
+ * @param futures
+ * @param timeout_ms 总超时时间，~0ull表示不超时
+ * @return true 全部完成
+ * @return false 超时
+ */
+template <class T>
+bool whenAll(const std::vector<Future<T>>& futures, uint64_t timeout_ms = ~0ull) {
+    std::vector<FutureStateBase::ptr> states;
+    states.reserve(futures.size());
+    for (auto& i : futures) {
+        states.push_back(i.getState());
+    }
+    return WhenAll(states, timeout_ms);
+}
+
+/**
+ * @brief 等待任意一个Future完成
+ *
+ * @tparam T
+ * @param futures
+ * @param timeout_ms 超时时间，~0ull表示不超时
+ * @return int 完成的Future下标，超时或列表为空返回-1
+ */
+template <class T>
+int whenAny(const std::vector<Future<T>>& futures, uint64_t timeout_ms = ~0ull) {
+    std::vector<FutureStateBase::ptr> states;
+    states.reserve(futures.size());
+    for (auto& i : futures) {
+        states.push_back(i.getState());
+    }
+    return WhenAny(states, timeout_ms);
+}
+
+template <class T, class F>
+void FutureInvoke(Promise<T>& promise, F& fn) {
+    promise.setValue(fn());
+}
+
+template <class F>
+void FutureInvoke(Promise<void>& promise, F& fn) {
+    fn();
+    promise.setValue();
+}
+
+/**
+ * @brief 在调度器上异步执行函数，返回其结果的Future
+ *
+ * @tparam F 无参可调用对象
+ * @param scheduler
+ * @param fn
+ * @return Future<typename std::result_of<F()>::type>
+ */
+template <class F>
+Future<typename std::result_of<F()>::type> Async(Scheduler* scheduler, F fn) {
+    typedef typename std::result_of<F()>::type T;
+    /// Promise不可拷贝也不可移动，C++11的lambda又不能移动捕获，放在堆上共享
+    std::shared_ptr<Promise<T>> promise(new Promise<T>);
+    Future<T> future = promise->getFuture();
+    scheduler->schedule([promise, fn]() mutable {
+        try {
+            FutureInvoke(*promise, fn);
+        } catch (...) {
+            promise->setException(std::current_exception());
+        }
+    });
+    return future;
+}
+
+}  // namespace zero
+
+#endif
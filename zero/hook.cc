@@ -1,4 +1,5 @@
 #include "hook.h"
+#include <algorithm>
 #include <asm-generic/errno-base.h>
 #include <asm-generic/errno.h>
 #include <asm-generic/socket.h>
@@ -18,6 +19,7 @@
 #include "iomanager.h"
 #include "log.h"
 #include "macro.h"
+#include "offload.h"
 #include "zero/scheduler.h"
 #include "zero/timer.h"
 
@@ -47,6 +49,12 @@ static thread_local bool t_hook_enable = false;
     XX(sendto)       \
     XX(sendmsg)      \
     XX(close)        \
+    XX(open)         \
+    XX(stat)         \
+    XX(fsync)        \
+    XX(pread)        \
+    XX(pwrite)       \
+    XX(getaddrinfo)  \
     XX(fcntl)        \
     XX(ioctl)        \
     XX(getsockopt)   \
@@ -90,10 +98,67 @@ void set_hook_enable(bool flag) {
 
 }  // namespace zero
 
-/// 条件定时器使用
-struct timer_info {
-    int cancelled = 0;
-};
+/**
+ * @brief 本次等待的超时：套接字(或调用方)的超时和当前协程距截止时间的剩余时间取小
+ *
+ * @param timeout_ms 套接字或调用方的超时，~0ull表示不超时
+ * @param[out] timeout_us 微秒，~0ull表示不超时
+ * @return true
+ * @return false 已经过了协程的截止时间，调用方应直接以ETIMEDOUT失败
+ */
+static bool WaitTimeout(uint64_t timeout_ms, uint64_t& timeout_us) {
+    uint64_t remain = zero::Fiber::GetRemainingUS();
+    if (remain == 0) {
+        return false;
+    }
+    timeout_us = timeout_ms == ~0ull ? remain : std::min(timeout_ms * 1000, remain);
+    return true;
+}
+
+/**
+ * @brief 微秒超时换成毫秒，不足一毫秒的部分向上取整
+ *
+ * @param timeout_us
+ * @return uint64_t
+ */
+static uint64_t TimeoutToMS(uint64_t timeout_us) {
+    return timeout_us == ~0ull ? ~0ull : (timeout_us + 999) / 1000;
+}
+
+/**
+ * @brief hook的休眠，不超过当前协程的截止时间
+ *
+ * @param us
+ * @return uint64_t 因截止时间没有睡完的微秒数
+ */
+static uint64_t HookSleepUS(uint64_t us) {
+    uint64_t remain = zero::Fiber::GetRemainingUS();
+    if (remain == 0) {
+        return us;
+    }
+    uint64_t slept = std::min(us, remain);
+    zero::IOManager::GetThis()->sleepUS(slept);
+    return us - slept;
+}
+
+/**
+ * @brief 把阻塞调用交给Offload线程池执行，当前协程挂起直到返回，errno一并带回
+ *
+ */
+template <typename OriginFun, typename... Args>
+static auto offload_call(OriginFun fun, Args&&... args) -> decltype(fun(std::forward<Args>(args)...)) {
+    decltype(fun(std::forward<Args>(args)...)) rt;
+    zero::Offload::GetInstance()->run([&]() { rt = fun(std::forward<Args>(args)...); });
+    return rt;
+}
+
+/**
+ * @brief 普通文件调用是否卸载：开启了hook且在调度器的普通协程中
+ *
+ */
+static bool ShouldOffload() {
+    return zero::t_hook_enable && zero::Offload::CanOffload();
+}
 
 template <typename OriginFun, typename... Args>
 static ssize_t do_io(int fd, OriginFun fun, const char* hook_fun_name, uint32_t event, int timeout_so, Args&&... args) {
@@ -101,7 +166,7 @@ static ssize_t do_io(int fd, OriginFun fun, const char* hook_fun_name, uint32_t
         return fun(fd, std::forward<Args>(args)...);
     }
 
-    zero::FdCtx::ptr ctx = zero::FdMgr::GetInstance()->get(fd);
+    zero::FdCtx* ctx = zero::FdMgr::GetInstance()->get(fd);
     if (!ctx) {
         return fun(fd, std::forward<Args>(args)...);
     }
@@ -111,12 +176,22 @@ static ssize_t do_io(int fd, OriginFun fun, const char* hook_fun_name, uint32_t
         return -1;
     }
 
+    /// 普通文件总是"就绪"，epoll不支持，读写会阻塞在磁盘上，交给线程池执行
+    if (ctx->isFile() && zero::Offload::CanOffload()) {
+        return offload_call(fun, fd, std::forward<Args>(args)...);
+    }
+
     if (!ctx->isSocket() || ctx->getUserNonblock()) {
         return fun(fd, std::forward<Args>(args)...);
     }
 
     uint64_t to = ctx->getTimeout(timeout_so);
-    std::shared_ptr<timer_info> tinfo(new timer_info);
+    uint64_t to_us = 0;
+    /// 协程已经过了截止时间，不再发起调用
+    if (!WaitTimeout(to, to_us)) {
+        errno = ETIMEDOUT;
+        return -1;
+    }
 
 retry:
     /// 如果发时缓冲区已满或信号中断，则交由IOManager，继续监听是否可写的事件，直到 n > 0 或 n = 0 为止
@@ -129,38 +204,34 @@ retry:
     /// 读写缓冲区已满的情况
     if (n == -1 && errno == EAGAIN) {
         zero::IOManager* iom = zero::IOManager::GetThis();
-        zero::Timer::ptr timer;
-        std::weak_ptr<timer_info> winfo(tinfo);
-
-        if (to != ( uint64_t )-1) {
-            timer = iom->addConditionTimer(
-                to,
-                [winfo, fd, iom, event]() {
-                    auto t = winfo.lock();
-                    if (!t || t->cancelled) {
-                        return;
-                    }
-                    t->cancelled = ETIMEDOUT;
-                    iom->cancelEvent(fd, (zero::IOManager::Event)(event));
-                },
-                winfo);
+        /// 超时状态就是定时器节点自身的状态：取消失败说明定时器已经执行，也就是超时了
+        /// 每次等待都按剩余时间重新计算，多次重试加起来也不会超过截止时间
+        if (!WaitTimeout(to, to_us)) {
+            errno = ETIMEDOUT;
+            return -1;
         }
 
-        int rt = iom->addEvent(fd, (zero::IOManager::Event)(event));
+        uint64_t seq = 0;
+        int rt = iom->addEvent(fd, (zero::IOManager::Event)(event), nullptr, &seq);
+        /// 常驻注册模式下事件已经就绪，不挂起直接重试
+        if (rt > 0) {
+            goto retry;
+        }
         /// -1
         if (ZERO_UNLIKELY(rt)) {
             ZERO_LOG_ERROR(g_logger) << hook_fun_name << " addEvent(" << fd << ", " << event << ")";
-            if (timer) {
-                timer->cancel();
-            }
             return -1;
         } else {
-            zero::Fiber::YieldToHold();
-            if (timer) {
-                timer->cancel();
+            /// 回调只按值捕获，不引用本函数栈上的数据；带上这次等待的序号，本函数返回后才执行时不会取消fd上之后的等待
+            /// 挂起之前就超时或就绪时，协程留在任务队列中，Scheduler::run等它挂起后再调度
+            zero::TimerHandle timer;
+            if (to_us != ~0ull) {
+                timer = iom->addOnceTimerUS(
+                    to_us, [fd, iom, event, seq]() { iom->cancelEvent(fd, (zero::IOManager::Event)(event), seq); });
             }
-            if (tinfo->cancelled) {
-                errno = tinfo->cancelled;
+            zero::Fiber::YieldToHold();
+            if (timer && !timer.cancel()) {
+                errno = ETIMEDOUT;
                 return -1;
             }
             goto retry;
@@ -170,6 +241,62 @@ retry:
     return n;
 }
 
+/**
+ * @brief io_uring后端：先直接调用，返回EAGAIN时把请求提交给当前线程的io_uring并挂起协程，
+ *        完成后直接拿到结果，省掉epoll_ctl和重试
+ *
+ * @return true 已处理，结果在n中
+ * @return false 不满足条件(未启用io_uring、非socket、用户设置了非阻塞等)，调用方走do_io
+ */
+template <typename OriginFun, typename... Args>
+static bool uring_io(ssize_t& n, int fd, OriginFun fun, uint8_t opcode, const void* addr, uint32_t len, uint64_t off,
+                     uint32_t op_flags, int timeout_so, Args&&... args) {
+    if (!zero::t_hook_enable) {
+        return false;
+    }
+    zero::IOManager* iom = zero::IOManager::GetThis();
+    if (!iom || !iom->canSubmitIo()) {
+        return false;
+    }
+    zero::FdCtx* ctx = zero::FdMgr::GetInstance()->get(fd);
+    if (!ctx || ctx->isClose() || !ctx->isSocket() || ctx->getUserNonblock()) {
+        return false;
+    }
+    uint64_t to_us = 0;
+    if (!WaitTimeout(ctx->getTimeout(timeout_so), to_us)) {
+        errno = ETIMEDOUT;
+        n = -1;
+        return true;
+    }
+
+    n = fun(fd, std::forward<Args>(args)...);
+    while (n == -1 && errno == EINTR) {
+        n = fun(fd, std::forward<Args>(args)...);
+    }
+    if (n != -1 || errno != EAGAIN) {
+        return true;
+    }
+
+    if (!WaitTimeout(ctx->getTimeout(timeout_so), to_us)) {
+        errno = ETIMEDOUT;
+        n = -1;
+        return true;
+    }
+    int res = iom->submitIo(opcode, fd, addr, len, off, op_flags, TimeoutToMS(to_us));
+    /// 提交队列已满，退回epoll等待
+    if (res == zero::IOManager::IO_SQ_FULL) {
+        return false;
+    }
+    if (res < 0) {
+        /// 被close取消
+        errno = res == -ECANCELED ? EBADF : -res;
+        n = -1;
+    } else {
+        n = res;
+    }
+    return true;
+}
+
 extern "C" {
 // sleep_fun sleep_f = nullptr;
 #define XX(name) name##_fun name##_f = nullptr;
@@ -181,13 +308,12 @@ unsigned int sleep(unsigned int seconds) {
         return sleep_f(seconds);
     }
 
-    zero::Fiber::ptr fiber = zero::Fiber::GetThis();
-    zero::IOManager* iom = zero::IOManager::GetThis();
-    iom->addTimer(seconds * 1000,
-                  std::bind((void(zero::Scheduler::*)(zero::Fiber::ptr, int thread)) & zero::IOManager::schedule, iom, fiber, -1));
-    zero::Fiber::YieldToHold();
-    
-    return 0;
+    /// 被截止时间打断时和被信号打断一样，返回没有睡完的秒数
+    uint64_t left = HookSleepUS(seconds * 1000000ull);
+    if (left) {
+        errno = ETIMEDOUT;
+    }
+    return (left + 999999) / 1000000;
 }
 
 int usleep(useconds_t usec) {
@@ -195,18 +321,11 @@ int usleep(useconds_t usec) {
         return usleep_f(usec);
     }
 
-    /// 获取当前正在执行任务的协程，及iomanager
-    /// 为该协程添加一个timer，待超时时间到达时再次将当前fiber调度起来，达到usleep的效果
-    zero::Fiber::ptr fiber = zero::Fiber::GetThis();
-    zero::IOManager* iom = zero::IOManager::GetThis();
-    // std::bind 绑定模板函数
-    // https://www.lmlphp.com/user/152247/article/item/3660974/
-    // iom->addTimer(usec / 1000,
-    //               std::bind(static_cast<void(zero::Scheduler::*)(zero::Fiber::ptr,int thread)>(& zero::IOManager::schedule),iom,fiber,-1));
-    iom->addTimer(usec / 1000,
-                  std::bind((void(zero::Scheduler::*)(zero::Fiber::ptr, int thread)) & zero::IOManager::schedule, iom, fiber, -1));
-    zero::Fiber::YieldToHold();
-    
+    /// 为当前协程添加一个timer，待超时时间到达时再次将当前fiber调度起来，达到usleep的效果
+    if (HookSleepUS(usec)) {
+        errno = ETIMEDOUT;
+        return -1;
+    }
     return 0;
 }
 
@@ -215,13 +334,17 @@ int nanosleep(const struct timespec* req, struct timespec* rem) {
         return nanosleep_f(req, rem);
     }
 
-    int timeout_ms = req->tv_sec * 1000 + req->tv_nsec / 1000 / 1000;
-    zero::Fiber::ptr fiber = zero::Fiber::GetThis();
-    zero::IOManager* iom = zero::IOManager::GetThis();
-    iom->addTimer(timeout_ms,
-                  std::bind((void(zero::Scheduler::*)(zero::Fiber::ptr, int thread)) & zero::IOManager::schedule, iom, fiber, -1));
-    zero::Fiber::YieldToHold();
-
+    /// 不足一微秒的部分向上取整，不会早于请求的时间醒来
+    uint64_t timeout_us = req->tv_sec * 1000000ull + (req->tv_nsec + 999) / 1000;
+    uint64_t left = HookSleepUS(timeout_us);
+    if (left) {
+        if (rem) {
+            rem->tv_sec = left / 1000000;
+            rem->tv_nsec = left % 1000000 * 1000;
+        }
+        errno = ETIMEDOUT;
+        return -1;
+    }
     return 0;
 }
 
@@ -241,7 +364,7 @@ int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen,
     if (!zero::t_hook_enable) {
         return connect_f(fd, addr, addrlen);
     }
-    zero::FdCtx::ptr ctx = zero::FdMgr::GetInstance()->get(fd);
+    zero::FdCtx* ctx = zero::FdMgr::GetInstance()->get(fd);
     if (!ctx || ctx->isClose()) {
         errno = EBADE;
         return -1;
@@ -254,6 +377,27 @@ int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen,
     if (ctx->getUserNonblock()) {
         return connect_f(fd, addr, addrlen);
     }
+
+    /// 超时不超过协程剩余的时间
+    uint64_t timeout_us = 0;
+    if (!WaitTimeout(timeout_ms, timeout_us)) {
+        errno = ETIMEDOUT;
+        return -1;
+    }
+
+    /// io_uring后端直接提交connect，内核在连接完成或失败后返回结果，超时由链接的超时请求实现
+    zero::IOManager* uring_iom = zero::IOManager::GetThis();
+    if (uring_iom && uring_iom->canSubmitIo()) {
+        int res = uring_iom->submitIo(IORING_OP_CONNECT, fd, addr, 0, addrlen, 0, TimeoutToMS(timeout_us));
+        /// 提交队列已满时走下面的epoll流程
+        if (res != zero::IOManager::IO_SQ_FULL) {
+            if (res < 0) {
+                errno = -res;
+                return -1;
+            }
+            return 0;
+        }
+    }
     /// 对于阻塞的fd，connect会等三次握手完成后返回
     /// 对于非阻塞的fd，connect会立即返回，0则成功，如果返回-1 且errno = EINPROGRESS，说明正在尝试连接
     int n = connect_f(fd, addr, addrlen);
@@ -264,9 +408,7 @@ int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen,
     }
 
     zero::IOManager* iom = zero::IOManager::GetThis();
-    zero::Timer::ptr timer;
-    std::shared_ptr<timer_info> tinfo(new timer_info);
-    std::weak_ptr<timer_info> winfo(tinfo);
+    zero::TimerHandle timer;
 
     /// 代码执行到这里，说明连接正在进行中...
     /// 参考文章：https://zhuanlan.zhihu.com/p/439530130
@@ -275,50 +417,31 @@ int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen,
     /// 2.设置了超时
     ///     2.1 timer超时之前完成了连接
     ///     2.2 timer超时之后还未完成连接
-    if (timeout_ms != ( uint64_t )-1) {
-        timer = iom->addConditionTimer(
-            timeout_ms,
-            [winfo, fd, iom]() {
-                auto t = winfo.lock();
-                /// 如果在未超时之前便已经连接成功了，则无需处理，直接返回即可
-                /// 所以使用了一个weak_ptr来做，如果weak_ptr为空时，说明connect_with_timeout()函数已经执行完毕
-                if (!t || t->cancelled) {
-                    return;
-                }
-
-                /// 未触发过则设置超时标志，触发一次写事件
-                t->cancelled = ETIMEDOUT;
-
-                /// 如果超时时间特别短，先addEvent的情况下执行了，因为当前fd还没有设置WRITE事件，ZERO_UNLIKELY失败，所以并不会去调度
-                /// 退一万步讲，即便是被设置了WRITE事件，但是因为FdContext未被添加，所以其回调函数和fiber都是空的，也无效
-                /// 当且仅当 下面的iom->addEvent(fd, zero::IOManager::WRITE);执行完，才有意义
-                /// 当上述成立之后，强制触发了WRITE事件时，说明调用失败了，因为已然超时
-                iom->cancelEvent(fd, zero::IOManager::WRITE);
-            },
-            winfo);
-    }
 
     /// addEvent时，会将其读事件的上下文中的fiber设置为正在调度的fiber
-    int rt = iom->addEvent(fd, zero::IOManager::WRITE);
+    uint64_t seq = 0;
+    int rt = iom->addEvent(fd, zero::IOManager::WRITE, nullptr, &seq);
     if (rt == 0) {
+        /// 注册成功之后再加定时器，超时时间特别短也一定有等待可以取消
+        if (timeout_us != ~0ull) {
+            timer = iom->addOnceTimerUS(timeout_us, [fd, iom, seq]() {
+                /// 超时则强制触发一次写事件，唤醒的协程取消定时器失败就知道是超时了
+                /// 只取消这次等待，连接已经完成、fd上有了新的等待时什么也不做
+                iom->cancelEvent(fd, zero::IOManager::WRITE, seq);
+            });
+        }
         /// 添加成功后，让出上下文
         zero::Fiber::YieldToHold();
         /// 当触发WRITE事件，fiber继续从此处执行
-        /// 如果timer存在的话，取消掉
-        if (timer) {
-            timer->cancel();
-        }
-        /// 如果设置过超时标志的话，说明在指定的时间里没有连接成功，也算失败
-        if (tinfo->cancelled) {
-            errno = tinfo->cancelled;
+        /// 定时器已经执行过的话，说明在指定的时间里没有连接成功，也算失败
+        if (timer && !timer.cancel()) {
+            errno = ETIMEDOUT;
             return -1;
         }
-    } else {
-        if (timer) {
-            timer->cancel();
-        }
+    } else if (rt < 0) {
         ZERO_LOG_ERROR(g_logger) << "connect addEvent(" << fd << ", WRITE) error";
     }
+    /// rt > 0: 常驻注册模式下已经可写，直接检查连接结果
 
     int error = 0;
     socklen_t len = sizeof(int);
@@ -340,7 +463,14 @@ int connect(int sockfd, const struct sockaddr* addr, socklen_t addrlen) {
 }
 
 int accept(int s, struct sockaddr* addr, socklen_t* addr_len) {
-    int fd = do_io(s, accept_f, "accept", zero::IOManager::READ, SO_REUSEADDR, addr, addr_len);
+    ssize_t n = 0;
+    int fd = 0;
+    if (uring_io(n, s, accept_f, IORING_OP_ACCEPT, addr, 0, ( uint64_t )( uintptr_t )addr_len, 0, SO_REUSEADDR, addr,
+                 addr_len)) {
+        fd = n;
+    } else {
+        fd = do_io(s, accept_f, "accept", zero::IOManager::READ, SO_REUSEADDR, addr, addr_len);
+    }
     if (fd >= 0) {
         zero::FdMgr::GetInstance()->get(fd, true);
     }
@@ -348,6 +478,10 @@ int accept(int s, struct sockaddr* addr, socklen_t* addr_len) {
 }
 
 ssize_t read(int fd, void* buf, size_t count) {
+    ssize_t n = 0;
+    if (uring_io(n, fd, read_f, IORING_OP_RECV, buf, count, 0, 0, SO_RCVTIMEO, buf, count)) {
+        return n;
+    }
     return do_io(fd, read_f, "read", zero::IOManager::READ, SO_RCVTIMEO, buf, count);
 }
 
@@ -356,6 +490,10 @@ ssize_t readv(int fd, const struct iovec* iov, int iovcnt) {
 }
 
 ssize_t recv(int sockfd, void* buf, size_t len, int flags) {
+    ssize_t n = 0;
+    if (uring_io(n, sockfd, recv_f, IORING_OP_RECV, buf, len, 0, flags, SO_RCVTIMEO, buf, len, flags)) {
+        return n;
+    }
     return do_io(sockfd, recv_f, "recv", zero::IOManager::READ, SO_RCVTIMEO, buf, len, flags);
 }
 
@@ -368,6 +506,10 @@ ssize_t recvmsg(int sockfd, struct msghdr* msg, int flags) {
 }
 
 ssize_t write(int fd, const void* buf, size_t count) {
+    ssize_t n = 0;
+    if (uring_io(n, fd, write_f, IORING_OP_SEND, buf, count, 0, 0, SO_SNDTIMEO, buf, count)) {
+        return n;
+    }
     return do_io(fd, write_f, "write", zero::IOManager::WRITE, SO_SNDTIMEO, buf, count);
 }
 
@@ -376,6 +518,10 @@ ssize_t writev(int fd, const struct iovec* iov, int iovcnt) {
 }
 
 ssize_t send(int s, const void* msg, size_t len, int flags) {
+    ssize_t n = 0;
+    if (uring_io(n, s, send_f, IORING_OP_SEND, msg, len, 0, flags, SO_SNDTIMEO, msg, len, flags)) {
+        return n;
+    }
     return do_io(s, send_f, "send", zero::IOManager::WRITE, SO_SNDTIMEO, msg, len, flags);
 }
 
@@ -392,18 +538,76 @@ int close(int fd) {
         return close_f(fd);
     }
 
-    zero::FdCtx::ptr ctx = zero::FdMgr::GetInstance()->get(fd);
+    zero::FdCtx* ctx = zero::FdMgr::GetInstance()->get(fd);
     if (ctx) {
         auto iom = zero::IOManager::GetThis();
         if (iom) {
             /// 如果还有事件未完成则强制触发一下
             iom->cancelAll(fd);
+            /// io_uring上的在途请求也要取消，否则内核持有文件引用，关闭后请求仍会完成
+            iom->cancelIo(fd);
         }
         zero::FdMgr::GetInstance()->del(fd);
     }
     return close_f(fd);
 }
 
+int open(const char* pathname, int flags, ...) {
+    mode_t mode = 0;
+    if ((flags & O_CREAT) || (flags & O_TMPFILE) == O_TMPFILE) {
+        va_list va;
+        va_start(va, flags);
+        mode = va_arg(va, int);
+        va_end(va);
+    }
+    if (!ShouldOffload()) {
+        return open_f(pathname, flags, mode);
+    }
+    int fd = offload_call(open_f, pathname, flags, mode);
+    /// 登记fd，之后的read/write据此判断是普通文件
+    if (fd >= 0) {
+        int err = errno;
+        zero::FdMgr::GetInstance()->get(fd, true);
+        errno = err;
+    }
+    return fd;
+}
+
+int stat(const char* pathname, struct stat* statbuf) {
+    if (!ShouldOffload()) {
+        return stat_f(pathname, statbuf);
+    }
+    return offload_call(stat_f, pathname, statbuf);
+}
+
+int fsync(int fd) {
+    if (!ShouldOffload()) {
+        return fsync_f(fd);
+    }
+    return offload_call(fsync_f, fd);
+}
+
+ssize_t pread(int fd, void* buf, size_t count, off_t offset) {
+    if (!ShouldOffload()) {
+        return pread_f(fd, buf, count, offset);
+    }
+    return offload_call(pread_f, fd, buf, count, offset);
+}
+
+ssize_t pwrite(int fd, const void* buf, size_t count, off_t offset) {
+    if (!ShouldOffload()) {
+        return pwrite_f(fd, buf, count, offset);
+    }
+    return offload_call(pwrite_f, fd, buf, count, offset);
+}
+
+int getaddrinfo(const char* node, const char* service, const struct addrinfo* hints, struct addrinfo** res) {
+    if (!ShouldOffload()) {
+        return getaddrinfo_f(node, service, hints, res);
+    }
+    return offload_call(getaddrinfo_f, node, service, hints, res);
+}
+
 int fcntl(int fd, int cmd, ... /* arg */) {
     va_list va;
     va_start(va, cmd);
@@ -411,7 +615,7 @@ int fcntl(int fd, int cmd, ... /* arg */) {
     case F_SETFL: {
         int arg = va_arg(va, int);
         va_end(va);
-        zero::FdCtx::ptr ctx = zero::FdMgr::GetInstance()->get(fd);
+        zero::FdCtx* ctx = zero::FdMgr::GetInstance()->get(fd);
         if (!ctx || ctx->isClose() || !ctx->isSocket()) {
             return fcntl_f(fd, cmd, arg);
         }
@@ -426,7 +630,7 @@ int fcntl(int fd, int cmd, ... /* arg */) {
     case F_GETFL: {
         va_end(va);
         int arg = fcntl_f(fd, cmd);
-        zero::FdCtx::ptr ctx = zero::FdMgr::GetInstance()->get(fd);
+        zero::FdCtx* ctx = zero::FdMgr::GetInstance()->get(fd);
         if (!ctx || ctx->isClose() || !ctx->isSocket()) {
             return arg;
         }
@@ -489,7 +693,7 @@ int ioctl(int d, unsigned long int request, ...) {
 
     if (FIONBIO == request) {
         bool user_nonblock = !!*( int* )arg;
-        zero::FdCtx::ptr ctx = zero::FdMgr::GetInstance()->get(d);
+        zero::FdCtx* ctx = zero::FdMgr::GetInstance()->get(d);
         if (!ctx || ctx->isClose() || !ctx->isSocket()) {
             return ioctl_f(d, request, arg);
         }
@@ -508,7 +712,7 @@ int setsockopt(int sockfd, int level, int optname, const void* optval, socklen_t
     }
     if (level == SOL_SOCKET) {
         if (optname == SO_RCVTIMEO || optname == SO_SNDTIMEO) {
-            zero::FdCtx::ptr ctx = zero::FdMgr::GetInstance()->get(sockfd);
+            zero::FdCtx* ctx = zero::FdMgr::GetInstance()->get(sockfd);
             if (ctx) {
                 const timeval* v = ( const timeval* )optval;
                 ctx->setTimeout(optname, v->tv_sec * 1000 + v->tv_usec / 1000);
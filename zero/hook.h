@@ -2,9 +2,11 @@
 #define __ZERO_HOOK_H__
 
 #include <fcntl.h>
+#include <netdb.h>
 #include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <stdint.h>
 #include <time.h>
 #include <unistd.h>
@@ -86,6 +88,26 @@ extern sendmsg_fun sendmsg_f;
 typedef int (*close_fun)(int fd);
 extern close_fun close_f;
 
+//file，没有就绪事件，在协程中调用时交给Offload线程池执行
+typedef int (*open_fun)(const char *pathname, int flags, ...);
+extern open_fun open_f;
+
+typedef int (*stat_fun)(const char *pathname, struct stat *statbuf);
+extern stat_fun stat_f;
+
+typedef int (*fsync_fun)(int fd);
+extern fsync_fun fsync_f;
+
+typedef ssize_t (*pread_fun)(int fd, void *buf, size_t count, off_t offset);
+extern pread_fun pread_f;
+
+typedef ssize_t (*pwrite_fun)(int fd, const void *buf, size_t count, off_t offset);
+extern pwrite_fun pwrite_f;
+
+//dns
+typedef int (*getaddrinfo_fun)(const char *node, const char *service, const struct addrinfo *hints, struct addrinfo **res);
+extern getaddrinfo_fun getaddrinfo_f;
+
 //
 typedef int (*fcntl_fun)(int fd, int cmd, ... /* arg */ );
 extern fcntl_fun fcntl_f;
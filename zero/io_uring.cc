@@ -0,0 +1,193 @@
+#include "io_uring.h"
+#include "log.h"
+#include <algorithm>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace zero {
+
+static zero::Logger::ptr g_logger = ZERO_LOG_NAME("system");
+
+static int IoUringSetup(uint32_t entries, io_uring_params* p) {
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int IoUringEnter(int fd, uint32_t to_submit, uint32_t min_complete, uint32_t flags) {
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+}
+
+static int IoUringRegister(int fd, uint32_t opcode, void* arg, uint32_t nr_args) {
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+bool IoUring::IsSupported() {
+    static const bool s_supported = []() {
+        io_uring_params p;
+        memset(&p, 0, sizeof(p));
+        int fd = IoUringSetup(4, &p);
+        if (fd < 0) {
+            ZERO_LOG_INFO(g_logger) << "io_uring_setup failed errno=" << errno << " " << strerror(errno);
+            return false;
+        }
+        bool ok = p.features & IORING_FEAT_NODROP;
+        const size_t nr_ops = 256;
+        size_t len = sizeof(io_uring_probe) + nr_ops * sizeof(io_uring_probe_op);
+        io_uring_probe* probe = ( io_uring_probe* )calloc(1, len);
+        if (ok && IoUringRegister(fd, IORING_REGISTER_PROBE, probe, nr_ops) == 0) {
+            static const uint8_t ops[] = { IORING_OP_RECV,         IORING_OP_SEND,         IORING_OP_ACCEPT,
+                                           IORING_OP_CONNECT,      IORING_OP_LINK_TIMEOUT, IORING_OP_ASYNC_CANCEL,
+                                           IORING_OP_POLL_ADD };
+            for (uint8_t op : ops) {
+                if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+                    ZERO_LOG_INFO(g_logger) << "io_uring op " << ( int )op << " not supported";
+                    ok = false;
+                }
+            }
+        } else {
+            ok = false;
+        }
+        free(probe);
+        close(fd);
+        /// close时按fd取消在途请求(IORING_ASYNC_CANCEL_FD，5.19)，旧内核只支持按user_data取消，返回-EINVAL
+        if (ok) {
+            IoUring ring;
+            ok = ring.init(4, 8);
+            io_uring_sqe* sqe = ok ? ring.getSqe() : nullptr;
+            if (sqe) {
+                sqe->opcode = IORING_OP_ASYNC_CANCEL;
+                sqe->fd = ring.getFd();
+                sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+                sqe->user_data = 1;
+                ring.submit();
+                IoUringEnter(ring.getFd(), 0, 1, IORING_ENTER_GETEVENTS);
+                int res = -EINVAL;
+                ring.reap([&res](const io_uring_cqe& cqe) { res = cqe.res; });
+                if (res == -EINVAL) {
+                    ZERO_LOG_INFO(g_logger) << "io_uring cancel by fd not supported";
+                    ok = false;
+                }
+            }
+        }
+        return ok;
+    }();
+    return s_supported;
+}
+
+IoUring::IoUring() {}
+
+IoUring::~IoUring() {
+    if (m_sqes) {
+        munmap(m_sqes, m_sqesSize);
+    }
+    if (m_cqRing && m_cqRing != m_sqRing) {
+        munmap(m_cqRing, m_cqRingSize);
+    }
+    if (m_sqRing) {
+        munmap(m_sqRing, m_sqRingSize);
+    }
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+}
+
+bool IoUring::init(uint32_t entries, uint32_t cq_entries) {
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = cq_entries;
+    m_fd = IoUringSetup(entries, &p);
+    if (m_fd < 0) {
+        ZERO_LOG_ERROR(g_logger) << "io_uring_setup(" << entries << ") errno=" << errno << " " << strerror(errno);
+        return false;
+    }
+
+    m_sqRingSize = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+    m_cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    /// 新内核提交队列和完成队列在同一块映射里
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        m_sqRingSize = m_cqRingSize = std::max(m_sqRingSize, m_cqRingSize);
+    }
+    m_sqRing = mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+    if (m_sqRing == MAP_FAILED) {
+        m_sqRing = nullptr;
+        return false;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        m_cqRing = m_sqRing;
+    } else {
+        m_cqRing = mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+        if (m_cqRing == MAP_FAILED) {
+            m_cqRing = nullptr;
+            return false;
+        }
+    }
+    m_sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+    m_sqes = ( io_uring_sqe* )mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd,
+                                    IORING_OFF_SQES);
+    if (m_sqes == MAP_FAILED) {
+        m_sqes = nullptr;
+        return false;
+    }
+
+    char* sq = ( char* )m_sqRing;
+    m_sqHead = ( uint32_t* )(sq + p.sq_off.head);
+    m_sqTail = ( uint32_t* )(sq + p.sq_off.tail);
+    m_sqFlags = ( uint32_t* )(sq + p.sq_off.flags);
+    m_sqMask = *( uint32_t* )(sq + p.sq_off.ring_mask);
+    m_sqEntries = p.sq_entries;
+    m_sqeTail = *m_sqTail;
+    /// 提交项下标与提交队列槽位一一对应，之后不再修改
+    uint32_t* array = ( uint32_t* )(sq + p.sq_off.array);
+    for (uint32_t i = 0; i < m_sqEntries; ++i) {
+        array[i] = i;
+    }
+
+    char* cq = ( char* )m_cqRing;
+    m_cqHead = ( uint32_t* )(cq + p.cq_off.head);
+    m_cqTail = ( uint32_t* )(cq + p.cq_off.tail);
+    m_cqMask = *( uint32_t* )(cq + p.cq_off.ring_mask);
+    m_cqes = ( io_uring_cqe* )(cq + p.cq_off.cqes);
+    return true;
+}
+
+io_uring_sqe* IoUring::getSqe() {
+    if (sqSpace() == 0) {
+        return nullptr;
+    }
+    io_uring_sqe* sqe = &m_sqes[m_sqeTail & m_sqMask];
+    memset(sqe, 0, sizeof(*sqe));
+    __atomic_store_n(&m_sqeTail, m_sqeTail + 1, __ATOMIC_RELAXED);
+    return sqe;
+}
+
+uint32_t IoUring::sqSpace() const {
+    return m_sqEntries - (m_sqeTail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE));
+}
+
+bool IoUring::hasUnsubmitted() const {
+    return __atomic_load_n(&m_sqeTail, __ATOMIC_RELAXED) != __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+}
+
+int IoUring::submit() {
+    __atomic_store_n(m_sqTail, m_sqeTail, __ATOMIC_RELEASE);
+    uint32_t to_submit = m_sqeTail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+    if (to_submit == 0) {
+        return 0;
+    }
+    int rt = IoUringEnter(m_fd, to_submit, 0, 0);
+    if (rt < 0) {
+        ZERO_LOG_ERROR(g_logger) << "io_uring_enter submit=" << to_submit << " errno=" << errno << " " << strerror(errno);
+        return -errno;
+    }
+    return rt;
+}
+
+void IoUring::flushOverflow() {
+    IoUringEnter(m_fd, 0, 0, IORING_ENTER_GETEVENTS);
+}
+
+}  // namespace zero
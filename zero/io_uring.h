@@ -0,0 +1,131 @@
+#ifndef __ZERO_IO_URING_H__
+#define __ZERO_IO_URING_H__
+
+#include "mutex.h"
+#include "noncopyable.h"
+#include <linux/io_uring.h>
+#include <stdint.h>
+
+namespace zero {
+
+/**
+ * @brief io_uring的最小封装，直接使用系统调用和mmap，不依赖liburing
+ *        提交队列由sqMutex保护，任意线程都可以提交；完成队列只能由所属线程收割
+ *
+ */
+class IoUring : Noncopyable {
+public:
+    IoUring();
+
+    ~IoUring();
+
+    /**
+     * @brief 当前内核是否支持IOManager需要的io_uring功能(RECV/SEND/ACCEPT/CONNECT/LINK_TIMEOUT/ASYNC_CANCEL/POLL_ADD)
+     *        以及按fd取消(5.19)
+     *        进程内只探测一次
+     *
+     * @return true
+     * @return false
+     */
+    static bool IsSupported();
+
+    /**
+     * @brief 创建io_uring并映射提交、完成队列
+     *
+     * @param entries 提交队列长度
+     * @param cq_entries 完成队列长度
+     * @return true
+     * @return false
+     */
+    bool init(uint32_t entries, uint32_t cq_entries);
+
+    /**
+     * @brief io_uring文件句柄，有完成事件时可读，可以加入epoll
+     *
+     * @return int
+     */
+    int getFd() const { return m_fd; }
+
+    /**
+     * @brief 取一个空闲的提交项，已清零，需持有sqMutex
+     *
+     * @return io_uring_sqe* 提交队列已满返回nullptr
+     */
+    io_uring_sqe* getSqe();
+
+    /**
+     * @brief 提交队列剩余空间，需持有sqMutex
+     *
+     * @return uint32_t
+     */
+    uint32_t sqSpace() const;
+
+    /**
+     * @brief 是否有尚未提交给内核的提交项
+     *
+     * @return true
+     * @return false
+     */
+    bool hasUnsubmitted() const;
+
+    /**
+     * @brief 把已填好的提交项一次性交给内核，需持有sqMutex
+     *
+     * @return int 提交的数量，失败返回-errno
+     */
+    int submit();
+
+    /**
+     * @brief 收割所有完成事件，只能由所属线程调用
+     *
+     * @tparam F void(const io_uring_cqe&)
+     * @param fn
+     * @return uint32_t 收割的数量
+     */
+    template <class F>
+    uint32_t reap(F fn) {
+        uint32_t head = *m_cqHead;
+        uint32_t tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+        uint32_t count = tail - head;
+        for (; head != tail; ++head) {
+            fn(m_cqes[head & m_cqMask]);
+        }
+        __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+        /// 完成队列曾经满过，内核暂存的完成事件需要进入内核才能刷到队列里
+        if (__atomic_load_n(m_sqFlags, __ATOMIC_RELAXED) & IORING_SQ_CQ_OVERFLOW) {
+            flushOverflow();
+        }
+        return count;
+    }
+
+    Spinlock sqMutex;
+
+private:
+    void flushOverflow();
+
+private:
+    int m_fd = -1;
+    void* m_sqRing = nullptr;
+    size_t m_sqRingSize = 0;
+    void* m_cqRing = nullptr;
+    size_t m_cqRingSize = 0;
+    io_uring_sqe* m_sqes = nullptr;
+    size_t m_sqesSize = 0;
+
+    uint32_t* m_sqHead = nullptr;
+    uint32_t* m_sqTail = nullptr;
+    uint32_t* m_sqFlags = nullptr;
+    uint32_t m_sqMask = 0;
+    uint32_t m_sqEntries = 0;
+    /// 本地已填好的提交项队尾，submit时发布给内核
+    uint32_t m_sqeTail = 0;
+
+    uint32_t* m_cqHead = nullptr;
+    uint32_t* m_cqTail = nullptr;
+    uint32_t m_cqMask = 0;
+    io_uring_cqe* m_cqes = nullptr;
+};
+
+}  // namespace zero
+
+#endif
@@ -1,9 +1,14 @@
 #include "iomanager.h"
+#include "clock.h"
+#include "config.h"
+#include "fd_manager.h"
 #include "log.h"
 #include "macro.h"
+#include "util.h"
 #include "zero/fiber.h"
 #include "zero/scheduler.h"
 
+#include <algorithm>
 #include <asm-generic/errno-base.h>
 #include <bits/stdint-uintn.h>
 #include <cstddef>
@@ -11,15 +16,74 @@
 #include <fcntl.h>
 #include <functional>
 #include <ostream>
+#include <sched.h>
 #include <stdexcept>
 #include <string.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
 #include <unistd.h>
 
 namespace zero {
 
 static zero::Logger::ptr g_logger = ZERO_LOG_NAME("system");
 
+static ConfigVar<bool>::ptr g_multi_reactor =
+    Config::Lookup<bool>("iomanager.multi_reactor", false, "each worker thread owns an epoll, fds are registered on the registering thread's epoll");
+
+static ConfigVar<bool>::ptr g_io_uring =
+    Config::Lookup<bool>("iomanager.io_uring", false, "hooked socket io goes through a per-worker io_uring, implies multi_reactor, falls back to epoll if unsupported");
+
+static ConfigVar<uint32_t>::ptr g_io_uring_entries =
+    Config::Lookup<uint32_t>("iomanager.io_uring.entries", 256, "submission queue entries of each io_uring");
+
+static ConfigVar<bool>::ptr g_persistent_epoll =
+    Config::Lookup<bool>("iomanager.persistent_epoll", false, "register each fd once with EPOLLIN|EPOLLOUT|EPOLLET and latch readiness, no MOD/DEL until close");
+
+static ConfigVar<bool>::ptr g_epoll_pwait2 =
+    Config::Lookup<bool>("iomanager.epoll_pwait2", true, "sleep with epoll_pwait2 for microsecond timer precision, falls back to a per-epoll timerfd if unsupported");
+
+static ConfigVar<uint32_t>::ptr g_timer_slack_ns =
+    Config::Lookup<uint32_t>("iomanager.timer_slack_ns", 1000, "kernel timer slack of scheduler threads, thread-wide so it also applies to fibers running on them, restored when the scheduler stops, 0 keeps the kernel default (50us)");
+
+static ConfigVar<uint32_t>::ptr g_idle_spin_us =
+    Config::Lookup<uint32_t>("iomanager.idle.spin_us", 50, "max microseconds an idle thread spins before blocking in epoll_wait, 0 disables");
+
+/**
+ * @brief 自旋等待时降低CPU占用，让出流水线给同核的超线程
+ * 
+ */
+static inline void CpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield" ::: "memory");
+#endif
+}
+
+/// 较老的内核头文件没有定义，各架构的编号相同
+#ifndef __NR_epoll_pwait2
+#define __NR_epoll_pwait2 441
+#endif
+
+/**
+ * @brief 内核是否支持epoll_pwait2(5.11+)，进程内只探测一次
+ * 
+ * @return true 
+ * @return false 
+ */
+static bool HasEpollPwait2() {
+    static const bool s_supported = []() {
+        /// 无效的epfd：支持时返回EBADF，不支持返回ENOSYS
+        timespec ts = { 0, 0 };
+        int rt = syscall(__NR_epoll_pwait2, -1, nullptr, 1, &ts, nullptr, 0);
+        return !(rt < 0 && errno == ENOSYS);
+    }();
+    return s_supported;
+}
+
 enum EpollCtlOp {};
 
 static std::ostream& operator<<(std::ostream& os, const EpollCtlOp& op) {
@@ -100,26 +164,65 @@ void IOManager::FdContext::triggerEvent(IOManager::Event event) {
     return;
 }
 
-IOManager::IOManager(size_t threads, bool use_caller, const std::string& name) : Scheduler(threads, use_caller, name) {
-    m_epfd = epoll_create(5000);
-    ZERO_ASSERT(m_epfd > 0);
-
-    int rt = pipe(m_tickleFds);
-    ZERO_ASSERT(!rt);
-
-    /// 关注的event和fd
-    epoll_event event;
-    memset(&event, 0, sizeof(epoll_event));
-    event.events = EPOLLIN | EPOLLET;
-    event.data.fd = m_tickleFds[0];
+static std::atomic<uint32_t> s_iomanager_id = { 0 };
 
-    rt = fcntl(m_tickleFds[0], F_SETFL, O_NONBLOCK);
-    ZERO_ASSERT(!rt);
-
-    rt = epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_tickleFds[0], &event);
-    ZERO_ASSERT(!rt);
+IOManager::IOManager(size_t threads, bool use_caller, const std::string& name) : Scheduler(threads, use_caller, name) {
+    m_id = ++s_iomanager_id;
+    m_multiReactor = g_multi_reactor->getValue();
+    m_persistentEpoll = g_persistent_epoll->getValue();
+    m_epollPwait2 = g_epoll_pwait2->getValue() && HasEpollPwait2();
+    if (g_io_uring->getValue()) {
+        if (IoUring::IsSupported()) {
+            /// 完成队列只能由一个线程收割，每个工作线程一个io_uring，也就需要各自的epoll
+            m_ioUring = true;
+            m_multiReactor = true;
+        } else {
+            ZERO_LOG_WARN(g_logger) << "io_uring not supported, fallback to epoll";
+        }
+    }
+    size_t count = m_multiReactor ? getWorkerCount() : 1;
+    /// 每个工作线程各自等待时，定时器也按线程分片，idle只看自己的分片
+    /// 单反应堆时所有线程阻塞在同一个epoll上，无法定向唤醒某个线程，仍共用一个加锁的分片
+    if (m_multiReactor) {
+        initTimerShards(getWorkerCount());
+    }
+    for (size_t i = 0; i < count; ++i) {
+        std::unique_ptr<Reactor> reactor(new Reactor);
+        reactor->epfd = epoll_create(5000);
+        ZERO_ASSERT(reactor->epfd > 0);
+
+        reactor->tickleFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        ZERO_ASSERT(reactor->tickleFd >= 0);
+
+        /// 关注的event和fd，多个线程阻塞在同一个epoll上时，每次写eventfd只唤醒其中一个
+        epoll_event event;
+        memset(&event, 0, sizeof(epoll_event));
+        event.events = EPOLLIN | EPOLLET;
+        event.data.fd = reactor->tickleFd;
+
+        int rt = epoll_ctl(reactor->epfd, EPOLL_CTL_ADD, reactor->tickleFd, &event);
+        ZERO_ASSERT(!rt);
+
+        if (!m_epollPwait2) {
+            /// epoll_wait只有毫秒精度，不足一毫秒的等待由timerfd唤醒
+            reactor->timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+            ZERO_ASSERT(reactor->timerFd >= 0);
+            event.data.fd = reactor->timerFd;
+            rt = epoll_ctl(reactor->epfd, EPOLL_CTL_ADD, reactor->timerFd, &event);
+            ZERO_ASSERT(!rt);
+        }
 
-    contextResize(32);
+        if (m_ioUring) {
+            uint32_t entries = g_io_uring_entries->getValue();
+            reactor->ring.reset(new IoUring);
+            ZERO_ASSERT2(reactor->ring->init(entries, entries * 16), "io_uring init entries=" << entries);
+            /// 休眠在epoll_wait中的线程靠io_uring句柄可读得知有完成事件
+            event.data.fd = reactor->ring->getFd();
+            rt = epoll_ctl(reactor->epfd, EPOLL_CTL_ADD, reactor->ring->getFd(), &event);
+            ZERO_ASSERT(!rt);
+        }
+        m_reactors.push_back(std::move(reactor));
+    }
 
     /// 开始调度
     start();
@@ -128,62 +231,89 @@ IOManager::IOManager(size_t threads, bool use_caller, const std::string& name) :
 IOManager::~IOManager() {
     /// 停止调度
     stop();
-    close(m_epfd);
-    close(m_tickleFds[0]);
-    close(m_tickleFds[1]);
-
-    for (size_t i = 0; i < m_fdContexts.size(); ++i) {
-        if (m_fdContexts[i]) {
-            delete m_fdContexts[i];
-        }
-    }
-}
-
-void IOManager::contextResize(size_t size) {
-    m_fdContexts.resize(size);
-
-    for (size_t i = 0; i < m_fdContexts.size(); ++i) {
-        if (!m_fdContexts[i]) {
-            m_fdContexts[i] = new FdContext;
-            m_fdContexts[i]->fd = i;
+    for (auto& i : m_reactors) {
+        close(i->epfd);
+        close(i->tickleFd);
+        if (i->timerFd >= 0) {
+            close(i->timerFd);
         }
     }
 }
 
-int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
-    FdContext* fd_ctx = nullptr;
-    RWMutexType::ReadLock lock(m_mutex);
-    if (( int )m_fdContexts.size() > fd) {
-        fd_ctx = m_fdContexts[fd];
-        lock.unlock();
-    } else {
-        lock.unlock();
-        RWMutexType::WriteLock lock2(m_mutex);
-        contextResize(fd * 1.5);
-        fd_ctx = m_fdContexts[fd];
+int IOManager::addEvent(int fd, Event event, Task cb, uint64_t* seq) {
+    FdContext* fd_ctx = FdMgr::GetInstance()->getEventContext(fd, true);
+    if (ZERO_UNLIKELY(!fd_ctx)) {
+        ZERO_LOG_ERROR(g_logger) << "addEvent fd=" << fd << " out of fd table";
+        return -1;
     }
 
     /// 同一fd不允许添加相同的事件
     FdContext::MutexType::Lock lock2(fd_ctx->mutex);
+    /// 上一个使用者是其他IOManager，它的注册状态在这里无效
+    if (fd_ctx->owner != m_id) {
+        if (ZERO_UNLIKELY(fd_ctx->events)) {
+            ZERO_LOG_ERROR(g_logger) << "addEvent fd=" << fd << " is waiting in another IOManager";
+            return -1;
+        }
+        fd_ctx->owner = m_id;
+        fd_ctx->registered = false;
+        fd_ctx->ready = NONE;
+    }
     if (ZERO_UNLIKELY(fd_ctx->events & event)) {
         ZERO_LOG_ERROR(g_logger) << "addEvent assert fd=" << fd << " event=" << ( EPOLL_EVENTS )event
                                  << " fd_ctx.event=" << ( EPOLL_EVENTS )fd_ctx->events;
         ZERO_ASSERT(!(fd_ctx->events & event));
     }
 
-    int op = fd_ctx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
-    epoll_event epevent;
-    /// 可以读写事件一起
-    epevent.events = EPOLLET | fd_ctx->events | event;
-    /// 当epoll_wait返回时，可以据此返回并使用FdContext数据成员
-    epevent.data.ptr = fd_ctx;
-
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if (rt) {
-        ZERO_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", " << ( EpollCtlOp )op << ", " << fd << ", "
-                                 << ( EPOLL_EVENTS )epevent.events << "):" << rt << " (" << errno << ") (" << strerror(errno)
-                                 << ") fd_ctx->events=" << ( EPOLL_EVENTS )fd_ctx->events;
-        return -1;
+    if (m_persistentEpoll && fd_ctx->registered) {
+        /// 上次就绪时没有等待者，直接消费，省掉挂起、唤醒和epoll_ctl
+        if (fd_ctx->ready & event) {
+            fd_ctx->ready = ( Event )(fd_ctx->ready & ~event);
+            if (!cb) {
+                return 1;
+            }
+            Scheduler::GetThis()->schedule(std::move(cb));
+            return 0;
+        }
+        /// 绕过hook关闭的fd不会清掉注册状态，内核随关闭把它移出epoll，同号的新fd不在epoll中；
+        /// 挂起前重新ADD，EEXIST说明仍是原来的注册。上面消费的就绪状态即使属于旧fd也只是一次多余的重试
+        if (!fd_ctx->events) {
+            int epfd = epfdOf(fd_ctx);
+            epoll_event epevent;
+            epevent.events = EPOLLIN | EPOLLOUT | EPOLLET;
+            epevent.data.ptr = fd_ctx;
+            int rt = epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &epevent);
+            if (rt && errno != EEXIST) {
+                ZERO_LOG_ERROR(g_logger) << "epoll_ctl(" << epfd << ", " << ( EpollCtlOp )EPOLL_CTL_ADD << ", " << fd << ", "
+                                         << ( EPOLL_EVENTS )epevent.events << "):" << rt << " (" << errno << ") ("
+                                         << strerror(errno) << ")";
+                return -1;
+            }
+            if (!rt) {
+                fd_ctx->ready = NONE;
+            }
+        }
+    } else {
+        /// 没有事件的fd不在任何epoll中，注册到当前线程的反应堆；已有事件时跟随原来的反应堆，epoll_ctl可以跨线程调用
+        if (!fd_ctx->events) {
+            fd_ctx->reactor = pickReactor();
+        }
+        int epfd = epfdOf(fd_ctx);
+        int op = fd_ctx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+        epoll_event epevent;
+        /// 可以读写事件一起；常驻注册一次关注读写两种事件
+        epevent.events = m_persistentEpoll ? EPOLLIN | EPOLLOUT | EPOLLET : EPOLLET | fd_ctx->events | event;
+        /// 当epoll_wait返回时，可以据此返回并使用FdContext数据成员
+        epevent.data.ptr = fd_ctx;
+
+        int rt = epoll_ctl(epfd, op, fd, &epevent);
+        if (rt) {
+            ZERO_LOG_ERROR(g_logger) << "epoll_ctl(" << epfd << ", " << ( EpollCtlOp )op << ", " << fd << ", "
+                                     << ( EPOLL_EVENTS )epevent.events << "):" << rt << " (" << errno << ") ("
+                                     << strerror(errno) << ") fd_ctx->events=" << ( EPOLL_EVENTS )fd_ctx->events;
+            return -1;
+        }
+        fd_ctx->registered = m_persistentEpoll;
     }
 
     ++m_pendingEventCount;
@@ -191,8 +321,12 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
     FdContext::EventContext& event_ctx = fd_ctx->getContext(event);
     ZERO_ASSERT(!event_ctx.scheduler && !event_ctx.fiber && !event_ctx.cb);
     event_ctx.scheduler = Scheduler::GetThis();
+    ++event_ctx.seq;
+    if (seq) {
+        *seq = event_ctx.seq;
+    }
     if (cb) {
-        event_ctx.cb.swap(cb);
+        event_ctx.cb = std::move(cb);
     } else {
         event_ctx.fiber = Fiber::GetThis();
         /// 该情形在Scheduler::run里面处理了，如果状态为EXEC，则跳过
@@ -202,14 +336,15 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
 }
 
 bool IOManager::delEvent(int fd, Event event) {
-    RWMutexType::ReadLock lock(m_mutex);
-    if (( int )m_fdContexts.size() <= fd) {
+    FdContext* fd_ctx = FdMgr::GetInstance()->getEventContext(fd);
+    if (!fd_ctx) {
         return false;
     }
-    FdContext* fd_ctx = m_fdContexts[fd];
-    lock.unlock();
 
     FdContext::MutexType::Lock lock2(fd_ctx->mutex);
+    if (fd_ctx->owner != m_id) {
+        return false;
+    }
     if (ZERO_UNLIKELY(!(fd_ctx->events & event))) {
         return false;
     }
@@ -220,9 +355,11 @@ bool IOManager::delEvent(int fd, Event event) {
     epevent.events = EPOLLET | new_events;
     epevent.data.ptr = fd_ctx;
 
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
+    int epfd = epfdOf(fd_ctx);
+    /// 常驻注册时不修改epoll，之后的就绪由idle记录下来
+    int rt = m_persistentEpoll ? 0 : epoll_ctl(epfd, op, fd, &epevent);
     if (rt) {
-        ZERO_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", " << ( EpollCtlOp )op << ", " << fd << ", "
+        ZERO_LOG_ERROR(g_logger) << "epoll_ctl(" << epfd << ", " << ( EpollCtlOp )op << ", " << fd << ", "
                                  << ( EPOLL_EVENTS )epevent.events << "):" << rt << " (" << errno << ") (" << strerror(errno) << ")";
         return false;
     }
@@ -234,20 +371,25 @@ bool IOManager::delEvent(int fd, Event event) {
     return true;
 }
 
-bool IOManager::cancelEvent(int fd, Event event) {
-    RWMutexType::ReadLock lock(m_mutex);
-    if (( int )m_fdContexts.size() <= fd) {
+bool IOManager::cancelEvent(int fd, Event event, uint64_t seq) {
+    FdContext* fd_ctx = FdMgr::GetInstance()->getEventContext(fd);
+    if (!fd_ctx) {
         return false;
     }
-    FdContext* fd_ctx = m_fdContexts[fd];
-    lock.unlock();
 
     FdContext::MutexType::Lock lock2(fd_ctx->mutex);
+    if (fd_ctx->owner != m_id) {
+        return false;
+    }
 
     /// 先验证当前fd_ctx->events是否有event这个事件，如果没有直接返回false
     if (ZERO_UNLIKELY(!(fd_ctx->events & event))) {
         return false;
     }
+    /// 指定的那次等待已经结束，现在的是之后的等待
+    if (seq && fd_ctx->getContext(event).seq != seq) {
+        return false;
+    }
 
     Event new_events = ( Event )(fd_ctx->events & ~event);
     int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
@@ -255,9 +397,10 @@ bool IOManager::cancelEvent(int fd, Event event) {
     epevent.events = EPOLLET | new_events;
     epevent.data.ptr = fd_ctx;
 
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
+    int epfd = epfdOf(fd_ctx);
+    int rt = m_persistentEpoll ? 0 : epoll_ctl(epfd, op, fd, &epevent);
     if (rt) {
-        ZERO_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", " << ( EpollCtlOp )op << ", " << fd << ", "
+        ZERO_LOG_ERROR(g_logger) << "epoll_ctl(" << epfd << ", " << ( EpollCtlOp )op << ", " << fd << ", "
                                  << ( EPOLL_EVENTS )epevent.events << "):" << rt << " (" << errno << ") (" << strerror(errno) << ")";
         return false;
     }
@@ -268,15 +411,17 @@ bool IOManager::cancelEvent(int fd, Event event) {
 }
 
 bool IOManager::cancelAll(int fd) {
-    RWMutexType::ReadLock lock(m_mutex);
-    if (( int )m_fdContexts.size() <= fd) {
+    FdContext* fd_ctx = FdMgr::GetInstance()->getEventContext(fd);
+    if (!fd_ctx) {
         return false;
     }
-    FdContext* fd_ctx = m_fdContexts[fd];
-    lock.unlock();
 
     FdContext::MutexType::Lock lock2(fd_ctx->mutex);
-    if (!fd_ctx->events) {
+    if (fd_ctx->owner != m_id) {
+        return false;
+    }
+    /// 常驻注册的fd没有等待者时也在epoll中，关闭前移除，同号的新fd重新注册
+    if (!fd_ctx->events && !fd_ctx->registered) {
         return false;
     }
 
@@ -285,9 +430,12 @@ bool IOManager::cancelAll(int fd) {
     epevent.events = 0;
     epevent.data.ptr = fd_ctx;
 
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
+    int epfd = epfdOf(fd_ctx);
+    int rt = epoll_ctl(epfd, op, fd, &epevent);
+    fd_ctx->registered = false;
+    fd_ctx->ready = NONE;
     if (rt) {
-        ZERO_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", " << ( EpollCtlOp )op << ", " << fd << ", "
+        ZERO_LOG_ERROR(g_logger) << "epoll_ctl(" << epfd << ", " << ( EpollCtlOp )op << ", " << fd << ", "
                                  << ( EPOLL_EVENTS )epevent.events << "):" << rt << " (" << errno << ") (" << strerror(errno) << ")";
         return false;
     }
@@ -305,24 +453,246 @@ bool IOManager::cancelAll(int fd) {
     return true;
 }
 
+bool IOManager::canSubmitIo() {
+    return m_ioUring && getWorkerIndex() >= 0 && !Fiber::GetThisRaw()->isSharedStack();
+}
+
+int IOManager::submitIo(uint8_t opcode, int fd, const void* addr, uint32_t len, uint64_t off, uint32_t op_flags,
+                        uint64_t timeout_ms) {
+    ZERO_ASSERT(canSubmitIo());
+    Reactor& reactor = currentReactor();
+    IoUring& ring = *reactor.ring;
+    IoOp op;
+    op.fiber = Fiber::GetThis();
+    /// 超时由链接在后面的LINK_TIMEOUT实现，内核在提交时读取，协程挂起期间一直有效
+    __kernel_timespec ts;
+    bool has_timeout = timeout_ms != ~0ull;
+    /// 请求和超时必须一起放入提交队列，先确认空间够用
+    uint32_t need = has_timeout ? 2 : 1;
+    {
+        Spinlock::Lock lock(ring.sqMutex);
+        if (ring.sqSpace() < need) {
+            ring.submit();
+        }
+        if (ring.sqSpace() < need) {
+            return IO_SQ_FULL;
+        }
+        io_uring_sqe* sqe = ring.getSqe();
+        sqe->opcode = opcode;
+        sqe->fd = fd;
+        sqe->addr = ( uint64_t )( uintptr_t )addr;
+        sqe->len = len;
+        sqe->off = off;
+        /// 与msg_flags、poll32_events等共用
+        sqe->rw_flags = op_flags;
+        sqe->user_data = ( uint64_t )( uintptr_t )&op;
+        if (has_timeout) {
+            ts.tv_sec = timeout_ms / 1000;
+            ts.tv_nsec = (timeout_ms % 1000) * 1000000;
+            sqe->flags |= IOSQE_IO_LINK;
+            io_uring_sqe* tsqe = ring.getSqe();
+            tsqe->opcode = IORING_OP_LINK_TIMEOUT;
+            tsqe->fd = -1;
+            tsqe->addr = ( uint64_t )( uintptr_t )&ts;
+            tsqe->len = 1;
+            /// 超时的完成事件用最低位标记(IoOp按指针对齐)，据此区分超时取消和close取消
+            tsqe->user_data = ( uint64_t )( uintptr_t )&op | 1;
+            op.pending = 2;
+        }
+        /// 在锁内计数，cancelIo在同一把锁下检查，不会漏掉已经放入提交队列的请求
+        ++reactor.ringInflight;
+        ++m_pendingEventCount;
+    }
+    Fiber::YieldToHold();
+    /// 超时触发后请求被取消；请求先完成时超时以-ECANCELED结束，不算超时
+    if (op.timedOut && op.res < 0) {
+        return -ETIMEDOUT;
+    }
+    return op.res;
+}
+
+/// cancelIo提交的取消请求的user_data，IoOp的地址按指针对齐，不会是这个值
+static const uint64_t CANCEL_USER_DATA = 2;
+
+void IOManager::cancelIo(int fd) {
+    if (!m_ioUring) {
+        return;
+    }
+    /// 请求可能在任意线程的io_uring上，按fd取消只作用于同一个io_uring
+    for (auto& i : m_reactors) {
+        IoUring& ring = *i->ring;
+        Spinlock::Lock lock(ring.sqMutex);
+        if (i->ringInflight == 0) {
+            continue;
+        }
+        if (ring.sqSpace() < 1) {
+            ring.submit();
+        }
+        io_uring_sqe* sqe = ring.getSqe();
+        if (!sqe) {
+            ZERO_LOG_ERROR(g_logger) << "cancelIo fd=" << fd << " submission queue full";
+            continue;
+        }
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = fd;
+        sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+        sqe->user_data = CANCEL_USER_DATA;
+        /// fd马上要关闭，立即提交，不等所属线程的调度循环
+        ring.submit();
+    }
+}
+
+uint32_t IOManager::pollRing(Reactor& reactor) {
+    IoUring& ring = *reactor.ring;
+    if (ring.hasUnsubmitted()) {
+        Spinlock::Lock lock(ring.sqMutex);
+        ring.submit();
+    }
+    if (reactor.ringInflight == 0) {
+        return 0;
+    }
+    return ring.reap([this, &reactor](const io_uring_cqe& cqe) {
+        if (!cqe.user_data) {
+            return;
+        }
+        /// 取消返回取消的个数，没有在途请求时为-ENOENT，其他错误说明请求没被取消，协程会一直挂着
+        if (cqe.user_data == CANCEL_USER_DATA) {
+            if (cqe.res < 0 && cqe.res != -ENOENT) {
+                ZERO_LOG_ERROR(g_logger) << "io_uring cancel failed res=" << cqe.res << " " << strerror(-cqe.res);
+            }
+            return;
+        }
+        IoOp* op = ( IoOp* )( uintptr_t )(cqe.user_data & ~1ull);
+        if (cqe.user_data & 1) {
+            op->timedOut = cqe.res == -ETIME;
+        } else {
+            op->res = cqe.res;
+        }
+        /// 请求和超时的完成事件顺序不定，都收割之后才恢复协程
+        if (--op->pending) {
+            return;
+        }
+        /// 先取出协程，恢复之后op随协程栈一起失效
+        Fiber::ptr fiber = std::move(op->fiber);
+        schedule(std::move(fiber));
+        --reactor.ringInflight;
+        --m_pendingEventCount;
+    });
+}
+
+/// 本线程上次在调度循环中检查到期定时器的毫秒
+static thread_local uint64_t t_timer_check_ms = 0;
+/// 本线程收集到期回调的数组，复用容量
+static thread_local std::vector<Task> t_expired_cbs;
+
+void IOManager::onTick() {
+    /// 每次调度任务前刷新缓存时间，任务里读到的时间最多落后该任务已运行的时长
+    uint64_t now_ms = Clock::Refresh() / 1000;
+    /// 分片只由所属线程处理，一直有任务不进idle时也要让定时器到期，每毫秒最多检查一次
+    if (isTimerSharded() && now_ms != t_timer_check_ms) {
+        t_timer_check_ms = now_ms;
+        std::vector<Task>& cbs = t_expired_cbs;
+        listExpiredCb(cbs);
+        if (!cbs.empty()) {
+            schedule(cbs.begin(), cbs.end());
+            cbs.clear();
+        }
+    }
+    if (m_ioUring && getWorkerIndex() >= 0) {
+        pollRing(currentReactor());
+    }
+}
+
+void IOManager::sleepUS(uint64_t us) {
+    Fiber::ptr fiber = Fiber::GetThis();
+    addOnceTimerUS(us, [this, fiber]() { schedule(fiber); });
+    Fiber::YieldToHold();
+}
+
 /// 
 IOManager* IOManager::GetThis() {
     return dynamic_cast<IOManager*>(Scheduler::GetThis());
 }
 
+IOManager::Reactor& IOManager::currentReactor() {
+    if (!m_multiReactor) {
+        return *m_reactors[0];
+    }
+    int worker = getWorkerIndex();
+    ZERO_ASSERT(worker >= 0);
+    return *m_reactors[worker];
+}
+
+size_t IOManager::pickReactor() {
+    if (!m_multiReactor) {
+        return 0;
+    }
+    int worker = getWorkerIndex();
+    if (worker >= 0) {
+        return worker;
+    }
+    size_t n = m_reactors.size();
+    /// 同pickTimerShard，use_caller线程的reactor只在stop时才有线程等待事件，外部注册的fd不交给它
+    if (m_rootThread != -1 && n > 1) {
+        return 1 + m_reactorSeq++ % (n - 1);
+    }
+    return m_reactorSeq++ % n;
+}
+
+void IOManager::wakeReactor(Reactor& reactor, bool force) {
+    if (reactor.sleeping == 0) {
+        return;
+    }
+    /// 已有唤醒在途，被唤醒的线程取到任务后发现还有剩余会继续唤醒下一个
+    if (!force && reactor.ticklePending.exchange(true)) {
+        return;
+    }
+    int rt = eventfd_write(reactor.tickleFd, 1);
+    ZERO_ASSERT(rt == 0);
+}
+
 void IOManager::tickle() {
-    if (!hasIdleThreads()) {
+    /// 没有线程阻塞在epoll_wait中，空闲的线程都在自旋或即将检查队列
+    if (m_sleepingThreadCount == 0) {
         return;
     }
-    int rt = write(m_tickleFds[1], "T", 1);
-    ZERO_ASSERT(rt == 1);
+    /// 停止时需要唤醒所有休眠的线程，不合并
+    if (m_stopping) {
+        for (auto& i : m_reactors) {
+            wakeReactor(*i, true);
+        }
+        return;
+    }
+    /// 有线程在自旋，会自己发现任务，省掉一次write和被唤醒线程的epoll_wait返回
+    if (hasSpinningThreads()) {
+        return;
+    }
+    /// 从轮转位置开始找一个有线程休眠的反应堆，只唤醒一个
+    size_t n = m_reactors.size();
+    size_t start = n > 1 ? m_reactorSeq++ % n : 0;
+    for (size_t i = 0; i < n; ++i) {
+        Reactor& reactor = *m_reactors[(start + i) % n];
+        if (reactor.sleeping) {
+            wakeReactor(reactor, false);
+            return;
+        }
+    }
+}
+
+void IOManager::tickleWorker(size_t worker) {
+    if (!m_multiReactor) {
+        tickle();
+        return;
+    }
+    /// 指定线程的任务只能由该线程执行，直接唤醒它自己的epoll
+    wakeReactor(*m_reactors[worker], m_stopping);
 }
 
 bool IOManager::stopping(uint64_t& timeout) {
     /// 获取对应于timer集合当中最小的超时时间
-    timeout = getNextTimer();
-    /// 如果timer集合为空，则说明该停止了
-    return timeout == ~0ull && m_pendingEventCount == 0 && Scheduler::stopping();
+    timeout = getNextTimerUS();
+    /// 所有分片都没有定时器，才说明该停止了
+    return !hasTimer() && m_pendingEventCount == 0 && Scheduler::stopping();
 }
 
 bool IOManager::stopping() {
@@ -330,6 +700,75 @@ bool IOManager::stopping() {
     return stopping(timeout);
 }
 
+int IOManager::waitEvents(Reactor& reactor, epoll_event* events, int max_events, uint64_t timeout_us) {
+    if (m_epollPwait2) {
+        timespec ts;
+        ts.tv_sec = timeout_us / 1000000;
+        ts.tv_nsec = (timeout_us % 1000000) * 1000;
+        return syscall(__NR_epoll_pwait2, reactor.epfd, events, max_events, &ts, nullptr, 0);
+    }
+    if (timeout_us % 1000 == 0) {
+        return epoll_wait(reactor.epfd, events, max_events, timeout_us / 1000);
+    }
+    /// 用绝对时间设置timerfd，同一个epoll上的线程按同一个最近定时器计算，互相覆盖也不会推迟唤醒
+    uint64_t deadline = Clock::MonotonicNS() + timeout_us * 1000;
+    itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = deadline / 1000000000;
+    its.it_value.tv_nsec = deadline % 1000000000;
+    timerfd_settime(reactor.timerFd, TFD_TIMER_ABSTIME, &its, nullptr);
+    /// 超时向上取整作为兜底，正常由timerfd先唤醒
+    return epoll_wait(reactor.epfd, events, max_events, timeout_us / 1000 + 1);
+}
+
+int IOManager::spinIdle(int epfd, epoll_event* events, int max_events, uint64_t budget_us) {
+    if (!startSpinning()) {
+        return -1;
+    }
+    uint64_t start = Clock::Refresh();
+    uint64_t now = start;
+    int rt = -1;
+    for (uint32_t i = 0; !m_stopping; ++i) {
+        if (hasPendingTask()) {
+            rt = 0;
+            break;
+        }
+        /// 系统调用和取时间开销较大，每16次轮询一次
+        if (i % 16 == 0) {
+            if (getNextTimer() == 0) {
+                rt = 0;
+                break;
+            }
+            if (m_ioUring && pollRing(currentReactor()) > 0) {
+                rt = 0;
+                break;
+            }
+            int n = epoll_wait(epfd, events, max_events, 0);
+            if (n > 0) {
+                rt = n;
+                break;
+            }
+            now = Clock::Refresh();
+            if (now - start >= budget_us) {
+                break;
+            }
+            /// 线程数多于核数时让出CPU，不和投递任务的线程抢时间片
+            sched_yield();
+        } else {
+            CpuRelax();
+        }
+    }
+    if (rt >= 0) {
+        now = Clock::Refresh();
+    }
+    stopSpinning(rt >= 0, now - start);
+    /// 清除自旋标记之后投递的任务会唤醒本线程，之前投递的在这里发现
+    if (rt < 0 && hasPendingTask()) {
+        rt = 0;
+    }
+    return rt;
+}
+
 /// 尽量避免协程栈溢出问题
 void IOManager::idle() {
     ZERO_LOG_DEBUG(g_logger) << "idle";
@@ -339,27 +778,70 @@ void IOManager::idle() {
     /// 自定义智能指针管理的数组释放规则
     std::shared_ptr<epoll_event> shared_events(events, [](epoll_event* ptr) { delete[] ptr; });
 
+    Reactor& reactor = currentReactor();
+
+    /// 内核默认给休眠加50微秒的松弛，会吃掉微秒定时器的精度
+    /// 松弛是线程属性，调度线程上运行的协程也受影响；idle退出时恢复，use_caller的线程stop之后回到原来的值
+    uint32_t slack_ns = g_timer_slack_ns->getValue();
+    int old_slack = -1;
+    if (slack_ns) {
+        old_slack = prctl(PR_GET_TIMERSLACK, 0, 0, 0, 0);
+        prctl(PR_SET_TIMERSLACK, slack_ns, 0, 0, 0);
+    }
+
+    /// 自旋时长自适应：自旋等到任务时加倍，超时休眠时减半，不低于上限的1/16以便负载上升时重新发现
+    const uint64_t max_spin = g_idle_spin_us->getValue();
+    uint64_t spin_budget = max_spin;
+
     while (true) {
         uint64_t next_timeout = 0;
         if (ZERO_UNLIKELY(stopping(next_timeout))) {
             ZERO_LOG_INFO(g_logger) << "name=" << getName() << " idle stopping exit";
+            /// 其他线程可能在stop发出唤醒之后才休眠，退出前接力唤醒
+            tickle();
+            if (old_slack > 0) {
+                prctl(PR_SET_TIMERSLACK, old_slack, 0, 0, 0);
+            }
             break;
         }
 
-        int rt = 0;
+        int rt = -1;
+        if (max_spin && next_timeout != 0) {
+            rt = spinIdle(reactor.epfd, events, MAX_EVENTS, spin_budget);
+            if (rt >= 0) {
+                spin_budget = std::min(max_spin, spin_budget * 2);
+            } else {
+                spin_budget = std::max(max_spin / 16, spin_budget / 2);
+                /// 自旋期间可能插入了更早的定时器
+                next_timeout = getNextTimerUS();
+            }
+        }
+
+        /// 先计入休眠线程再检查任务、停止状态和定时器，tickle要么看到计数去唤醒，要么在这里被发现
+        bool sleeping = rt < 0;
+        if (sleeping) {
+            ++m_sleepingThreadCount;
+            ++reactor.sleeping;
+            /// 休眠前提交积攒的io_uring请求，收割到完成事件就不休眠了
+            if ((m_ioUring && pollRing(reactor) > 0) || hasPendingTask() || stopping(next_timeout)) {
+                rt = 0;
+            }
+        }
+
         /// 陷入到epoll_wait进行等待，最长三秒之后返回
         /// 情况1 收集并执行超时timer的回调
         /// 情况2 继续利用idle协程去执行关注的fd的事件
         do {
-            /// 设置最大超时时间未3秒
-            static const int MAX_TIMEOUT = 3000;
-            /// 每次比较定时器集合中最小timer的待触发间隔与默认超时时间，为避免定时器超时时间太大时，epoll_wait一直阻塞
-            if (next_timeout != ~0ull) {
-                next_timeout = ( int )next_timeout > MAX_TIMEOUT ? MAX_TIMEOUT : next_timeout;
-            } else {
-                next_timeout = MAX_TIMEOUT;
+            if (rt >= 0) {
+                /// 自旋期间已经等到了任务或事件
+                rt = std::max(rt, 0);
+                break;
             }
-            rt = epoll_wait(m_epfd, events, MAX_EVENTS, ( int )next_timeout);
+            /// 设置最大超时时间为3秒
+            static const uint64_t MAX_TIMEOUT_US = 3000 * 1000;
+            /// 每次比较定时器集合中最小timer的待触发间隔与默认超时时间，为避免定时器超时时间太大时，epoll_wait一直阻塞
+            next_timeout = std::min(next_timeout, MAX_TIMEOUT_US);
+            rt = waitEvents(reactor, events, MAX_EVENTS, next_timeout);
             if (rt < 0 && errno == EINTR) {
                 /// 信号中断处理
             } else { /// 超时或者有事件到来都会退出
@@ -367,10 +849,16 @@ void IOManager::idle() {
             }
 
         } while (true);
+        if (sleeping) {
+            --reactor.sleeping;
+            --m_sleepingThreadCount;
+        }
+        /// 每轮epoll只取一次时间，之后的定时器处理和事件回调都读缓存
+        Clock::Refresh();
 
         /// 每次epoll_wait超时返回之后应该根据当前系统时间，执行所有已经超时的timer回调函数
         /// 收集完所有的超时timer回调函数之后，交由scheduler去进行调度
-        std::vector<std::function<void()>> cbs;
+        std::vector<Task>& cbs = t_expired_cbs;
         listExpiredCb(cbs);
         if (!cbs.empty()) {
             schedule(cbs.begin(), cbs.end());
@@ -379,12 +867,28 @@ void IOManager::idle() {
 
         for (int i = 0; i < rt; ++i) {
             epoll_event& event = events[i];
-            /// 如果是m_tickleFds[0],说明scheduler利用tickle函数通知有新任务到来，需要让idle协程让出上下文唤醒其他协程去调度任务了
+            /// 如果是tickleFd,说明scheduler利用tickle函数通知有新任务到来，需要让idle协程让出上下文唤醒其他协程去调度任务了
             /// 让出CPU之前，先把所有IO事件处理完
-            if (event.data.fd == m_tickleFds[0]) {
-                uint8_t dummy[256];
-                while (read(m_tickleFds[0], dummy, sizeof(dummy)) > 0)
-                    ;
+            if (event.data.fd == reactor.tickleFd) {
+                eventfd_t dummy;
+                eventfd_read(reactor.tickleFd, &dummy);
+                /// 读走之后才允许下一次唤醒，本线程随后会检查任务队列
+                reactor.ticklePending = false;
+                /// 停止时逐个唤醒其余休眠的线程
+                if (m_stopping) {
+                    tickle();
+                }
+                continue;
+            }
+            if (reactor.ring && event.data.fd == reactor.ring->getFd()) {
+                pollRing(reactor);
+                continue;
+            }
+            if (event.data.fd == reactor.timerFd) {
+                /// 只用于唤醒，读走到期次数
+                uint64_t expirations;
+                ssize_t n = ::read(reactor.timerFd, &expirations, sizeof(expirations));
+                ( void )n;
                 continue;
             }
 
@@ -394,7 +898,7 @@ void IOManager::idle() {
             /// 1. 当发生err事件时，我们需要关闭该连接
             /// 2. 当发生hup事件时，说明对端关闭了，我们可能需要重新拉起客户端的连接
             if (event.events & (EPOLLERR | EPOLLHUP)) {
-                event.events |= (EPOLLIN | EPOLLOUT) & fd_ctx->events;
+                event.events |= m_persistentEpoll ? EPOLLIN | EPOLLOUT : (EPOLLIN | EPOLLOUT) & fd_ctx->events;
             }
             int real_events = NONE;
             if (event.events & EPOLLIN) {
@@ -404,21 +908,27 @@ void IOManager::idle() {
                 real_events |= WRITE;
             }
 
-            /// 说明当前事件未触发读写，不作处理
-            if ((fd_ctx->events & real_events) == NONE) {
-                continue;
-            }
-
-            int left_events = (fd_ctx->events & ~real_events);
-            int op = left_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-            event.events = EPOLLET | left_events;
-
-            int rt2 = epoll_ctl(m_epfd, op, fd_ctx->fd, &event);
-            if (rt2) {
-                ZERO_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", " << ( EpollCtlOp )op << ", " << fd_ctx->fd << ", "
-                                         << ( EPOLL_EVENTS )event.events << "):" << rt2 << " (" << errno << ") (" << strerror(errno)
-                                         << ")";
-                continue;
+            if (m_persistentEpoll) {
+                /// 常驻注册不修改epoll，没有等待者的就绪事件记录下来，等下次addEvent消费
+                fd_ctx->ready = ( Event )(fd_ctx->ready | (real_events & ~fd_ctx->events));
+                real_events &= fd_ctx->events;
+            } else {
+                /// 说明当前事件未触发读写，不作处理
+                if ((fd_ctx->events & real_events) == NONE) {
+                    continue;
+                }
+
+                int left_events = (fd_ctx->events & ~real_events);
+                int op = left_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+                event.events = EPOLLET | left_events;
+
+                int rt2 = epoll_ctl(epfdOf(fd_ctx), op, fd_ctx->fd, &event);
+                if (rt2) {
+                    ZERO_LOG_ERROR(g_logger) << "epoll_ctl(" << epfdOf(fd_ctx) << ", " << ( EpollCtlOp )op << ", "
+                                             << fd_ctx->fd << ", " << ( EPOLL_EVENTS )event.events << "):" << rt2 << " ("
+                                             << errno << ") (" << strerror(errno) << ")";
+                    continue;
+                }
             }
 
             if (real_events & READ) {
@@ -432,16 +942,30 @@ void IOManager::idle() {
         }
 
         /// idle协程让出上下文
-        Fiber::ptr cur = Fiber::GetThis();
-        auto raw_ptr = cur.get();
-        cur.reset();
+        Fiber::GetThisRaw()->swapOut();
+    }
+}
 
-        raw_ptr->swapOut();
+void IOManager::onTimerInsertedAtFront(size_t shard) {
+    /// 按线程分片时只有所属线程会处理该分片，唤醒它自己的epoll
+    if (isTimerSharded()) {
+        tickleWorker(shard);
+    } else {
+        tickle();
     }
 }
 
-void IOManager::onTimerInsertedAtFront() {
-    tickle();
+int IOManager::getTimerShard() {
+    return getWorkerIndex();
+}
+
+size_t IOManager::pickTimerShard() {
+    size_t n = getWorkerCount();
+    /// use_caller线程只在stop时进入调度循环，其他线程的定时器不交给它
+    if (m_rootThread != -1 && n > 1) {
+        return 1 + m_reactorSeq++ % (n - 1);
+    }
+    return m_reactorSeq++ % n;
 }
 
 }  // namespace zero
\ No newline at end of file
@@ -1,6 +1,7 @@
 #ifndef __ZERO_IOMANAGER_H__
 #define __ZERO_IOMANAGER_H__
 
+#include "io_uring.h"
 #include "scheduler.h"
 #include "zero/fiber.h"
 #include "zero/mutex.h"
@@ -9,6 +10,7 @@
 #include <cstddef>
 #include <functional>
 #include <memory>
+#include <sys/epoll.h>
 #include <vector>
 #include "timer.h"
 
@@ -29,9 +31,9 @@ public:
         WRITE = 0x4,
     };
 
-private:
     /**
-     * @brief socket事件上下文
+     * @brief socket事件上下文，存放在FdManager的fd表中，与hook用的FdCtx同一条记录，地址不变
+     *        同一时刻只属于一个IOManager
      * 
      */
     struct FdContext {
@@ -43,7 +45,9 @@ private:
         struct EventContext {
             Scheduler* scheduler = nullptr;
             Fiber::ptr fiber;
-            std::function<void()> cb;
+            Task cb;
+            /// 每次addEvent加一，区分同一fd上先后的等待，记录复用时也不归零
+            uint64_t seq = 0;
         };
 
         /**
@@ -77,6 +81,14 @@ private:
         int fd = 0;
         /// 当前事件
         Event events = NONE;
+        /// 注册所在的反应堆下标，没有事件时可以换到其他反应堆
+        size_t reactor = 0;
+        /// 常驻注册模式：是否已经以EPOLLIN|EPOLLOUT|EPOLLET加入epoll，关闭前不再MOD/DEL；挂起前以ADD确认注册仍在
+        bool registered = false;
+        /// 常驻注册模式：已就绪但没有等待者的事件，下次addEvent直接消费
+        Event ready = NONE;
+        /// 所属IOManager的编号，换了IOManager时之前的注册状态作废
+        uint32_t owner = 0;
         MutexType mutex;
     };
 
@@ -91,9 +103,11 @@ public:
      * @param fd 
      * @param event 
      * @param cb 
-     * @return int 成功返回0，失败返回-1
+     * @param seq 不为空时返回这次等待的序号，传给cancelEvent只取消这一次等待
+     * @return int 成功返回0，失败返回-1；
+     *             常驻注册模式下事件已经就绪时，有cb则立即调度cb并返回0，没有cb则返回1，调用方不应挂起而是直接重试
      */
-    int addEvent(int fd, Event event, std::function<void()> cb = nullptr);
+    int addEvent(int fd, Event event, Task cb = nullptr, uint64_t* seq = nullptr);
 
     /**
      * @brief 删除事件,不会触发事件
@@ -110,10 +124,11 @@ public:
      * 
      * @param fd 
      * @param event 
+     * @param seq addEvent返回的等待序号，那次等待已经结束时什么也不做；0表示取消当前的等待
      * @return true 
      * @return false 
      */
-    bool cancelEvent(int fd, Event event);
+    bool cancelEvent(int fd, Event event, uint64_t seq = 0);
 
     /**
      * @brief 取消所有事件
@@ -124,6 +139,14 @@ public:
      */
     bool cancelAll(int fd);
 
+    /**
+     * @brief 挂起当前协程us微秒，到期后重新调度
+     *        定时器是池化的一次性节点，恢复协程的回调就地存放，整个过程不分配内存
+     * 
+     * @param us 
+     */
+    void sleepUS(uint64_t us);
+
     /**
      * @brief 返回当前的IOManager
      * 
@@ -131,30 +154,218 @@ public:
      */
     static IOManager* GetThis();
 
+    /**
+     * @brief 是否每个工作线程一个epoll(多反应堆模式)，由iomanager.multi_reactor在构造时决定
+     * 
+     * @return true 
+     * @return false 
+     */
+    bool isMultiReactor() const {
+        return m_multiReactor;
+    }
+
+    /**
+     * @brief 是否启用了io_uring后端，由iomanager.io_uring在构造时决定，内核不支持时回退到epoll
+     * 
+     * @return true 
+     * @return false 
+     */
+    bool isIoUring() const {
+        return m_ioUring;
+    }
+
+    /**
+     * @brief 是否常驻注册epoll，由iomanager.persistent_epoll在构造时决定
+     *        fd第一次addEvent时以EPOLLIN|EPOLLOUT|EPOLLET加入epoll，就绪状态记录在fd上下文中，直到cancelAll(close)才移除
+     * 
+     * @return true 
+     * @return false 
+     */
+    bool isPersistentEpoll() const {
+        return m_persistentEpoll;
+    }
+
+    /**
+     * @brief 休眠是否使用epoll_pwait2，由iomanager.epoll_pwait2和内核支持情况在构造时决定，否则使用timerfd
+     * 
+     * @return true 
+     * @return false 
+     */
+    bool isEpollPwait2() const {
+        return m_epollPwait2;
+    }
+
+    /**
+     * @brief 当前协程能否通过submitIo等待IO：需要启用io_uring、运行在本调度器的工作线程上且不使用共享栈
+     *        (共享栈协程切出后栈地址会被复用，内核无法回写栈上的完成结果)
+     * 
+     * @return true 
+     * @return false 
+     */
+    bool canSubmitIo();
+
+    /// submitIo的返回值：提交队列已满，请求没有提交
+    static const int IO_SQ_FULL = -0x7fffffff - 1;
+
+    /**
+     * @brief 向当前线程的io_uring提交一个请求并挂起当前协程，完成后恢复
+     *        提交项在本轮调度循环结束时批量交给内核
+     * 
+     * @param opcode IORING_OP_*
+     * @param fd 
+     * @param addr 缓冲区或地址
+     * @param len 
+     * @param off 偏移，accept/connect时为地址长度
+     * @param op_flags recv/send的flags，poll的事件
+     * @param timeout_ms 超时时间，~0ull表示不超时
+     * @return int 请求的结果，失败返回-errno，超时返回-ETIMEDOUT；
+     *             提交队列腾不出空间时不挂起，返回IO_SQ_FULL，调用方应退回epoll等待
+     */
+    int submitIo(uint8_t opcode, int fd, const void* addr, uint32_t len, uint64_t off, uint32_t op_flags,
+                 uint64_t timeout_ms);
+
+    /**
+     * @brief 取消fd上所有在途的io_uring请求，等待的协程以-ECANCELED恢复
+     * 
+     * @param fd 
+     */
+    void cancelIo(int fd);
+
 protected:
     void tickle() override;
+    void tickleWorker(size_t worker) override;
     bool stopping() override;
     void idle() override;
-    void onTimerInsertedAtFront() override;
+    void onTimerInsertedAtFront(size_t shard) override;
+    int getTimerShard() override;
+    size_t pickTimerShard() override;
+    void onTick() override;
 
     /**
-     * @brief 重置socker句柄上下文的容器大小
+     * @brief 休眠前先自旋一段时间，轮询任务队列、到期定时器和IO事件(epoll_wait超时为0)
      * 
-     * @param size 
+     * @param epfd 本线程的epoll
+     * @param events epoll事件数组
+     * @param max_events 
+     * @param budget_us 最长自旋时间
+     * @return int >0 轮询到的IO事件数；0 有任务或到期定时器；-1 自旋超时，需要休眠
+     */
+    int spinIdle(int epfd, epoll_event* events, int max_events, uint64_t budget_us);
+
+    /**
+     * @brief 是否可以停止
+     * 
+     * @param timeout 最近一个定时器的等待时间(微秒)
+     * @return true 
+     * @return false 
      */
-    void contextResize(size_t size);
     bool stopping(uint64_t& timeout);
 
 private:
-    /// epoll文件句柄
-    int m_epfd = 0;
-    /// pipe文件句柄
-    int m_tickleFds[2];
+    /**
+     * @brief 反应堆：一个epoll和唤醒阻塞在它上面的线程的eventfd
+     * 
+     */
+    struct Reactor {
+        /// epoll文件句柄
+        int epfd = -1;
+        /// 唤醒休眠线程的eventfd
+        int tickleFd = -1;
+        /// 已经写过eventfd、还没有线程读走，期间的tickle合并为一次
+        std::atomic<bool> ticklePending = { false };
+        /// 阻塞在该epoll上的线程数
+        std::atomic<size_t> sleeping = { 0 };
+        /// io_uring后端时每个反应堆一个，文件句柄加入epoll，有完成事件时唤醒
+        std::unique_ptr<IoUring> ring;
+        /// 已提交未完成的请求数
+        std::atomic<size_t> ringInflight = { 0 };
+        /// 不支持epoll_pwait2时用于微秒级唤醒的timerfd
+        int timerFd = -1;
+    };
+
+    /**
+     * @brief 等待中的io_uring请求，放在发起协程的栈上，地址作为user_data
+     * 
+     */
+    struct IoOp {
+        Fiber::ptr fiber;
+        int res = 0;
+        /// 还没收割的完成事件数，链接了超时时请求和超时各有一个
+        int pending = 1;
+        /// 链接的超时是否触发
+        bool timedOut = false;
+    };
+
+    /**
+     * @brief 提交反应堆中积攒的请求并收割完成事件，恢复对应的协程
+     * 
+     * @param reactor 
+     * @return uint32_t 收割的完成事件数
+     */
+    uint32_t pollRing(Reactor& reactor);
+
+    /**
+     * @brief 在反应堆上等待IO事件，微秒精度：优先epoll_pwait2，否则不足一毫秒的部分由timerfd唤醒
+     * 
+     * @param reactor 
+     * @param events 
+     * @param max_events 
+     * @param timeout_us 
+     * @return int 同epoll_wait
+     */
+    int waitEvents(Reactor& reactor, epoll_event* events, int max_events, uint64_t timeout_us);
+
+    /**
+     * @brief 当前线程等待所用的反应堆
+     * 
+     * @return Reactor& 
+     */
+    Reactor& currentReactor();
+
+    /**
+     * @brief 为没有事件的fd选择反应堆：多反应堆模式下是调用线程自己的，非工作线程轮流分配
+     * 
+     * @return size_t 
+     */
+    size_t pickReactor();
+
+    /**
+     * @brief fd注册所在的epoll
+     * 
+     * @param fd_ctx 
+     * @return int 
+     */
+    int epfdOf(FdContext* fd_ctx) {
+        return m_reactors[fd_ctx->reactor]->epfd;
+    }
+
+    /**
+     * @brief 唤醒阻塞在该反应堆上的一个线程
+     * 
+     * @param reactor 
+     * @param force 是否忽略在途的唤醒(停止时)
+     */
+    void wakeReactor(Reactor& reactor, bool force);
+
+private:
+    /// 单反应堆模式只有一个，所有线程共用；多反应堆模式下标与工作线程下标一致
+    std::vector<std::unique_ptr<Reactor>> m_reactors;
+    /// 是否多反应堆模式
+    bool m_multiReactor = false;
+    /// 是否使用io_uring后端
+    bool m_ioUring = false;
+    /// 是否常驻注册epoll
+    bool m_persistentEpoll = false;
+    /// 是否用epoll_pwait2休眠
+    bool m_epollPwait2 = false;
+    /// 轮转选择反应堆
+    std::atomic<size_t> m_reactorSeq = { 0 };
+    /// 阻塞在epoll_wait中的线程数，为0时tickle不用写eventfd
+    std::atomic<size_t> m_sleepingThreadCount = { 0 };
     /// 当前等待执行的事件数量
     std::atomic<size_t> m_pendingEventCount = { 0 };
-    RWMutexType m_mutex;
-    /// socker事件上下文的容器
-    std::vector<FdContext*> m_fdContexts;
+    /// 进程内唯一编号，标记fd上下文的归属
+    uint32_t m_id = 0;
 };
 
 }  // namespace zero
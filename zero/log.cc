@@ -468,7 +468,7 @@ std::string FileLogAppender::toYamlString() {
 Logger::Logger(const std::string& name)
     : m_name(name), m_level(LogLevel::INFO)
       ,
-      m_createTime(zero::GetCurrentMS()) {}
+      m_createTime(zero::Clock::CoarseMS()) {}
 
 void Logger::addAppender(LogAppender::ptr appender) {
     MutexType::Lock lock(m_mutex);
@@ -1,6 +1,7 @@
 #ifndef __ZERO_LOG_H__
 #define __ZERO_LOG_H__
 
+#include "clock.h"
 #include "singleton.h"
 #include "util.h"
 #include "mutex.h"
@@ -42,7 +43,7 @@
 #define ZERO_LOG_LEVEL(logger, level)                                                                                                 \
     if (level <= logger->getLevel())                                                                                                  \
     zero::LogEventWrap(logger, zero::LogEvent::ptr(new zero::LogEvent(                                                                \
-                                   logger->getName(), level, __FILE__, __LINE__, zero::GetCurrentMS() - logger->getCreateTime(),      \
+                                   logger->getName(), level, __FILE__, __LINE__, zero::Clock::CoarseMS() - logger->getCreateTime(),    \
                                    zero::GetThreadId(), zero::GetFiberId(), time(0), zero::GetThreadName())))                         \
         .getLogEvent()                                                                                                                \
         ->getSS()
@@ -71,7 +72,7 @@
 #define ZERO_LOG_FMT_LEVEL(logger, level, fmt, ...)                                                                                   \
     if (level <= logger->getLevel())                                                                                                  \
     zero::LogEventWrap(logger, zero::LogEvent::ptr(new zero::LogEvent(                                                                \
-                                   logger->getName(), level, __FILE__, __LINE__, zero::GetCurrentMS() - logger->getCreateTime(),      \
+                                   logger->getName(), level, __FILE__, __LINE__, zero::Clock::CoarseMS() - logger->getCreateTime(),    \
                                    zero::GetThreadId(), zero::GetFiberId(), time(0), zero::GetThreadName())))                         \
         .getLogEvent()                                                                                                                \
         ->printf(fmt, __VA_ARGS__)
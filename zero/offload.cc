@@ -0,0 +1,108 @@
+#include "offload.h"
+#include "config.h"
+#include "fiber.h"
+#include "log.h"
+#include "macro.h"
+#include "scheduler.h"
+#include <algorithm>
+#include <errno.h>
+#include <string>
+
+namespace zero {
+
+static Logger::ptr g_logger = ZERO_LOG_NAME("system");
+
+static ConfigVar<uint32_t>::ptr g_offload_threads =
+    Config::Lookup<uint32_t>("offload.threads", 4, "threads running blocking calls (file io, getaddrinfo) for fibers, 0 to disable");
+
+static std::atomic<uint32_t> s_offload_threads{ 4 };
+
+struct _OffloadIniter {
+    _OffloadIniter() {
+        s_offload_threads = g_offload_threads->getValue();
+        g_offload_threads->addListener([](const uint32_t& old_value, const uint32_t& new_value) {
+            ZERO_LOG_INFO(g_logger) << "offload threads changed from " << old_value << " to " << new_value;
+            s_offload_threads = new_value;
+        });
+    }
+};
+
+static _OffloadIniter s_offload_initer;
+
+Offload* Offload::GetInstance() {
+    /// 不析构，进程退出时线程可能还阻塞在队列上
+    static Offload* s_instance = new Offload;
+    return s_instance;
+}
+
+Offload::Offload() : m_sem(0) {}
+
+bool Offload::CanOffload() {
+    if (!s_offload_threads || !Scheduler::GetThis() || Fiber::GetFiberId() == 0) {
+        return false;
+    }
+    Fiber* cur = Fiber::GetThisRaw();
+    /// 共享栈协程挂起后栈区域会被其他协程复用，池中线程不能回写它栈上的结果和缓冲区(同IOManager::canSubmitIo)
+    return cur != Scheduler::GetMainFiber() && !cur->isSharedStack();
+}
+
+size_t Offload::getThreadCount() {
+    Mutex::Lock lock(m_mutex);
+    return m_threads.size();
+}
+
+void Offload::start() {
+    Mutex::Lock lock(m_mutex);
+    if (m_started) {
+        return;
+    }
+    /// 已经运行的线程数只增不减，配置调小在下次启动进程时生效
+    uint32_t count = std::max(s_offload_threads.load(), 1u);
+    for (uint32_t i = 0; i < count; ++i) {
+        m_threads.emplace_back(new Thread(std::bind(&Offload::worker, this), "offload_" + std::to_string(i)));
+    }
+    m_started = true;
+}
+
+void Offload::run(Task task) {
+    if (!CanOffload()) {
+        task();
+        return;
+    }
+    if (ZERO_UNLIKELY(!m_started)) {
+        start();
+    }
+    int err = 0;
+    FiberWaiter waiter;
+    /// 挂起期间协程不在调度器的任何队列中，登记为等待中，防止调度器先停止
+    Scheduler* scheduler = Scheduler::GetThis();
+    scheduler->addPending();
+    {
+        Mutex::Lock lock(m_mutex);
+        m_jobs.push_back(Job{ std::move(task), waiter, &err });
+    }
+    m_sem.notify();
+    /// 执行完可能早于这里让出，调度器会等协程让出后再执行它
+    waiter.park();
+    scheduler->donePending();
+    errno = err;
+}
+
+void Offload::worker() {
+    while (true) {
+        m_sem.wait();
+        Mutex::Lock lock(m_mutex);
+        ZERO_ASSERT(!m_jobs.empty());
+        Job job(std::move(m_jobs.front()));
+        m_jobs.pop_front();
+        lock.unlock();
+        job.task();
+        *job.err = errno;
+        /// task可能引用提交协程栈上的数据，唤醒之前先析构，唤醒之后不再访问job之外的东西
+        job.task = nullptr;
+        ++m_completed;
+        job.waiter.notify();
+    }
+}
+
+}  // namespace zero
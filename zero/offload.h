@@ -0,0 +1,104 @@
+#ifndef __ZERO_OFFLOAD_H__
+#define __ZERO_OFFLOAD_H__
+
+#include "fiber_sync.h"
+#include "mutex.h"
+#include "noncopyable.h"
+#include "task.h"
+#include "thread.h"
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+namespace zero {
+
+/**
+ * @brief 阻塞调用卸载线程池
+ *        普通文件的读写、open、stat、fsync以及getaddrinfo没有可以等待的就绪事件，在调度线程上直接执行会卡住
+ *        该线程上的所有协程。协程把调用交给池中的线程执行后挂起，执行完再回到原来的调度器上继续
+ *        线程在第一次提交时才创建，数量由offload.threads决定，为0时不卸载
+ *
+ */
+class Offload : Noncopyable {
+public:
+    /**
+     * @brief 进程唯一的线程池
+     *
+     * @return Offload*
+     */
+    static Offload* GetInstance();
+
+    /**
+     * @brief 当前执行环境能否卸载：在调度器的普通协程中(调度协程、主协程不能挂起)、不使用共享栈且线程数不为0
+     *
+     * @return true
+     * @return false
+     */
+    static bool CanOffload();
+
+    /**
+     * @brief 在池中的线程执行task，当前协程挂起直到执行完，执行后的errno带回当前线程
+     *        task可以按引用捕获调用方栈上的数据；不能卸载时直接在当前线程执行
+     *
+     * @param task
+     */
+    void run(Task task);
+
+    /**
+     * @brief 已经创建的线程数
+     *
+     * @return size_t
+     */
+    size_t getThreadCount();
+
+    /**
+     * @brief 在池中执行完的调用数
+     *
+     * @return uint64_t
+     */
+    uint64_t getCompleted() const { return m_completed; }
+
+private:
+    Offload();
+
+    /**
+     * @brief 按配置创建线程，只在第一次提交时执行
+     *
+     */
+    void start();
+
+    /**
+     * @brief 线程函数，不断取出调用执行并唤醒提交的协程
+     *
+     */
+    void worker();
+
+private:
+    /**
+     * @brief 提交的调用
+     *
+     */
+    struct Job {
+        Task task;
+        /// 提交的协程
+        FiberWaiter waiter;
+        /// 执行后的errno，写在提交协程的栈上
+        int* err;
+    };
+
+    /// 保护任务队列和线程列表
+    Mutex m_mutex;
+    /// 队列中的任务数
+    Semaphore m_sem;
+    std::deque<Job> m_jobs;
+    std::vector<std::unique_ptr<Thread>> m_threads;
+    /// 线程是否已经创建
+    std::atomic<bool> m_started = { false };
+    std::atomic<uint64_t> m_completed = { 0 };
+};
+
+}  // namespace zero
+
+#endif
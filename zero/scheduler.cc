@@ -1,9 +1,12 @@
 #include "scheduler.h"
+#include "clock.h"
 #include "log.h"
 #include "macro.h"
 #include "util.h"
 #include <atomic>
+#include <algorithm>
 #include <cstddef>
+#include <sched.h>
 #include <string>
 #include <vector>
 #include "hook.h"
@@ -16,6 +19,51 @@ static zero::Logger::ptr g_logger = ZERO_LOG_NAME("system");
 static thread_local Scheduler* t_scheduler = nullptr;
 /// use_caller线程的调度协程，其他线程的主协程
 static thread_local Fiber* t_scheduler_fiber = nullptr;
+/// 当前线程下一个要执行的协程，同线程唤醒时直接交接，不经过全局任务队列
+static thread_local Fiber::ptr t_run_next;
+/// 当前线程在调度器中的工作线程下标，-1表示不是工作线程
+static thread_local int t_worker = -1;
+/// 取任务的次数，定期优先检查全局队列，避免全局队列里的任务饿死
+static thread_local uint32_t t_tick = 0;
+/// 选择窃取对象的随机数种子
+static thread_local uint32_t t_seed = 0;
+
+/// 每个线程缓存的空闲任务节点数上限
+static const size_t s_task_cache_max = 256;
+
+/**
+ * @brief 本线程缓存的空闲任务节点，线程退出时释放
+ * 
+ */
+struct Scheduler::TaskCache {
+    FiberAndThread* head = nullptr;
+    size_t size = 0;
+
+    ~TaskCache() {
+        while (head) {
+            FiberAndThread* ft = head;
+            head = ft->next;
+            delete ft;
+        }
+    }
+};
+
+thread_local Scheduler::TaskCache Scheduler::t_taskCache;
+
+/**
+ * @brief xorshift随机数
+ * 
+ * @return uint32_t 
+ */
+static uint32_t NextRandom() {
+    if (t_seed == 0) {
+        t_seed = zero::GetThreadId() * 2654435761u | 1;
+    }
+    t_seed ^= t_seed << 13;
+    t_seed ^= t_seed >> 17;
+    t_seed ^= t_seed << 5;
+    return t_seed;
+}
 
 Scheduler::Scheduler(size_t threads, bool use_caller, const std::string& name) : m_name(name) {
     ZERO_ASSERT(threads > 0);
@@ -39,6 +87,13 @@ Scheduler::Scheduler(size_t threads, bool use_caller, const std::string& name) :
         m_rootThread = -1;
     }
     m_threadCount = threads;
+
+    for (size_t i = 0; i < m_threadCount + (use_caller ? 1 : 0); ++i) {
+        m_workers.emplace_back(new Worker);
+    }
+    if (use_caller) {
+        m_workers[0]->thread = m_rootThread;
+    }
 }
 
 Scheduler::~Scheduler() {
@@ -46,6 +101,44 @@ Scheduler::~Scheduler() {
     if (GetThis() == this) {
         t_scheduler = nullptr;
     }
+    while (FiberAndThread* ft = m_fibers.head) {
+        m_fibers.unlink(nullptr, ft);
+        FreeTask(ft);
+    }
+    /// 此时工作线程都已退出，可以由任意线程取出
+    for (auto& i : m_workers) {
+        while (FiberAndThread* ft = i->queue.steal()) {
+            FreeTask(ft);
+        }
+        while (FiberAndThread* ft = i->mailbox.head) {
+            i->mailbox.unlink(nullptr, ft);
+            FreeTask(ft);
+        }
+    }
+}
+
+Scheduler::FiberAndThread* Scheduler::AllocTask() {
+    TaskCache& cache = t_taskCache;
+    if (!cache.head) {
+        return new FiberAndThread;
+    }
+    FiberAndThread* ft = cache.head;
+    cache.head = ft->next;
+    --cache.size;
+    ft->next = nullptr;
+    return ft;
+}
+
+void Scheduler::FreeTask(FiberAndThread* ft) {
+    ft->reset();
+    TaskCache& cache = t_taskCache;
+    if (cache.size >= s_task_cache_max) {
+        delete ft;
+        return;
+    }
+    ft->next = cache.head;
+    cache.head = ft;
+    ++cache.size;
 }
 
 Scheduler* Scheduler::GetThis() {
@@ -63,6 +156,7 @@ void Scheduler::start() {
     }
     m_stopping = false;
     ZERO_ASSERT(m_threads.empty());
+    m_workerSeq = m_rootThread == -1 ? 0 : 1;
 
     m_threads.resize(m_threadCount);
     for (size_t i = 0; i < m_threadCount; ++i) {
@@ -132,45 +226,48 @@ void Scheduler::run() {
         t_scheduler_fiber = Fiber::GetThis().get();
     }
 
+    size_t worker = zero::GetThreadId() == m_rootThread ? 0 : m_workerSeq++;
+    ZERO_ASSERT2(worker < m_workers.size(), "worker=" << worker << " size=" << m_workers.size());
+    t_worker = worker;
+    Worker& self = *m_workers[worker];
+    self.thread = zero::GetThreadId();
+
     Fiber::ptr idle_fiber(new Fiber(std::bind(&Scheduler::idle, this)));
     Fiber::ptr cb_fiber;
 
     FiberAndThread ft;
+    /// 上一个任务设置了runnext时不减少活跃计数，runnext里的协程不在任何队列中，需要对stopping可见
+    bool carried = false;
     while (true) {
         ft.reset();
         /// 不会存在线程安全的问题吗？
         /// tickle_me继续调度  is_active有空闲任务
         bool tickle_me = false;
         bool is_active = false;
-        {
-            MutexType::Lock lock(m_mutex);
-            auto it = m_fibers.begin();
-            /// 可优化，因为每次都要去任务队列从头循环遍历取任务
-            while (it != m_fibers.end()) {
-                /// 需要到指定线程去调度，跳过
-                if (it->thread != -1 && it->thread != zero::GetThreadId()) {
-                    ++it;
-                    tickle_me = true;
-                    continue;
-                }
-
-                ZERO_ASSERT(it->fiber || it->cb);
-                /// 该任务正在被调度，跳过（该情况针对IOManager添加事件时，不设置回调的情形）
-                /// hold状态是否也加入判断？
-                if (it->fiber && it->fiber->getState() == Fiber::EXEC) {
-                    ++it;
-                    continue;
-                }
-
-                ft = *it;
-                /// 防止迭代器失效的做法
-                m_fibers.erase(it++);
-                ++m_activeThreadCount;
+        onTick();
+        if (t_run_next && t_run_next->getState() == Fiber::EXEC) {
+            /// 唤醒者早于协程让出，交给全局队列等它让出后再调度
+            schedule(std::move(t_run_next));
+        }
+        /// 先计入活跃线程，stopping不会在任务从队列取出到开始执行之间误判为空闲
+        if (!carried) {
+            ++m_activeThreadCount;
+        }
+        carried = false;
+        if (t_run_next) {
+            ft.fiber = std::move(t_run_next);
+            is_active = true;
+        } else {
+            FiberAndThread* task = nextTask(tickle_me);
+            if (task) {
+                ft.fiber = std::move(task->fiber);
+                ft.cb = std::move(task->cb);
+                ft.thread = task->thread;
+                FreeTask(task);
                 is_active = true;
-                break;
+            } else {
+                --m_activeThreadCount;
             }
-            /// 有剩余任务继续通知线程进行调度
-            tickle_me |= it != m_fibers.end();
         }
 
         /// 有任务到来，通知idle协程让出上下文
@@ -180,27 +277,36 @@ void Scheduler::run() {
 
         if (ft.fiber && (ft.fiber->getState() != Fiber::TERM && ft.fiber->getState() != Fiber::EXCEPT)) {
             ft.fiber->swapIn();
-            --m_activeThreadCount;
+            Fiber::State state = ft.fiber->getState();
             /// 当前任务可能被调用者在回调函数中执行了YieldToReady，只执行了一部分，需要将其再次放入到执行队列中去调度
-            if (ft.fiber->getState() == Fiber::READY) {
-                schedule(ft.fiber);
-            } else if (ft.fiber->getState() != Fiber::TERM && ft.fiber->getState() != Fiber::EXCEPT) {
+            if (state == Fiber::READY) {
+                schedule(std::move(ft.fiber));
+            } else if (state == Fiber::TERM || state == Fiber::EXCEPT) {
+                /// 没有其他引用的协程放回空闲链表，供后续的函数任务复用
+                Fiber::Recycle(ft.fiber);
+            } else {
                 /// YieldToHold 不用管了
                 ft.fiber->m_state = Fiber::HOLD;
             }
             ft.reset();
+            /// 重新调度之后才减少活跃计数，见stopping
+            self.finished = self.finished + 1;
+            if (t_run_next) {
+                carried = true;
+            } else {
+                --m_activeThreadCount;
+            }
         } else if (ft.cb) {
             /// 函数的调度也是由协程来承载的
             if (cb_fiber) {
-                cb_fiber->reset(ft.cb);
+                cb_fiber->reset(std::move(ft.cb));
             } else {
-                cb_fiber.reset(new Fiber(ft.cb));
+                cb_fiber = Fiber::Alloc(std::move(ft.cb));
             }
             ft.reset();
             cb_fiber->swapIn();
-            --m_activeThreadCount;
             if (cb_fiber->getState() == Fiber::READY) {
-                schedule(cb_fiber);
+                schedule(std::move(cb_fiber));
                 cb_fiber.reset();
             } else if (cb_fiber->getState() == Fiber::EXCEPT || cb_fiber->getState() == Fiber::TERM) {
                 cb_fiber->reset(nullptr);
@@ -208,6 +314,12 @@ void Scheduler::run() {
                 cb_fiber->m_state = Fiber::HOLD;
                 cb_fiber.reset();
             }
+            self.finished = self.finished + 1;
+            if (t_run_next) {
+                carried = true;
+            } else {
+                --m_activeThreadCount;
+            }
         } else {
             /// 多线程状态下有可能任务队列已经为空了，但是该线程还是去取过任务，说明这个线程活被人抢了，啥也没干，混子线程
             if (is_active) {
@@ -216,11 +328,23 @@ void Scheduler::run() {
             }
             if (idle_fiber->getState() == Fiber::TERM) {
                 ZERO_LOG_INFO(g_logger) << "idle fiber term";
+                Fiber::ClearFreeList();
+                t_worker = -1;
+                /// 离开调度循环，关闭onTick可能开启的时间缓存，之后本线程直接读时钟
+                Clock::Invalidate();
                 break;
             }
 
             ++m_idleThreadCount;
+            self.idle = true;
+            /// 先标记idle再检查，投递者要么看到idle标记去唤醒，要么任务在这里被发现
+            if (hasPendingTask()) {
+                self.idle = false;
+                --m_idleThreadCount;
+                continue;
+            }
             idle_fiber->swapIn();
+            self.idle = false;
             --m_idleThreadCount;
             if (idle_fiber->getState() != Fiber::TERM && idle_fiber->getState() != Fiber::EXCEPT) {
                 idle_fiber->m_state = Fiber::HOLD;
@@ -233,18 +357,242 @@ void Scheduler::tickle() {
     ZERO_LOG_INFO(g_logger) << "tickle";
 }
 
+void Scheduler::tickleWorker(size_t worker) {
+    tickle();
+}
+
 bool Scheduler::stopping() {
-    MutexType::Lock lock(m_mutex);
-    return m_autoStop && m_stopping && m_fibers.empty() && m_activeThreadCount == 0;
+    /// 空闲线程会反复检查，未停止时不加锁
+    if (!m_autoStop || !m_stopping) {
+        return false;
+    }
+    /// 各队列不在同一把锁下，逐个检查期间可能有线程取走任务并投递到已检查过的队列：
+    /// 这样的线程要么在检查结束时仍是活跃的，要么已经增加了完成计数
+    uint64_t finished = 0;
+    for (auto& i : m_workers) {
+        finished += i->finished;
+    }
+    if (m_activeThreadCount != 0 || m_fiberCount != 0 || m_pendingCount != 0) {
+        return false;
+    }
+    for (auto& i : m_workers) {
+        if (!i->queue.empty() || i->mailboxCount) {
+            return false;
+        }
+    }
+    if (m_activeThreadCount != 0) {
+        return false;
+    }
+    for (auto& i : m_workers) {
+        finished -= i->finished;
+    }
+    return finished == 0;
 }
 
 void Scheduler::idle() {
     ZERO_LOG_INFO(g_logger) << "idle";
     while (!stopping()) {
+        /// 取任务不再加锁，空转时主动让出CPU，线程数多于核数时不和有任务的线程抢时间片
+        sched_yield();
         zero::Fiber::YieldToHold();
     }
 }
 
+bool Scheduler::pushLocal(FiberAndThread* ft) {
+    if (t_worker < 0 || GetThis() != this) {
+        return false;
+    }
+    WorkStealQueue<FiberAndThread>& local = m_workers[t_worker]->queue;
+    bool need_tickle = local.empty();
+    local.push(ft);
+    /// push只是release，之后读idle/自旋标记前需要全屏障，与空闲线程"先置标记再检查队列"配对
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    /// 队列由空变为非空时通知空闲线程来窃取，之后由窃取成功的线程继续唤醒下一个
+    if (need_tickle && hasIdleThreads()) {
+        tickle();
+    }
+    return true;
+}
+
+bool Scheduler::pushMailbox(FiberAndThread* ft) {
+    /// 工作线程数量很少，线性查找的开销与队列长度无关
+    for (size_t i = 0; i < m_workers.size(); ++i) {
+        Worker& worker = *m_workers[i];
+        if (worker.thread != ft->thread) {
+            continue;
+        }
+        worker.mailboxMutex.lock();
+        worker.mailbox.push(ft);
+        bool need_tickle = worker.mailboxCount++ == 0;
+        worker.mailboxMutex.unlock();
+        /// 只有信箱由空变为非空且目标线程空闲时才需要唤醒，自旋中的线程会自己发现
+        if (need_tickle && worker.idle && !worker.spinning) {
+            tickleWorker(i);
+        }
+        return true;
+    }
+    return false;
+}
+
+Scheduler::FiberAndThread* Scheduler::popMailbox() {
+    Worker& self = *m_workers[t_worker];
+    if (self.mailboxCount == 0) {
+        return nullptr;
+    }
+    FiberAndThread* ft = nullptr;
+    Spinlock::Lock lock(self.mailboxMutex);
+    FiberAndThread* prev = nullptr;
+    for (FiberAndThread* it = self.mailbox.head; it; prev = it, it = it->next) {
+        /// 该任务正在被调度，跳过（该情况针对IOManager添加事件时，不设置回调的情形）
+        if (it->fiber && it->fiber->getState() == Fiber::EXEC) {
+            continue;
+        }
+        ft = it;
+        self.mailbox.unlink(prev, it);
+        --self.mailboxCount;
+        break;
+    }
+    return ft;
+}
+
+bool Scheduler::hasPendingTask() {
+    Worker& self = *m_workers[t_worker];
+    if (self.mailboxCount || !self.queue.empty() || m_fiberCount) {
+        return true;
+    }
+    for (auto& i : m_workers) {
+        if (!i->queue.empty()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int Scheduler::getWorkerIndex() {
+    return GetThis() == this ? t_worker : -1;
+}
+
+bool Scheduler::startSpinning() {
+    size_t max_spinning = std::max<size_t>(1, m_workers.size() / 2);
+    if (m_spinningThreadCount++ >= max_spinning) {
+        --m_spinningThreadCount;
+        return false;
+    }
+    m_workers[t_worker]->spinning = true;
+    return true;
+}
+
+void Scheduler::stopSpinning(bool hit, uint64_t used_us) {
+    Worker& self = *m_workers[t_worker];
+    /// 先清除标记再由调用方重新检查队列，投递者要么看到标记已清除去唤醒，要么任务在重新检查时被发现
+    self.spinning = false;
+    --m_spinningThreadCount;
+    if (hit) {
+        self.spinHits = self.spinHits + 1;
+    } else {
+        self.spinMisses = self.spinMisses + 1;
+    }
+    self.spinUs = self.spinUs + used_us;
+}
+
+Scheduler::IdleStats Scheduler::getIdleStats() {
+    IdleStats stats = { 0, 0, 0 };
+    for (auto& i : m_workers) {
+        stats.spin_hits += i->spinHits;
+        stats.spin_misses += i->spinMisses;
+        stats.spin_us += i->spinUs;
+    }
+    return stats;
+}
+
+Scheduler::FiberAndThread* Scheduler::nextTask(bool& tickle_me) {
+    WorkStealQueue<FiberAndThread>& local = m_workers[t_worker]->queue;
+    FiberAndThread* ft = popMailbox();
+    /// 每61次优先取一次全局队列(同go runtime)
+    if (!ft && ++t_tick % 61 == 0) {
+        ft = popGlobal(tickle_me);
+    }
+    /// 本线程也从队头取，按FIFO执行；pop是LIFO，YieldToReady的协程会一直排在最前面饿死其他任务
+    while (!ft && !local.empty()) {
+        ft = local.steal();
+    }
+    if (!ft) {
+        ft = popGlobal(tickle_me);
+    }
+    if (!ft && m_workers.size() > 1) {
+        /// 从随机位置开始依次窃取其他线程
+        size_t n = m_workers.size();
+        size_t start = NextRandom() % n;
+        for (size_t i = 0; i < n && !ft; ++i) {
+            size_t victim = (start + i) % n;
+            if (( int )victim != t_worker) {
+                ft = m_workers[victim]->queue.steal();
+            }
+        }
+        /// 窃取成功说明有线程积压，继续唤醒空闲线程分担
+        if (ft && hasIdleThreads()) {
+            tickle_me = true;
+        }
+    }
+    if (ft && ft->fiber && ft->fiber->getState() == Fiber::EXEC) {
+        /// 唤醒者早于协程让出，交给全局队列等它让出后再调度
+        MutexType::Lock lock(m_mutex);
+        scheduleNoLock(ft);
+        /// 任务换了队列，让stopping重新检查
+        Worker& self = *m_workers[t_worker];
+        self.finished = self.finished + 1;
+        tickle_me = true;
+        return nullptr;
+    }
+    return ft;
+}
+
+Scheduler::FiberAndThread* Scheduler::popGlobal(bool& tickle_me) {
+    if (m_fiberCount == 0) {
+        return nullptr;
+    }
+    FiberAndThread* ft = nullptr;
+    MutexType::Lock lock(m_mutex);
+    FiberAndThread* prev = nullptr;
+    FiberAndThread* it = m_fibers.head;
+    /// 可优化，因为每次都要去任务队列从头循环遍历取任务
+    while (it) {
+        /// 需要到指定线程去调度，跳过
+        if (it->thread != -1 && it->thread != zero::GetThreadId()) {
+            prev = it;
+            it = it->next;
+            tickle_me = true;
+            continue;
+        }
+
+        ZERO_ASSERT(it->fiber || it->cb);
+        /// 该任务正在被调度，跳过（该情况针对IOManager添加事件时，不设置回调的情形）
+        if (it->fiber && it->fiber->getState() == Fiber::EXEC) {
+            prev = it;
+            it = it->next;
+            continue;
+        }
+
+        ft = it;
+        /// 先记下后继，摘下后next被清空
+        it = it->next;
+        m_fibers.unlink(prev, ft);
+        --m_fiberCount;
+        break;
+    }
+    /// 有剩余任务继续通知线程进行调度
+    tickle_me |= it != nullptr;
+    return ft;
+}
+
+void Scheduler::scheduleNext(Fiber::ptr fiber) {
+    if (GetThis() != this || t_run_next || (fiber->getThread() != -1 && fiber->getThread() != zero::GetThreadId())) {
+        schedule(std::move(fiber));
+        return;
+    }
+    t_run_next = std::move(fiber);
+}
+
 void Scheduler::switchTo(int thread) {
     ZERO_ASSERT(Scheduler::GetThis() != nullptr);
     if (Scheduler::GetThis() == this) {
@@ -258,7 +606,16 @@ void Scheduler::switchTo(int thread) {
 
 std::ostream& Scheduler::dump(std::ostream& os) {
     os << "[Scheduler name=" << m_name << " size=" << m_threadCount << " active_count=" << m_activeThreadCount
-       << " idle_count=" << m_idleThreadCount << " stopping=" << m_stopping << " ]" << std::endl
+       << " idle_count=" << m_idleThreadCount << " stopping=" << m_stopping << " global=" << m_fiberCount
+       << " ]" << std::endl;
+    IdleStats stats = getIdleStats();
+    os << "    spin_hits=" << stats.spin_hits << " spin_misses=" << stats.spin_misses << " spin_us=" << stats.spin_us
+       << std::endl
+       << "    queues:";
+    for (auto& i : m_workers) {
+        os << " " << i->queue.size() << "/" << i->mailboxCount;
+    }
+    os << std::endl
        << "    ";
     for (size_t i = 0; i < m_threadIds.size(); ++i) {
         if (i) {
@@ -266,6 +623,8 @@ std::ostream& Scheduler::dump(std::ostream& os) {
         }
         os << m_threadIds[i];
     }
+    os << std::endl;
+    Fiber::DumpStackUsage(os);
     return os;
 }
 
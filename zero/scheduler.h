@@ -3,13 +3,14 @@
 
 #include "fiber.h"
 #include "mutex.h"
+#include "task.h"
 #include "thread.h"
+#include "work_steal_queue.h"
 #include "zero/noncopyable.h"
 #include <atomic>
 #include <cstddef>
 #include <functional>
 #include <iostream>
-#include <list>
 #include <memory>
 #include <ostream>
 #include <vector>
@@ -75,15 +76,29 @@ public:
      * @brief 调度协程
      * 
      * @tparam FiberOrCb 
-     * @param fc 协程或函数
+     * @param fc 协程或函数，函数直接转发构造Task，捕获不多的lambda不分配内存
      * @param thread 协程执行的线程id，-1表示任意线程
      */
     template <class FiberOrCb>
-    void schedule(FiberOrCb fc, int thread = -1) {
+    void schedule(FiberOrCb&& fc, int thread = -1) {
+        FiberAndThread* ft = AllocTask();
+        ft->assign(std::forward<FiberOrCb>(fc), thread);
+        if (!ft->fiber && !ft->cb) {
+            FreeTask(ft);
+            return;
+        }
+        /// 调度器自己的线程上调度不指定线程的任务，放入本线程的队列，不用加全局锁
+        if (ft->thread == -1 && pushLocal(ft)) {
+            return;
+        }
+        /// 指定线程的任务直接投递到目标线程的信箱，只唤醒该线程
+        if (ft->thread != -1 && pushMailbox(ft)) {
+            return;
+        }
         bool need_tickle = false;
         {
             MutexType::Lock lock(m_mutex);
-            need_tickle = scheduleNoLock(fc, thread);
+            need_tickle = scheduleNoLock(ft);
         }
         /// 任务队列不为空时则通知取任务执行
         if (need_tickle) {
@@ -104,7 +119,13 @@ public:
         {
             MutexType::Lock lock(m_mutex);
             while (begin != end) {
-                need_tickle = scheduleNoLock(&*begin, -1) || need_tickle;
+                FiberAndThread* ft = AllocTask();
+                ft->assign(&*begin, -1);
+                if (ft->fiber || ft->cb) {
+                    need_tickle = scheduleNoLock(ft) || need_tickle;
+                } else {
+                    FreeTask(ft);
+                }
                 ++begin;
             }
         }
@@ -113,29 +134,126 @@ public:
         }
     }
 
+    /**
+     * @brief 把协程放到当前线程的runnext槽位，当前协程让出后优先执行，不经过全局任务队列
+     *        当前线程不属于该调度器、槽位已被占用或协程绑定了其他线程时退回schedule
+     * 
+     * @param fiber 
+     */
+    void scheduleNext(Fiber::ptr fiber);
+
+    /**
+     * @brief 空闲自旋统计
+     * 
+     */
+    struct IdleStats {
+        /// 自旋期间等到任务或IO事件的次数
+        uint64_t spin_hits;
+        /// 自旋超时后休眠的次数
+        uint64_t spin_misses;
+        /// 自旋总时长(us)
+        uint64_t spin_us;
+    };
+
+    /**
+     * @brief 汇总各工作线程的空闲自旋统计，命中率 = spin_hits / (spin_hits + spin_misses)
+     * 
+     * @return IdleStats 
+     */
+    IdleStats getIdleStats();
+
+    /**
+     * @brief 登记一个在调度器之外等待唤醒的协程(如交给Offload线程池执行阻塞调用)
+     *        协程挂起期间不在任何队列中，登记后调度器等它被唤醒才会停止
+     * 
+     */
+    void addPending() { ++m_pendingCount; }
+
+    /**
+     * @brief 取消登记，由被唤醒的协程自己调用：此时线程处于活跃状态，调度器不会在计数归零的同时停止
+     * 
+     */
+    void donePending() { --m_pendingCount; }
+
     void switchTo(int thread = -1);
     std::ostream& dump(std::ostream& os);
 
 private:
+    struct FiberAndThread;
+    struct TaskCache;
+
+    /// 本线程缓存的空闲任务节点，任务节点在投递线程分配、在执行线程回收
+    static thread_local TaskCache t_taskCache;
+
     /**
-     * @brief 无锁的调度启动
+     * @brief 取一个任务节点，优先复用本线程缓存的节点
      * 
-     * @tparam FiberOrCb 
-     * @param fc 
-     * @param thread 
-     * @return true 
+     * @return FiberAndThread* 
+     */
+    static FiberAndThread* AllocTask();
+
+    /**
+     * @brief 清空任务节点并放回本线程缓存，缓存满时释放
+     * 
+     * @param ft 
+     */
+    static void FreeTask(FiberAndThread* ft);
+
+    /**
+     * @brief 放入全局注入队列，需持有m_mutex
+     * 
+     * @param ft 
+     * @return true 队列原本为空，需要通知
      * @return false 
      */
-    template <class FiberOrCb>
-    bool scheduleNoLock(FiberOrCb fc, int thread) {
+    bool scheduleNoLock(FiberAndThread* ft) {
         bool need_tickle = m_fibers.empty();
-        FiberAndThread ft(fc, thread);
-        if (ft.fiber || ft.cb) {
-            m_fibers.push_back(ft);
-        }
+        m_fibers.push(ft);
+        ++m_fiberCount;
         return need_tickle;
     }
 
+    /**
+     * @brief 当前线程是该调度器的工作线程时，放入本线程的窃取队列
+     * 
+     * @param ft 
+     * @return true 已放入
+     * @return false 当前线程不是工作线程
+     */
+    bool pushLocal(FiberAndThread* ft);
+
+    /**
+     * @brief 投递到指定线程的信箱
+     * 
+     * @param ft 
+     * @return true 已投递
+     * @return false 目标线程还没有进入调度(或不属于该调度器)，由调用方放入全局队列
+     */
+    bool pushMailbox(FiberAndThread* ft);
+
+    /**
+     * @brief 从本线程信箱取一个任务
+     * 
+     * @return FiberAndThread* 
+     */
+    FiberAndThread* popMailbox();
+
+    /**
+     * @brief 取下一个任务：本线程信箱 -> 本线程队列 -> 全局队列 -> 随机窃取其他线程
+     * 
+     * @param tickle_me 是否还有剩余任务需要通知其他线程
+     * @return FiberAndThread* 没有任务返回nullptr
+     */
+    FiberAndThread* nextTask(bool& tickle_me);
+
+    /**
+     * @brief 从全局队列取一个本线程可执行的任务
+     * 
+     * @param tickle_me 
+     * @return FiberAndThread* 
+     */
+    FiberAndThread* popGlobal(bool& tickle_me);
+
 protected:
     /**
      * @brief 通知协程调度器有任务了
@@ -143,6 +261,19 @@ protected:
      */
     virtual void tickle();
 
+    /**
+     * @brief 通知指定的工作线程有任务了，默认退化为tickle
+     * 
+     * @param worker 工作线程下标
+     */
+    virtual void tickleWorker(size_t worker);
+
+    /**
+     * @brief 每轮调度循环开始时调用，子类可以在这里批量提交IO请求、收割完成事件
+     * 
+     */
+    virtual void onTick() {}
+
     /**
      * @brief 协程调度函数，多个线程去使用该函数调度携程
      * 
@@ -179,65 +310,182 @@ protected:
         return m_idleThreadCount > 0;
     }
 
+    /**
+     * @brief 当前线程在该调度器中的工作线程下标
+     * 
+     * @return int 不是该调度器的工作线程返回-1
+     */
+    int getWorkerIndex();
+
+    /**
+     * @brief 工作线程数量(包括use_caller线程)
+     * 
+     * @return size_t 
+     */
+    size_t getWorkerCount() const {
+        return m_workers.size();
+    }
+
+    /**
+     * @brief 是否有空闲线程正在自旋等待任务
+     * 
+     * @return true 
+     * @return false 
+     */
+    bool hasSpinningThreads() {
+        return m_spinningThreadCount > 0;
+    }
+
+    /**
+     * @brief 本线程是否还有可取的任务，进入idle前检查，避免错过idle标记设置之前到来的任务
+     * 
+     * @return true 
+     * @return false 
+     */
+    bool hasPendingTask();
+
+    /**
+     * @brief 当前工作线程开始自旋，自旋期间投递任务不再唤醒该线程
+     *        同时自旋的线程不超过工作线程数的一半
+     * 
+     * @return true 可以自旋
+     * @return false 自旋线程已满
+     */
+    bool startSpinning();
+
+    /**
+     * @brief 当前工作线程结束自旋，调用后需要再用hasPendingTask检查一次，避免错过自旋期间未唤醒的任务
+     * 
+     * @param hit 自旋期间是否等到了任务
+     * @param used_us 自旋时长
+     */
+    void stopSpinning(bool hit, uint64_t used_us);
+
 private:
     /**
-     * @brief 协程/函数/线程组
+     * @brief 协程/函数/线程组，同时是全局队列和信箱的侵入式链表节点
      * 
      */
     struct FiberAndThread {
         /// 协程
         Fiber::ptr fiber;
         /// 协程执行函数
-        std::function<void()> cb;
+        Task cb;
         /// 线程id
-        int thread;
+        int thread = -1;
+        /// 链表中的下一个节点
+        FiberAndThread* next = nullptr;
 
         /**
-         * @brief Construct a new Fiber And Thread object
+         * @brief 设置协程
          * 
          * @param f 协程智能指针 
          * @param thr 线程id
          */
-        FiberAndThread(Fiber::ptr f, int thr) : fiber(f), thread(thr) {}
+        void assign(Fiber::ptr f, int thr) {
+            fiber = std::move(f);
+            thread = thr;
+            pin();
+        }
 
         /**
-         * @brief Construct a new Fiber And Thread object
+         * @brief 设置协程
          * 
-         * @param f 协程智能指针的指针
+         * @param f 协程智能指针的指针，取走后置空
          * @param thr 线程id
          */
-        FiberAndThread(Fiber::ptr* f, int thr) : thread(thr) {
+        void assign(Fiber::ptr* f, int thr) {
             fiber.swap(*f);
+            thread = thr;
+            pin();
         }
 
         /**
-         * @brief Construct a new Fiber And Thread object
+         * @brief 设置协程执行函数
          * 
-         * @param f 协程执行函数
+         * @param f 
          * @param thr 
          */
-        FiberAndThread(std::function<void()> f, int thr) : cb(f), thread(thr) {}
+        void assign(Task f, int thr) {
+            cb = std::move(f);
+            thread = thr;
+        }
 
         /**
-         * @brief Construct a new Fiber And Thread object
+         * @brief 设置协程执行函数
          * 
-         * @param f 协程执行函数指针
+         * @param f 协程执行函数指针，取走后置空
          * @param thr 
          */
-        FiberAndThread(std::function<void()>* f, int thr) : thread(thr) {
+        void assign(Task* f, int thr) {
             cb.swap(*f);
+            thread = thr;
         }
 
         /**
-         * @brief Construct a new Fiber And Thread object
+         * @brief 设置协程执行函数
          * 
+         * @param f std::function指针，取走后置空
+         * @param thr 
          */
-        FiberAndThread() : thread(-1) {}
+        void assign(std::function<void()>* f, int thr) {
+            cb = std::move(*f);
+            *f = nullptr;
+            thread = thr;
+        }
 
         void reset() {
             fiber = nullptr;
             cb = nullptr;
             thread = -1;
+            next = nullptr;
+        }
+
+        /**
+         * @brief 共享栈协程只能回到第一次运行的线程上执行
+         * 
+         */
+        void pin() {
+            if (thread == -1 && fiber) {
+                thread = fiber->getThread();
+            }
+        }
+    };
+
+    /**
+     * @brief FiberAndThread组成的单向FIFO链表，入队出队不分配内存
+     * 
+     */
+    struct TaskList {
+        FiberAndThread* head = nullptr;
+        FiberAndThread* tail = nullptr;
+
+        bool empty() const {
+            return head == nullptr;
+        }
+
+        void push(FiberAndThread* ft) {
+            ft->next = nullptr;
+            if (tail) {
+                tail->next = ft;
+            } else {
+                head = ft;
+            }
+            tail = ft;
+        }
+
+        /**
+         * @brief 摘下ft
+         * 
+         * @param prev ft的前一个节点，ft为头节点时为nullptr
+         * @param ft 
+         */
+        void unlink(FiberAndThread* prev, FiberAndThread* ft) {
+            (prev ? prev->next : head) = ft->next;
+            if (tail == ft) {
+                tail = prev;
+            }
+            ft->next = nullptr;
         }
     };
 
@@ -245,8 +493,41 @@ private:
     MutexType m_mutex;
     /// 线程池
     std::vector<Thread::ptr> m_threads;
-    /// 待执行协程队列
-    std::list<FiberAndThread> m_fibers;
+    /// 全局注入队列：其他线程调度的任务、指定线程的任务
+    TaskList m_fibers;
+    /// 全局队列长度，为0时取任务不用加锁
+    std::atomic<size_t> m_fiberCount = { 0 };
+    /// 在调度器之外等待唤醒的协程数
+    std::atomic<size_t> m_pendingCount = { 0 };
+    /**
+     * @brief 工作线程的任务队列
+     * 
+     */
+    struct Worker {
+        /// 线程id，线程进入run之前为-1
+        std::atomic<int> thread = { -1 };
+        /// 是否处于idle
+        std::atomic<bool> idle = { false };
+        /// 执行完的任务数，只由所属线程修改
+        std::atomic<uint64_t> finished = { 0 };
+        /// 是否在idle中自旋
+        std::atomic<bool> spinning = { false };
+        /// 自旋统计，只由所属线程修改
+        std::atomic<uint64_t> spinHits = { 0 };
+        std::atomic<uint64_t> spinMisses = { 0 };
+        std::atomic<uint64_t> spinUs = { 0 };
+        /// 不指定线程的任务，其他线程可以窃取
+        WorkStealQueue<FiberAndThread> queue;
+        /// 指定在该线程执行的任务
+        TaskList mailbox;
+        /// 信箱长度，为0时取任务不用加锁
+        std::atomic<size_t> mailboxCount = { 0 };
+        Spinlock mailboxMutex;
+    };
+    /// 每个工作线程一个，use_caller时下标0为caller线程，其余按线程进入run的顺序分配
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    /// 分配工作线程下标
+    std::atomic<size_t> m_workerSeq = { 0 };
     /// use_caller为true时有效，调度协程
     Fiber::ptr m_rootFiber;
     /// 协程调度器名称
@@ -261,6 +542,8 @@ protected:
     std::atomic<size_t> m_activeThreadCount = { 0 };
     /// 空闲线程数量
     std::atomic<size_t> m_idleThreadCount = { 0 };
+    /// 空闲线程中正在自旋的数量
+    std::atomic<size_t> m_spinningThreadCount = { 0 };
     /// 是否正在停止
     bool m_stopping = true;
     /// 是否自动停止
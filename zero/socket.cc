@@ -74,7 +74,7 @@ Socket::~Socket() {
 }
 
 int64_t Socket::getSendTimeout() {
-    FdCtx::ptr ctx = FdMgr::GetInstance()->get(m_sock);
+    FdCtx* ctx = FdMgr::GetInstance()->get(m_sock);
     if(ctx) {
         return ctx->getTimeout(SO_SNDTIMEO);
     }
@@ -87,7 +87,7 @@ void Socket::setSendTimeout(int64_t v) {
 }
 
 int64_t Socket::getRecvTimeout() {
-    FdCtx::ptr ctx = FdMgr::GetInstance()->get(m_sock);
+    FdCtx* ctx = FdMgr::GetInstance()->get(m_sock);
     if(ctx) {
         return ctx->getTimeout(SO_RCVTIMEO);
     }
@@ -122,7 +122,7 @@ bool Socket::setOption(int level, int option, const void* result, socklen_t len)
 
 /// 新连接到来时，会调用
 bool Socket::init(int sock) {
-    FdCtx::ptr ctx = FdMgr::GetInstance()->get(sock);
+    FdCtx* ctx = FdMgr::GetInstance()->get(sock);
     if(ctx && ctx->isSocket() && !ctx->isClose()) {
         m_sock = sock;
         m_isConnected = true;
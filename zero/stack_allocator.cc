@@ -0,0 +1,268 @@
+#include "stack_allocator.h"
+#include "config.h"
+#include "log.h"
+#include "macro.h"
+#include <cstdlib>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace zero {
+
+static Logger::ptr g_logger = ZERO_LOG_NAME("system");
+
+static ConfigVar<bool>::ptr g_stack_pool_enable =
+    Config::Lookup<bool>("fiber.stack_pool.enable", true, "use pooled mmap fiber stacks");
+static ConfigVar<uint32_t>::ptr g_stack_pool_thread_cache =
+    Config::Lookup<uint32_t>("fiber.stack_pool.thread_cache", 64, "max free fiber stacks cached per thread");
+static ConfigVar<uint32_t>::ptr g_stack_pool_global_cap =
+    Config::Lookup<uint32_t>("fiber.stack_pool.global_cap", 1024, "max free fiber stacks cached in global pool");
+
+/// SetDefault指定的分配器，为空时按配置选择
+static std::atomic<StackAllocator*> s_default_allocator{ nullptr };
+static std::atomic<bool> s_stack_pool_enable{ true };
+
+struct _StackAllocatorIniter {
+    _StackAllocatorIniter() {
+        s_stack_pool_enable = g_stack_pool_enable->getValue();
+        PooledStackAllocator::GetInstance()->setThreadCache(g_stack_pool_thread_cache->getValue());
+        PooledStackAllocator::GetInstance()->setGlobalCap(g_stack_pool_global_cap->getValue());
+
+        g_stack_pool_enable->addListener([](const bool& old_value, const bool& new_value) {
+            ZERO_LOG_INFO(g_logger) << "fiber stack pool enable changed from " << old_value << " to " << new_value;
+            s_stack_pool_enable = new_value;
+        });
+        g_stack_pool_thread_cache->addListener([](const uint32_t& old_value, const uint32_t& new_value) {
+            PooledStackAllocator::GetInstance()->setThreadCache(new_value);
+        });
+        g_stack_pool_global_cap->addListener([](const uint32_t& old_value, const uint32_t& new_value) {
+            PooledStackAllocator::GetInstance()->setGlobalCap(new_value);
+        });
+    }
+};
+
+static _StackAllocatorIniter s_stack_allocator_initer;
+
+StackAllocator* StackAllocator::GetDefault() {
+    StackAllocator* allocator = s_default_allocator;
+    if (allocator) {
+        return allocator;
+    }
+    if (s_stack_pool_enable) {
+        return PooledStackAllocator::GetInstance();
+    }
+    static MmapStackAllocator s_mmap_allocator;
+    return &s_mmap_allocator;
+}
+
+void StackAllocator::SetDefault(StackAllocator* allocator) {
+    s_default_allocator = allocator;
+}
+
+void* MallocStackAllocator::alloc(size_t size) {
+    return malloc(size);
+}
+
+void MallocStackAllocator::dealloc(void* vp, size_t size) {
+    free(vp);
+}
+
+size_t MmapStackAllocator::PageSize() {
+    static size_t s_page_size = sysconf(_SC_PAGESIZE);
+    return s_page_size;
+}
+
+size_t MmapStackAllocator::RoundUp(size_t size) {
+    size_t page = PageSize();
+    return (size + page - 1) & ~(page - 1);
+}
+
+void* MmapStackAllocator::Map(size_t size) {
+    size_t page = PageSize();
+    /// 只保留虚拟地址空间，物理页在第一次访问时才分配；MAP_NORESERVE不预占swap额度，大栈只按实际用到的页计费
+    void* base = mmap(nullptr, size + page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) {
+        ZERO_LOG_ERROR(g_logger) << "mmap fiber stack size=" << size << " errno=" << errno << " errstr=" << strerror(errno);
+        throw std::bad_alloc();
+    }
+    /// 栈向低地址增长，最低的一页作为保护页
+    if (mprotect(base, page, PROT_NONE)) {
+        ZERO_LOG_ERROR(g_logger) << "mprotect fiber stack guard errno=" << errno << " errstr=" << strerror(errno);
+        munmap(base, size + page);
+        throw std::bad_alloc();
+    }
+    return (char*)base + page;
+}
+
+void MmapStackAllocator::Unmap(void* vp, size_t size) {
+    size_t page = PageSize();
+    if (munmap((char*)vp - page, size + page)) {
+        ZERO_LOG_ERROR(g_logger) << "munmap fiber stack size=" << size << " errno=" << errno << " errstr=" << strerror(errno);
+    }
+}
+
+void* MmapStackAllocator::alloc(size_t size) {
+    return Map(RoundUp(size));
+}
+
+void MmapStackAllocator::dealloc(void* vp, size_t size) {
+    Unmap(vp, RoundUp(size));
+}
+
+/**
+ * @brief 线程本地空闲栈缓存，一个线程里的协程栈大小通常只有一两种，按大小分几个桶即可
+ *
+ */
+struct PooledStackAllocator::ThreadCache {
+    static const size_t BUCKETS = 4;
+
+    struct Bucket {
+        size_t size = 0;
+        FreeList list;
+    };
+
+    ~ThreadCache() {
+        /// 线程退出时把缓存的栈交还全局池
+        PooledStackAllocator* pool = PooledStackAllocator::GetInstance();
+        for (size_t i = 0; i < BUCKETS; ++i) {
+            Bucket& b = buckets[i];
+            while (b.list.head) {
+                FreeStack* node = b.list.head;
+                b.list.head = node->next;
+                pool->pushGlobal(FromNode(node, b.size), b.size);
+            }
+            b.list.count = 0;
+        }
+    }
+
+    /**
+     * @brief 查找指定大小的桶
+     *
+     * @param size
+     * @param create 没有时是否占用一个空桶
+     * @return Bucket*
+     */
+    Bucket* find(size_t size, bool create) {
+        Bucket* empty = nullptr;
+        for (size_t i = 0; i < BUCKETS; ++i) {
+            if (buckets[i].size == size) {
+                return &buckets[i];
+            }
+            if (!empty && buckets[i].list.count == 0) {
+                empty = &buckets[i];
+            }
+        }
+        if (create && empty) {
+            empty->size = size;
+            return empty;
+        }
+        return nullptr;
+    }
+
+    Bucket buckets[BUCKETS];
+};
+
+PooledStackAllocator::ThreadCache& PooledStackAllocator::LocalCache() {
+    static thread_local ThreadCache t_stack_cache;
+    return t_stack_cache;
+}
+
+PooledStackAllocator* PooledStackAllocator::GetInstance() {
+    /// 不析构，避免线程本地缓存在进程退出时访问已析构的对象
+    static PooledStackAllocator* s_instance = new PooledStackAllocator;
+    return s_instance;
+}
+
+PooledStackAllocator::PooledStackAllocator() : m_threadCache(64), m_globalCap(1024) {}
+
+void* PooledStackAllocator::alloc(size_t size) {
+    size = MmapStackAllocator::RoundUp(size);
+    ThreadCache::Bucket* b = LocalCache().find(size, false);
+    if (b && b->list.head) {
+        FreeStack* node = b->list.head;
+        b->list.head = node->next;
+        --b->list.count;
+        ++m_localHits;
+        return FromNode(node, size);
+    }
+
+    void* vp = popGlobal(size);
+    if (vp) {
+        ++m_globalHits;
+        return vp;
+    }
+    ++m_maps;
+    return MmapStackAllocator::Map(size);
+}
+
+void PooledStackAllocator::dealloc(void* vp, size_t size) {
+    size = MmapStackAllocator::RoundUp(size);
+    ThreadCache::Bucket* b = LocalCache().find(size, true);
+    if (b && b->list.count < m_threadCache) {
+        FreeStack* node = ToNode(vp, size);
+        node->next = b->list.head;
+        b->list.head = node;
+        ++b->list.count;
+        return;
+    }
+    pushGlobal(vp, size);
+}
+
+void PooledStackAllocator::pushGlobal(void* vp, size_t size) {
+    {
+        Mutex::Lock lock(m_mutex);
+        if (m_globalCount < m_globalCap) {
+            FreeList& list = m_global[size];
+            FreeStack* node = ToNode(vp, size);
+            node->next = list.head;
+            list.head = node;
+            ++list.count;
+            ++m_globalCount;
+            return;
+        }
+    }
+    ++m_unmaps;
+    MmapStackAllocator::Unmap(vp, size);
+}
+
+void* PooledStackAllocator::popGlobal(size_t size) {
+    Mutex::Lock lock(m_mutex);
+    auto it = m_global.find(size);
+    if (it == m_global.end() || !it->second.head) {
+        return nullptr;
+    }
+    FreeStack* node = it->second.head;
+    it->second.head = node->next;
+    --it->second.count;
+    --m_globalCount;
+    return FromNode(node, size);
+}
+
+PooledStackAllocator::Stats PooledStackAllocator::getStats() {
+    Stats stats;
+    stats.local_hits = m_localHits;
+    stats.global_hits = m_globalHits;
+    stats.maps = m_maps;
+    stats.unmaps = m_unmaps;
+    Mutex::Lock lock(m_mutex);
+    stats.global_free = m_globalCount;
+    return stats;
+}
+
+void PooledStackAllocator::trim() {
+    std::map<size_t, FreeList> global;
+    {
+        Mutex::Lock lock(m_mutex);
+        global.swap(m_global);
+        m_globalCount = 0;
+    }
+    for (auto& i : global) {
+        while (i.second.head) {
+            FreeStack* node = i.second.head;
+            i.second.head = node->next;
+            ++m_unmaps;
+            MmapStackAllocator::Unmap(FromNode(node, i.first), i.first);
+        }
+    }
+}
+
+}  // namespace zero
@@ -0,0 +1,257 @@
+#ifndef __ZERO_STACK_ALLOCATOR_H__
+#define __ZERO_STACK_ALLOCATOR_H__
+
+#include "mutex.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+
+namespace zero {
+
+/**
+ * @brief 协程栈分配器接口，Fiber通过它申请/归还运行栈
+ *
+ */
+class StackAllocator {
+public:
+    virtual ~StackAllocator() {}
+
+    /**
+     * @brief 申请协程栈
+     *
+     * @param size 栈大小
+     * @return void* 栈的低地址(可用区域起点)
+     */
+    virtual void* alloc(size_t size) = 0;
+
+    /**
+     * @brief 归还协程栈
+     *
+     * @param vp alloc返回的地址
+     * @param size 申请时的栈大小
+     */
+    virtual void dealloc(void* vp, size_t size) = 0;
+
+    /**
+     * @brief 返回当前默认的栈分配器
+     *        未通过SetDefault指定时，由fiber.stack_pool.enable配置决定使用池化分配器还是mmap分配器
+     *
+     * @return StackAllocator*
+     */
+    static StackAllocator* GetDefault();
+
+    /**
+     * @brief 指定默认的栈分配器(分配器需保证比用它创建的协程活得久)
+     *
+     * @param allocator
+     */
+    static void SetDefault(StackAllocator* allocator);
+};
+
+/**
+ * @brief malloc/free实现的栈分配器，没有溢出保护
+ *
+ */
+class MallocStackAllocator : public StackAllocator {
+public:
+    void* alloc(size_t size) override;
+    void dealloc(void* vp, size_t size) override;
+};
+
+/**
+ * @brief mmap实现的栈分配器，栈底(低地址)额外映射一页PROT_NONE保护页，栈溢出时立即触发SIGSEGV
+ *
+ */
+class MmapStackAllocator : public StackAllocator {
+public:
+    void* alloc(size_t size) override;
+    void dealloc(void* vp, size_t size) override;
+
+    /**
+     * @brief 系统页大小
+     *
+     * @return size_t
+     */
+    static size_t PageSize();
+
+    /**
+     * @brief 按页大小向上取整
+     *
+     * @param size
+     * @return size_t
+     */
+    static size_t RoundUp(size_t size);
+
+    /**
+     * @brief 直接映射一块带保护页的栈
+     *
+     * @param size 已按页取整的大小
+     * @return void*
+     */
+    static void* Map(size_t size);
+
+    /**
+     * @brief 解除Map映射的栈(连同保护页)
+     *
+     * @param vp
+     * @param size 已按页取整的大小
+     */
+    static void Unmap(void* vp, size_t size);
+};
+
+/**
+ * @brief 池化的mmap栈分配器
+ *        归还的栈先放入线程本地空闲链表，超出fiber.stack_pool.thread_cache后放入全局溢出池，
+ *        全局池超出fiber.stack_pool.global_cap后才真正munmap，稳定状态下协程创建销毁不再有系统调用和内存分配
+ *
+ */
+class PooledStackAllocator : public StackAllocator {
+public:
+    /**
+     * @brief 分配统计
+     *
+     */
+    struct Stats {
+        /// 线程本地链表命中次数
+        uint64_t local_hits;
+        /// 全局池命中次数
+        uint64_t global_hits;
+        /// 新映射的栈数量
+        uint64_t maps;
+        /// 解除映射的栈数量
+        uint64_t unmaps;
+        /// 全局池中的空闲栈数量
+        uint64_t global_free;
+    };
+
+    /**
+     * @brief 进程唯一的池化分配器(线程本地链表只能属于一个分配器)
+     *
+     * @return PooledStackAllocator*
+     */
+    static PooledStackAllocator* GetInstance();
+
+    void* alloc(size_t size) override;
+    void dealloc(void* vp, size_t size) override;
+
+    /**
+     * @brief 设置每个线程最多缓存的空闲栈数量
+     *
+     * @param v
+     */
+    void setThreadCache(uint32_t v) { m_threadCache = v; }
+
+    /**
+     * @brief 设置全局溢出池最多缓存的空闲栈数量
+     *
+     * @param v
+     */
+    void setGlobalCap(uint32_t v) { m_globalCap = v; }
+
+    uint32_t getThreadCache() const { return m_threadCache; }
+
+    uint32_t getGlobalCap() const { return m_globalCap; }
+
+    /**
+     * @brief 获取分配统计
+     *
+     * @return Stats
+     */
+    Stats getStats();
+
+    /**
+     * @brief 释放全局池中所有空闲栈
+     *
+     */
+    void trim();
+
+private:
+    PooledStackAllocator();
+
+    /**
+     * @brief 栈放入全局池，全局池已满时直接解除映射
+     *
+     * @param vp
+     * @param size 已按页取整的大小
+     */
+    void pushGlobal(void* vp, size_t size);
+
+    /**
+     * @brief 从全局池取一个指定大小的栈
+     *
+     * @param size 已按页取整的大小
+     * @return void* 没有返回nullptr
+     */
+    void* popGlobal(size_t size);
+
+private:
+    struct ThreadCache;
+    friend struct ThreadCache;
+
+    /**
+     * @brief 空闲栈链表节点，放在空闲栈的最高处(协程运行时总会用到的那一页)，不额外分配内存
+     *
+     */
+    struct FreeStack {
+        FreeStack* next;
+    };
+
+    /**
+     * @brief 按大小划分的空闲链表
+     *
+     */
+    struct FreeList {
+        FreeStack* head = nullptr;
+        size_t count = 0;
+    };
+
+    /**
+     * @brief 空闲栈所在地址对应的链表节点
+     *
+     * @param vp
+     * @param size
+     * @return FreeStack*
+     */
+    static FreeStack* ToNode(void* vp, size_t size) {
+        return (FreeStack*)((char*)vp + size - sizeof(FreeStack));
+    }
+
+    /**
+     * @brief 链表节点对应的栈地址
+     *
+     * @param node
+     * @param size
+     * @return void*
+     */
+    static void* FromNode(FreeStack* node, size_t size) {
+        return (char*)node + sizeof(FreeStack) - size;
+    }
+
+    /**
+     * @brief 当前线程的空闲栈缓存
+     *
+     * @return ThreadCache&
+     */
+    static ThreadCache& LocalCache();
+
+    /// 每个线程最多缓存的空闲栈数量
+    std::atomic<uint32_t> m_threadCache;
+    /// 全局池最多缓存的空闲栈数量
+    std::atomic<uint32_t> m_globalCap;
+    /// 统计信息
+    std::atomic<uint64_t> m_localHits = { 0 };
+    std::atomic<uint64_t> m_globalHits = { 0 };
+    std::atomic<uint64_t> m_maps = { 0 };
+    std::atomic<uint64_t> m_unmaps = { 0 };
+    /// 全局池锁
+    Mutex m_mutex;
+    /// 全局溢出池 栈大小->空闲链表
+    std::map<size_t, FreeList> m_global;
+    /// 全局池中的空闲栈总数
+    size_t m_globalCount = 0;
+};
+
+}  // namespace zero
+
+#endif
@@ -0,0 +1,197 @@
+#ifndef __ZERO_TASK_H__
+#define __ZERO_TASK_H__
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <typeinfo>
+#include <utility>
+
+namespace zero {
+
+/**
+ * @brief 只能移动的无参回调，替代调度、定时器、IO事件路径上的std::function<void()>
+ *        可调用对象不超过SBO_SIZE字节且移动不抛异常时就地存放，不分配堆内存；
+ *        只移动不拷贝，回调在队列之间传递时不会再复制捕获的数据
+ *
+ */
+class Task {
+public:
+    /// 就地存放的最大字节数，可放下hook里带weak_ptr条件的IO超时回调或捕获7个指针的lambda
+    static const size_t SBO_SIZE = 64;
+
+    Task() : m_ops(nullptr) {}
+
+    Task(std::nullptr_t) : m_ops(nullptr) {}
+
+    /**
+     * @brief 从任意无参可调用对象构造
+     *        空的函数指针或std::function构造出空Task
+     *
+     * @tparam F
+     * @param f
+     */
+    template <class F, class Fn = typename std::decay<F>::type,
+              class = typename std::enable_if<!std::is_same<Fn, Task>::value>::type,
+              class = decltype(std::declval<Fn&>()())>
+    Task(F&& f) : m_ops(nullptr) {
+        if (IsEmpty(f)) {
+            return;
+        }
+        Construct<Fn>(std::forward<F>(f), std::integral_constant<bool, Inline<Fn>::value>());
+        m_ops = &OpsFor<Fn>::ops;
+    }
+
+    Task(Task&& other) : m_ops(other.m_ops) {
+        if (m_ops) {
+            m_ops->move(&m_buf, &other.m_buf);
+            other.m_ops = nullptr;
+        }
+    }
+
+    Task& operator=(Task&& other) {
+        if (this != &other) {
+            reset();
+            if (other.m_ops) {
+                other.m_ops->move(&m_buf, &other.m_buf);
+                m_ops = other.m_ops;
+                other.m_ops = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    Task& operator=(std::nullptr_t) {
+        reset();
+        return *this;
+    }
+
+    Task(const Task&) = delete;
+
+    Task& operator=(const Task&) = delete;
+
+    ~Task() { reset(); }
+
+    explicit operator bool() const { return m_ops != nullptr; }
+
+    void operator()() { m_ops->invoke(&m_buf); }
+
+    void swap(Task& other) {
+        Task tmp(std::move(other));
+        other = std::move(*this);
+        *this = std::move(tmp);
+    }
+
+    /**
+     * @brief 可调用对象的类型，空Task返回typeid(void)
+     *
+     * @return const std::type_info&
+     */
+    const std::type_info& target_type() const { return m_ops ? m_ops->type() : typeid(void); }
+
+private:
+    void reset() {
+        if (m_ops) {
+            m_ops->destroy(&m_buf);
+            m_ops = nullptr;
+        }
+    }
+
+    typedef typename std::aligned_storage<SBO_SIZE, alignof(std::max_align_t)>::type Storage;
+
+    /**
+     * @brief 按是否就地存放分别构造，两个分支不能写在同一个if里，否则大对象也会实例化就地构造
+     *
+     */
+    template <class Fn, class F>
+    void Construct(F&& f, std::true_type) {
+        new (&m_buf) Fn(std::forward<F>(f));
+    }
+
+    template <class Fn, class F>
+    void Construct(F&& f, std::false_type) {
+        *reinterpret_cast<Fn**>(&m_buf) = new Fn(std::forward<F>(f));
+    }
+
+    /**
+     * @brief 可调用对象是否就地存放
+     *
+     * @tparam Fn
+     */
+    template <class Fn>
+    struct Inline {
+        static const bool value = sizeof(Fn) <= SBO_SIZE && alignof(Fn) <= alignof(Storage) &&
+                                  std::is_nothrow_move_constructible<Fn>::value;
+    };
+
+    /**
+     * @brief 类型擦除后的操作表，每种可调用类型一份
+     *
+     */
+    struct Ops {
+        void (*invoke)(void* buf);
+        /// 移动到dst并析构src
+        void (*move)(void* dst, void* src);
+        void (*destroy)(void* buf);
+        const std::type_info& (*type)();
+    };
+
+    template <class Fn>
+    struct OpsFor {
+        static Fn* Get(void* buf) {
+            return Inline<Fn>::value ? static_cast<Fn*>(buf) : *static_cast<Fn**>(buf);
+        }
+
+        static void Invoke(void* buf) { (*Get(buf))(); }
+
+        static void Move(void* dst, void* src) {
+            if (Inline<Fn>::value) {
+                Fn* f = static_cast<Fn*>(src);
+                new (dst) Fn(std::move(*f));
+                f->~Fn();
+            } else {
+                *static_cast<Fn**>(dst) = *static_cast<Fn**>(src);
+            }
+        }
+
+        static void Destroy(void* buf) {
+            if (Inline<Fn>::value) {
+                static_cast<Fn*>(buf)->~Fn();
+            } else {
+                delete *static_cast<Fn**>(buf);
+            }
+        }
+
+        static const std::type_info& Type() { return typeid(Fn); }
+
+        static const Ops ops;
+    };
+
+    template <class F>
+    static bool IsEmpty(const F&) {
+        return false;
+    }
+
+    template <class R>
+    static bool IsEmpty(R (*const& f)()) {
+        return f == nullptr;
+    }
+
+    template <class Sig>
+    static bool IsEmpty(const std::function<Sig>& f) {
+        return !f;
+    }
+
+private:
+    Storage m_buf;
+    const Ops* m_ops;
+};
+
+template <class Fn>
+const Task::Ops Task::OpsFor<Fn>::ops = { &Task::OpsFor<Fn>::Invoke, &Task::OpsFor<Fn>::Move,
+                                          &Task::OpsFor<Fn>::Destroy, &Task::OpsFor<Fn>::Type };
+
+}  // namespace zero
+
+#endif
@@ -11,11 +11,14 @@ namespace zero {
 static zero::ConfigVar<uint64_t>::ptr g_tcp_server_read_timeout =
     zero::Config::Lookup("tcp_server.read_timeout", ( uint64_t )(60 * 1000 * 2), "tcp server read timeout");
 
+static zero::ConfigVar<bool>::ptr g_tcp_server_shared_stack =
+    zero::Config::Lookup("tcp_server.shared_stack", false, "tcp server run connection fibers on shared stacks");
+
 static zero::Logger::ptr g_logger = ZERO_LOG_NAME("system");
 
 TcpServer::TcpServer(zero::IOManager* worker, zero::IOManager* io_woker, zero::IOManager* accept_worker)
     : m_worker(worker), m_ioWorker(io_woker), m_acceptWorker(accept_worker), m_recvTimeout(g_tcp_server_read_timeout->getValue()),
-      m_name("zero/1.0.0"), m_isStop(true) {}
+      m_name("zero/1.0.0"), m_isStop(true), m_sharedStack(g_tcp_server_shared_stack->getValue()) {}
 
 TcpServer::~TcpServer() {
     for(auto &i : m_socks) {
@@ -72,7 +75,12 @@ void TcpServer::startAccept(Socket::ptr sock) {
         Socket::ptr client = sock->accept();
         if(client) {
             client->setRecvTimeout(m_recvTimeout);
-            m_ioWorker->schedule(std::bind(&TcpServer::handleClient, shared_from_this(), client));
+            if(m_sharedStack) {
+                Fiber::ptr fiber(new Fiber(std::bind(&TcpServer::handleClient, shared_from_this(), client), 0, false, true));
+                m_ioWorker->schedule(fiber);
+            } else {
+                m_ioWorker->schedule(std::bind(&TcpServer::handleClient, shared_from_this(), client));
+            }
         } else {
             ZERO_LOG_ERROR(g_logger) << "accept errno=" << errno
                 << " errstr=" << strerror(errno);            
@@ -110,7 +118,7 @@ void TcpServer::handleClient(Socket::ptr client) {
 std::string TcpServer::toString(const std::string& prefix) {
     std::stringstream ss;
     ss << prefix << "[type=" << m_type
-       << " name=" << m_name << " ssl=" << m_ssl
+       << " name=" << m_name << " ssl=" << m_ssl << " shared_stack=" << m_sharedStack
        << " worker=" << (m_worker ? m_worker->getName() : "")
        << " accept=" << (m_acceptWorker ? m_acceptWorker->getName() : "")
        << " recv_timeout=" << m_recvTimeout << "]" << std::endl;
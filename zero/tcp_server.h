@@ -42,6 +42,11 @@ public:
 
     bool isStop() const { return m_isStop; }
 
+    /// 连接协程是否运行在共享栈上(大量长连接、空闲连接时可显著降低内存占用)
+    bool isSharedStack() const { return m_sharedStack; }
+
+    void setSharedStack(bool v) { m_sharedStack = v; }
+
     virtual std::string toString(const std::string& prefix = "");
 
     std::vector<Socket::ptr> getSocks() const { return m_socks; }
@@ -60,6 +65,7 @@ protected:
     std::string m_type = "tcp";
     bool m_isStop;
     bool m_ssl = false;
+    bool m_sharedStack;
 
 };
 
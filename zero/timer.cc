@@ -1,7 +1,11 @@
 #include "timer.h"
+#include "clock.h"
+#include "config.h"
 #include "util.h"
 #include "zero/mutex.h"
 #include "zero/log.h"
+#include "zero/macro.h"
+#include <algorithm>
 #include <cstdint>
 #include <functional>
 #include <memory>
@@ -11,211 +15,806 @@ namespace zero {
 
 static zero::Logger::ptr g_logger = ZERO_LOG_NAME("system");
 
-bool Timer::Comparator::operator()(const Timer::ptr& lhs, const Timer::ptr& rhs) const {
-    if (!lhs && !rhs) {
-        return false;
+static ConfigVar<uint32_t>::ptr g_timer_pool_thread_cache =
+    Config::Lookup<uint32_t>("timer.pool.thread_cache", 1024, "max free pooled timer nodes cached per thread");
+
+static std::atomic<uint32_t> s_timer_pool_thread_cache{ 1024 };
+
+struct _TimerPoolIniter {
+    _TimerPoolIniter() {
+        s_timer_pool_thread_cache = g_timer_pool_thread_cache->getValue();
+        g_timer_pool_thread_cache->addListener([](const uint32_t& old_value, const uint32_t& new_value) {
+            s_timer_pool_thread_cache = new_value;
+        });
     }
-    if (!lhs) {
-        return true;
+};
+
+static _TimerPoolIniter s_timer_pool_initer;
+
+/// 线程本地缓存为空时一次从全局池取的节点数
+static const size_t TIMER_POOL_BATCH = 64;
+
+/**
+ * @brief 全局空闲节点池，线程本地缓存满了或线程退出时放到这里
+ *        节点从不释放：TimerHandle可能在节点回收之后仍然读取它的状态
+ * 
+ */
+struct TimerNodePool {
+    Mutex mutex;
+    std::vector<Timer*> nodes;
+};
+
+/**
+ * @brief 不析构，避免线程本地缓存在进程退出时访问已析构的对象
+ * 
+ * @return TimerNodePool* 
+ */
+static TimerNodePool* GlobalTimerNodes() {
+    static TimerNodePool* s_pool = new TimerNodePool;
+    return s_pool;
+}
+
+/**
+ * @brief 线程本地空闲节点，回收节点的是驱动时间轮的线程，取节点的是添加定时器的线程
+ * 
+ */
+struct TimerNodeCache {
+    ~TimerNodeCache() {
+        TimerNodePool* pool = GlobalTimerNodes();
+        Mutex::Lock lock(pool->mutex);
+        pool->nodes.insert(pool->nodes.end(), nodes.begin(), nodes.end());
     }
-    if (!rhs) {
-        return false;
+
+    std::vector<Timer*> nodes;
+};
+
+static thread_local TimerNodeCache t_timer_nodes;
+
+/**
+ * @brief 层级对应的时间位移
+ * 
+ * @param level 
+ * @return uint32_t 
+ */
+static inline uint32_t LevelShift(uint32_t level) {
+    return level == 0 ? 0 : 8 + 6 * (level - 1);
+}
+
+/**
+ * @brief 层级第一个槽在槽数组中的下标
+ * 
+ * @param level 
+ * @return uint32_t 
+ */
+static inline uint32_t LevelSlotBase(uint32_t level) {
+    return level == 0 ? 0 : 256 + 64 * (level - 1);
+}
+
+/**
+ * @brief 在位图[0, size)中从start开始循环查找第一个置位
+ * 
+ * @param words 
+ * @param size 位数，64的整数倍
+ * @param start 
+ * @return int 相对start的偏移，没有返回-1
+ */
+static int FindNextBit(const uint64_t* words, uint32_t size, uint32_t start) {
+    for (uint32_t pos = start; pos < start + size;) {
+        uint32_t p = pos & (size - 1);
+        uint64_t bits = words[p >> 6] >> (p & 63);
+        if (bits) {
+            uint32_t off = pos - start + __builtin_ctzll(bits);
+            return off < size ? ( int )off : -1;
+        }
+        pos += 64 - (p & 63);
     }
-    /// 升序排列，最小堆
-    if (lhs->m_next < rhs->m_next) {
-        return true;
+    return -1;
+}
+
+/**
+ * @brief 单分片时加锁；按线程分片时分片只由驱动线程访问，不加锁
+ * 
+ */
+class OptionalLock {
+public:
+    OptionalLock(Mutex& mutex, bool locked) : m_mutex(mutex), m_locked(locked) {
+        if (m_locked) {
+            m_mutex.lock();
+        }
     }
-    if (rhs->m_next < lhs->m_next) {
-        return false;
+
+    ~OptionalLock() { unlock(); }
+
+    void unlock() {
+        if (m_locked) {
+            m_mutex.unlock();
+            m_locked = false;
+        }
     }
-    /// 时间相等，比较地址
-    return lhs.get() < rhs.get();
-}
 
-Timer::Timer(uint64_t ms, std::function<void()> cb, bool recurring, TimerManager* manager)
-    : m_recurring(recurring), m_ms(ms), m_cb(cb), m_manager(manager) {
-    m_next = zero::GetCurrentMS() + m_ms;
-}
+private:
+    Mutex& m_mutex;
+    bool m_locked;
+};
 
-Timer::Timer(uint64_t next) : m_next(next) {}
+/**
+ * @brief 循环定时器每次到期交给调度器的回调，共享同一个Task，不复制捕获的数据
+ * 
+ */
+struct SharedTask {
+    std::shared_ptr<Task> task;
 
-bool Timer::cancel() {
-    TimerManager::RWMutexType::WriteLock lock(m_manager->m_mutex);
-    if(m_cb) {
-        m_cb = nullptr;
-        auto it = m_manager->m_timers.find(shared_from_this());
-        m_manager->m_timers.erase(it);
-        return true;
+    void operator()() { (*task)(); }
+};
+
+Timer::Timer(uint64_t us, Task cb, bool recurring, uint64_t slack, TimerManager* manager)
+    : m_recurring(recurring), m_us(us), m_slack(slack), m_manager(manager) {
+    if (m_recurring) {
+        m_recurringCb = std::make_shared<Task>(std::move(cb));
+        m_cb = SharedTask{ m_recurringCb };
+    } else {
+        m_cb = std::move(cb);
     }
-    return false;
+    /// 不用缓存时间：当前任务可能已经运行了一段时间，以缓存时间为起点会提前到期
+    m_next = zero::Clock::MonotonicUS() + m_us;
+    updateExpire();
 }
 
-bool Timer::refresh() {
-    TimerManager::RWMutexType::WriteLock lock(m_manager->m_mutex);
-    /// 已经执行完了不处理
-    if(!m_cb) {
-        return false;
+void Timer::updateExpire() {
+    if(!m_slack) {
+        m_expire = m_next;
+        return;
     }
+    /// 窗口两端最高的不同位以下清零，得到窗口内最"整"的时刻，不早于m_next
+    uint64_t limit = m_next + m_slack;
+    uint64_t mask = m_next ^ limit;
+    uint32_t bit = 63 - __builtin_clzll(mask);
+    m_expire = limit & ~((1ull << bit) - 1);
+}
 
-    /// 已经处理过了
-    auto it = m_manager->m_timers.find(shared_from_this());
-    if(it == m_manager->m_timers.end()) {
+bool Timer::cancel() {
+    /// 与到期执行抢占同一个状态，抢到之后回调不会再被执行
+    uint64_t expected = 1;
+    if(!m_state.compare_exchange_strong(expected, 0)) {
         return false;
     }
-    /// 先删除，再insert，否则会对堆的排序造成影响
-    m_manager->m_timers.erase(it);
-    /// 刷新该定时器下次执行时间
-    m_next = zero::GetCurrentMS() + m_ms;
-    m_manager->m_timers.insert(shared_from_this());
+    m_manager->cancelTimer(this, 0, m_shard);
     return true;
 }
 
+bool TimerHandle::cancel() {
+    if(!m_node) {
+        return false;
+    }
+    /// 代数不同说明节点已经回收，和已执行一样抢不到
+    uint64_t expected = (m_gen << 1) | 1;
+    bool ok = m_node->m_state.compare_exchange_strong(expected, m_gen << 1);
+    if(ok) {
+        m_manager->cancelTimer(m_node, m_gen, m_shard);
+    }
+    m_node = nullptr;
+    return ok;
+}
+
+bool Timer::refresh() {
+    return m_manager->resetTimer(this, ~0ull, true);
+}
+
 bool Timer::reset(uint64_t ms, bool from_now) {
+    return resetUS(ms * 1000, from_now);
+}
+
+bool Timer::resetUS(uint64_t us, bool from_now) {
     /// 无意义的重置，应该也是false
-    if(ms == m_ms && !from_now) {
+    if(us == m_us && !from_now) {
         return true;
     }
-    TimerManager::RWMutexType::WriteLock lock(m_manager->m_mutex);
-    if(!m_cb) {
-        return false;
+    return m_manager->resetTimer(this, us, from_now);
+}
+
+TimerManager::Shard::Shard() {
+    base = zero::Clock::NowMS();
+    for(uint32_t i = 0; i <= SLOTS; ++i) {
+        slots[i] = nullptr;
+    }
+    for(uint32_t i = 0; i < SLOTS / 64; ++i) {
+        bitmap[i] = 0;
+    }
+}
+
+TimerManager::TimerManager() {
+    m_shards.emplace_back(new Shard);
+}
+
+TimerManager::~TimerManager() {
+    for(auto& shard : m_shards) {
+        /// 未处理的消息持有定时器，直接丢弃；还没挂上的池化节点只在ADD消息里，在这里回收
+        Message* msg = shard->inbox.exchange(nullptr);
+        while(msg) {
+            Message* next = msg->next;
+            if(msg->type == Message::ADD && msg->timer->m_pooled) {
+                FreeNode(msg->timer);
+            }
+            delete msg;
+            msg = next;
+        }
+        /// 时间轮中的定时器持有自身，断开后才能释放
+        for(uint32_t i = 0; i <= SLOTS; ++i) {
+            Timer* t = shard->takeSlot(i);
+            while(t) {
+                Timer* next = t->m_wheelNext;
+                t->m_wheelNext = nullptr;
+                t->m_wheelPprev = nullptr;
+                t->m_slot = -1;
+                release(t);
+                t = next;
+            }
+        }
+    }
+}
+
+void TimerManager::initTimerShards(size_t count) {
+    ZERO_ASSERT(count > 0);
+    ZERO_ASSERT(!hasTimer());
+    m_shards.clear();
+    for(size_t i = 0; i < count; ++i) {
+        m_shards.emplace_back(new Shard);
+    }
+    m_sharded = true;
+}
+
+Timer* TimerManager::AllocNode() {
+    std::vector<Timer*>& cache = t_timer_nodes.nodes;
+    if(cache.empty()) {
+        TimerNodePool* pool = GlobalTimerNodes();
+        Mutex::Lock lock(pool->mutex);
+        size_t n = std::min(pool->nodes.size(), TIMER_POOL_BATCH);
+        cache.insert(cache.end(), pool->nodes.end() - n, pool->nodes.end());
+        pool->nodes.resize(pool->nodes.size() - n);
+    }
+    if(!cache.empty()) {
+        Timer* node = cache.back();
+        cache.pop_back();
+        return node;
     }
-    auto it = m_manager->m_timers.find(shared_from_this());
-    if(it == m_manager->m_timers.end()) {
+    Timer* node = new Timer;
+    node->m_pooled = true;
+    node->m_state.store(0, std::memory_order_relaxed);
+    return node;
+}
+
+void TimerManager::FreeNode(Timer* node) {
+    node->m_cb = nullptr;
+    node->m_manager = nullptr;
+    /// 代数加一，之前的句柄全部失效
+    uint64_t gen = node->m_state.load(std::memory_order_relaxed) >> 1;
+    node->m_state.store((gen + 1) << 1, std::memory_order_release);
+    std::vector<Timer*>& cache = t_timer_nodes.nodes;
+    if(cache.size() < s_timer_pool_thread_cache) {
+        cache.push_back(node);
+        return;
+    }
+    TimerNodePool* pool = GlobalTimerNodes();
+    Mutex::Lock lock(pool->mutex);
+    pool->nodes.push_back(node);
+}
+
+size_t TimerManager::pickTimerShard() {
+    return m_shardSeq++ % m_shards.size();
+}
+
+void TimerManager::Shard::link(Timer* timer) {
+    /// 槽按毫秒划分
+    uint64_t expire = timer->m_expire / 1000;
+    uint32_t slot = DUE_SLOT;
+    if(expire >= base) {
+        uint64_t delta = expire - base;
+        if(delta >= MAX_RANGE) {
+            delta = MAX_RANGE - 1;
+            expire = base + delta;
+        }
+        if(delta < TVR_SIZE) {
+            slot = expire & (TVR_SIZE - 1);
+        } else {
+            uint32_t level = 1;
+            while(delta >= (1ull << (LevelShift(level) + TVN_BITS))) {
+                ++level;
+            }
+            slot = LevelSlotBase(level) + ((expire >> LevelShift(level)) & (TVN_SIZE - 1));
+        }
+    }
+
+    Timer*& head = slots[slot];
+    timer->m_wheelNext = head;
+    if(head) {
+        head->m_wheelPprev = &timer->m_wheelNext;
+    }
+    head = timer;
+    timer->m_wheelPprev = &head;
+    timer->m_slot = slot;
+    timer->m_seq = ++seq;
+    if(slot != DUE_SLOT) {
+        bitmap[slot >> 6] |= 1ull << (slot & 63);
+    }
+    count.store(size() + 1, std::memory_order_relaxed);
+}
+
+void TimerManager::Shard::unlink(Timer* timer) {
+    *timer->m_wheelPprev = timer->m_wheelNext;
+    if(timer->m_wheelNext) {
+        timer->m_wheelNext->m_wheelPprev = timer->m_wheelPprev;
+    }
+    uint32_t slot = timer->m_slot;
+    if(slot != DUE_SLOT && !slots[slot]) {
+        bitmap[slot >> 6] &= ~(1ull << (slot & 63));
+    }
+    timer->m_wheelNext = nullptr;
+    timer->m_wheelPprev = nullptr;
+    timer->m_slot = -1;
+    count.store(size() - 1, std::memory_order_relaxed);
+}
+
+Timer* TimerManager::Shard::takeSlot(uint32_t slot) {
+    Timer* head = slots[slot];
+    if(!head) {
+        return nullptr;
+    }
+    slots[slot] = nullptr;
+    if(slot != DUE_SLOT) {
+        bitmap[slot >> 6] &= ~(1ull << (slot & 63));
+    }
+    head->m_wheelPprev = nullptr;
+    size_t n = 0;
+    for(Timer* t = head; t; t = t->m_wheelNext) {
+        t->m_slot = -1;
+        ++n;
+    }
+    count.store(size() - n, std::memory_order_relaxed);
+    return head;
+}
+
+uint64_t TimerManager::Shard::nextExpiry() const {
+    if(slots[DUE_SLOT]) {
+        return 0;
+    }
+    /// 第0层的槽与到期毫秒一一对应：base + 偏移
+    int off = FindNextBit(bitmap, TVR_SIZE, base & (TVR_SIZE - 1));
+    if(off == 0) {
+        /// 当前毫秒的槽需要精确到微秒，只有这一毫秒内的定时器
+        uint64_t next = ~0ull;
+        for(Timer* t = slots[base & (TVR_SIZE - 1)]; t; t = t->m_wheelNext) {
+            next = std::min(next, t->m_expire);
+        }
+        return next;
+    }
+    if(off > 0) {
+        return (base + off) * 1000;
+    }
+    /// 高层的槽从下一个开始找，槽内定时器都不早于槽的起始时间
+    for(uint32_t level = 1; level < LEVELS; ++level) {
+        uint32_t shift = LevelShift(level);
+        uint64_t cur = (base >> shift) + 1;
+        off = FindNextBit(&bitmap[LevelSlotBase(level) >> 6], TVN_SIZE, cur & (TVN_SIZE - 1));
+        if(off >= 0) {
+            return ((cur + off) << shift) * 1000;
+        }
+    }
+    return ~0ull;
+}
+
+void TimerManager::Shard::advance(uint64_t now_us, std::vector<Timer*>& expired) {
+    uint64_t now_ms = now_us / 1000;
+    while(base <= now_ms) {
+        uint32_t idx = base & (TVR_SIZE - 1);
+        /// 第0层转完一圈，逐级把高层当前槽的定时器下放
+        if(idx == 0) {
+            for(uint32_t level = 1; level < LEVELS; ++level) {
+                uint32_t i = (base >> LevelShift(level)) & (TVN_SIZE - 1);
+                Timer* t = takeSlot(LevelSlotBase(level) + i);
+                while(t) {
+                    Timer* next = t->m_wheelNext;
+                    link(t);
+                    t = next;
+                }
+                if(i != 0) {
+                    break;
+                }
+            }
+        }
+
+        if(!size()) {
+            base = now_ms;
+            break;
+        }
+        /// 第0层为空时直接跳到最低非空层的下一次下放，不逐毫秒空转
+        /// 停在当前毫秒时也要先完成该刻度的下放，所以跳转后继续循环
+        if(!(bitmap[0] | bitmap[1] | bitmap[2] | bitmap[3])) {
+            if(base == now_ms) {
+                break;
+            }
+            uint32_t level = 1;
+            while(level < LEVELS - 1 && !bitmap[LevelSlotBase(level) >> 6]) {
+                ++level;
+            }
+            uint64_t granularity = 1ull << LevelShift(level);
+            base = std::min(now_ms, (base | (granularity - 1)) + 1);
+            continue;
+        }
+
+        if(base < now_ms) {
+            /// 已经过去的毫秒整槽到期
+            Timer* t = takeSlot(idx);
+            while(t) {
+                Timer* next = t->m_wheelNext;
+                expired.push_back(t);
+                t = next;
+            }
+            ++base;
+            continue;
+        }
+        /// 当前毫秒只取出已到期的，其余留在槽里
+        for(Timer* t = slots[idx]; t;) {
+            Timer* next = t->m_wheelNext;
+            if(t->m_expire <= now_us) {
+                unlink(t);
+                expired.push_back(t);
+            }
+            t = next;
+        }
+        break;
+    }
+}
+
+void TimerManager::linkNew(Shard& shard, Timer* timer, Timer::ptr hold) {
+    timer->m_self = std::move(hold);
+    shard.link(timer);
+}
+
+void TimerManager::release(Timer* timer) {
+    if(timer->m_pooled) {
+        FreeNode(timer);
+    } else {
+        timer->m_self.reset();
+    }
+}
+
+void TimerManager::post(size_t shard, Message* msg) {
+    std::atomic<Message*>& inbox = m_shards[shard]->inbox;
+    msg->next = inbox.load(std::memory_order_relaxed);
+    while(!inbox.compare_exchange_weak(msg->next, msg, std::memory_order_release, std::memory_order_relaxed)) {
+    }
+}
+
+void TimerManager::drain(Shard& shard) {
+    if(!shard.inbox.load(std::memory_order_relaxed)) {
+        return;
+    }
+    Message* msg = shard.inbox.exchange(nullptr, std::memory_order_acquire);
+    /// 栈是后进先出，翻转成投递顺序
+    Message* ordered = nullptr;
+    while(msg) {
+        Message* next = msg->next;
+        msg->next = ordered;
+        ordered = msg;
+        msg = next;
+    }
+    while(ordered) {
+        Message* next = ordered->next;
+        Timer* t = ordered->timer;
+        switch(ordered->type) {
+            case Message::ADD:
+                if(t->m_state.load(std::memory_order_acquire) & 1) {
+                    linkNew(shard, t, std::move(ordered->hold));
+                } else {
+                    /// 还没挂上就被取消了
+                    t->m_cb = nullptr;
+                    t->m_recurringCb.reset();
+                    if(t->m_pooled) {
+                        FreeNode(t);
+                    }
+                }
+                break;
+            case Message::CANCEL:
+                applyCancel(shard, t, ordered->gen);
+                break;
+            case Message::RESET:
+                applyReset(shard, t, ordered->us, ordered->fromNow, ordered->now);
+                break;
+        }
+        delete ordered;
+        ordered = next;
+    }
+}
+
+void TimerManager::applyCancel(Shard& shard, Timer* timer, uint64_t gen) {
+    /// 池化节点已经在到期处理时回收了
+    if((timer->m_state.load(std::memory_order_acquire) >> 1) != gen) {
+        return;
+    }
+    if(timer->m_slot < 0) {
+        /// 不在时间轮中：普通定时器可能是之前处理过，池化节点只可能还在ADD消息里，由ADD回收
+        if(!timer->m_pooled) {
+            timer->m_cb = nullptr;
+            timer->m_recurringCb.reset();
+        }
+        return;
+    }
+    /// 时间轮持有的自身引用最后释放
+    Timer::ptr self = std::move(timer->m_self);
+    timer->m_cb = nullptr;
+    timer->m_recurringCb.reset();
+    shard.unlink(timer);
+    if(timer->m_pooled) {
+        FreeNode(timer);
+    }
+}
+
+bool TimerManager::applyReset(Shard& shard, Timer* timer, uint64_t us, bool from_now, uint64_t now) {
+    /// 已经执行完、已取消或已经处理过了
+    if(!(timer->m_state.load(std::memory_order_relaxed) & 1) || timer->m_slot < 0) {
         return false;
     }
-    m_manager->m_timers.erase(it);
+    /// 先摘下，再按新的时间挂到对应的槽
+    shard.unlink(timer);
+    if(us == ~0ull) {
+        us = timer->m_us;
+    }
     uint64_t start = 0;
     if(from_now) {
-        start = zero::GetCurrentMS();
+        start = now;
     } else {
         /// 先把初始的执行间隔消除掉
-        start = m_next - m_ms;
+        start = timer->m_next - timer->m_us;
     }
     /// 再重置时间间隔
     /// 可以提前执行，也可以延后执行
-    m_ms = ms;
-    m_next = start + m_ms;
-    m_manager->addTimer(shared_from_this(),lock);
+    timer->m_us = us;
+    timer->m_next = start + us;
+    timer->updateExpire();
+    shard.link(timer);
     return true;
 }
 
-TimerManager::TimerManager() {
-    m_previousTime = zero::GetCurrentMS();
+void TimerManager::cancelTimer(Timer* timer, uint64_t gen, uint32_t shard) {
+    if(!m_sharded) {
+        MutexType::Lock lock(m_shards[0]->mutex);
+        applyCancel(*m_shards[0], timer, gen);
+        return;
+    }
+    if(getTimerShard() == ( int )shard) {
+        applyCancel(*m_shards[shard], timer, gen);
+        return;
+    }
+    /// 回调已经不会执行，摘除不急，不唤醒所属线程
+    Message* msg = new Message;
+    msg->type = Message::CANCEL;
+    msg->timer = timer;
+    if(!timer->m_pooled) {
+        msg->hold = timer->shared_from_this();
+    }
+    msg->gen = gen;
+    post(shard, msg);
 }
 
-TimerManager::~TimerManager() {}
+bool TimerManager::resetTimer(Timer* timer, uint64_t us, bool from_now) {
+    uint64_t now = zero::Clock::MonotonicUS();
+    if(!m_sharded) {
+        Shard& shard = *m_shards[0];
+        MutexType::Lock lock(shard.mutex);
+        if(!applyReset(shard, timer, us, from_now, now)) {
+            return false;
+        }
+        /// 提前到最近的到期时间之前，需要唤醒等待中的线程重新计算超时
+        bool at_front = !shard.tickled && timer->m_expire <= shard.nextExpiry();
+        if(at_front) {
+            shard.tickled = true;
+        }
+        lock.unlock();
+        if(at_front) {
+            onTimerInsertedAtFront(0);
+        }
+        return true;
+    }
+    Shard& shard = *m_shards[timer->m_shard];
+    if(getTimerShard() == ( int )timer->m_shard) {
+        /// 可能还在自己的消息队列里没有挂上
+        drain(shard);
+        return applyReset(shard, timer, us, from_now, now);
+    }
+    if(!(timer->m_state.load(std::memory_order_relaxed) & 1)) {
+        return false;
+    }
+    Message* msg = new Message;
+    msg->type = Message::RESET;
+    msg->timer = timer;
+    msg->hold = timer->shared_from_this();
+    msg->us = us;
+    msg->fromNow = from_now;
+    msg->now = now;
+    post(timer->m_shard, msg);
+    onTimerInsertedAtFront(timer->m_shard);
+    return true;
+}
+
+Timer::ptr TimerManager::addTimer(uint64_t ms, Task cb, bool recurring, uint64_t slack_ms) {
+    return addTimerUS(ms * 1000, std::move(cb), recurring, slack_ms * 1000);
+}
 
-Timer::ptr TimerManager::addTimer(uint64_t ms, std::function<void()> cb, bool recurring) {
-    Timer::ptr timer(new Timer(ms,cb,recurring,this));
-    RWMutexType::WriteLock lock(m_mutex);
-    addTimer(timer, lock);
+Timer::ptr TimerManager::addTimerUS(uint64_t us, Task cb, bool recurring, uint64_t slack_us) {
+    Timer::ptr timer(new Timer(us, std::move(cb), recurring, slack_us, this));
+    insertTimer(timer.get(), timer);
     return timer;
 }
 
-static void OnTimer(std::weak_ptr<void> weak_cond, std::function<void()> cb) {
-    std::shared_ptr<void> tmp = weak_cond.lock();
-    if(tmp) {
-        cb();
-    }
+TimerHandle TimerManager::addOnceTimer(uint64_t ms, Task cb, uint64_t slack_ms) {
+    return addOnceTimerUS(ms * 1000, std::move(cb), slack_ms * 1000);
 }
 
-Timer::ptr TimerManager::addConditionTimer(uint64_t ms, std::function<void()> cb, std::weak_ptr<void> weak_cond, bool recurring) {
-    return addTimer(ms, std::bind(&OnTimer, weak_cond, cb), recurring);
+TimerHandle TimerManager::addOnceTimerUS(uint64_t us, Task cb, uint64_t slack_us) {
+    Timer* node = AllocNode();
+    node->m_us = us;
+    node->m_slack = slack_us;
+    node->m_manager = this;
+    node->m_cb = std::move(cb);
+    node->m_next = zero::Clock::MonotonicUS() + us;
+    node->updateExpire();
+    uint64_t gen = node->m_state.load(std::memory_order_relaxed) >> 1;
+    node->m_state.store((gen << 1) | 1, std::memory_order_relaxed);
+    /// 挂上之后节点可能立刻被其他线程执行并回收，不能再读节点上的分片
+    uint32_t shard = insertTimer(node, nullptr);
+    return TimerHandle(node, this, gen, shard);
+}
+
+uint32_t TimerManager::insertTimer(Timer* timer, Timer::ptr hold) {
+    if(!m_sharded) {
+        Shard& shard = *m_shards[0];
+        MutexType::Lock lock(shard.mutex);
+        /// 比当前最近的到期时间还早，需要唤醒等待中的线程重新计算超时
+        bool at_front = !shard.tickled && timer->m_expire < shard.nextExpiry();
+        if(at_front) {
+            shard.tickled = true;
+        }
+        linkNew(shard, timer, std::move(hold));
+        lock.unlock();
+        if(at_front) {
+            onTimerInsertedAtFront(0);
+        }
+        return 0;
+    }
+    int own = getTimerShard();
+    if(own >= 0) {
+        /// 本线程的分片，不加锁；本线程醒着，回到idle时会重新计算超时
+        timer->m_shard = own;
+        linkNew(*m_shards[own], timer, std::move(hold));
+        return own;
+    }
+    size_t shard = pickTimerShard();
+    timer->m_shard = shard;
+    Message* msg = new Message;
+    msg->type = Message::ADD;
+    msg->timer = timer;
+    msg->hold = std::move(hold);
+    post(shard, msg);
+    onTimerInsertedAtFront(shard);
+    return shard;
 }
 
 uint64_t TimerManager::getNextTimer() {
-    RWMutexType::ReadLock lock(m_mutex);
-    m_tickled = false;
-    if(m_timers.empty()) {
+    uint64_t us = getNextTimerUS();
+    return us == ~0ull ? us : (us + 999) / 1000;
+}
+
+uint64_t TimerManager::getNextTimerUS() {
+    Shard* shard = nullptr;
+    OptionalLock lock(m_shards[0]->mutex, !m_sharded);
+    if(!m_sharded) {
+        shard = m_shards[0].get();
+        shard->tickled = false;
+    } else {
+        int own = getTimerShard();
+        if(own < 0) {
+            return hasTimer() ? 0 : ~0ull;
+        }
+        shard = m_shards[own].get();
+        drain(*shard);
+    }
+    if(!shard->size()) {
         return ~0ull;
     }
-    const Timer::ptr& next = *m_timers.begin();
-    uint64_t now_ms = zero::GetCurrentMS();
-    /// now_ms >= next->m_next 该timer已经执行过了
-    /// 否则获取将要执行的timer毫秒
-    if(now_ms >= next->m_next) {
+    uint64_t next = shard->nextExpiry();
+    uint64_t now_us = zero::Clock::NowUS();
+    /// now_us >= next 该timer已经到期
+    /// 否则获取将要执行的timer微秒
+    if(now_us >= next) {
         return 0;
     } else {
-        return next->m_next - now_ms;
+        return next - now_us;
     }
 }
 
-void TimerManager::listExpiredCb(std::vector<std::function<void()>>& cbs) {
-    uint64_t now_ms = zero::GetCurrentMS();
-    std::vector<Timer::ptr> expired;
-    {
-        RWMutex::ReadLock lock(m_mutex);
-        if(m_timers.empty()) {
+void TimerManager::listExpiredCb(std::vector<Task>& cbs) {
+    Shard* shard = nullptr;
+    if(!m_sharded) {
+        shard = m_shards[0].get();
+    } else {
+        int own = getTimerShard();
+        if(own < 0) {
             return;
         }
+        shard = m_shards[own].get();
+        drain(*shard);
     }
-
-    RWMutexType::WriteLock lock(m_mutex);
-    if(m_timers.empty()) {
+    if(!shard->size()) {
         return;
     }
-    bool rollover = detectClockRollover(now_ms);
+    uint64_t now_us = zero::Clock::NowUS();
 
-    /// 系统时间未回调，且最早应该执行的timer也尚未到执行时间，则直接返回
-    if(!rollover && ((*m_timers.begin())->m_next > now_ms)) {
+    OptionalLock lock(shard->mutex, !m_sharded);
+    if(!shard->size()) {
         return;
     }
-
-    Timer::ptr now_timer(new Timer(now_ms));
-    /// 以now_timer为分界点，返回第一个大于等于now_timer的位置
-    /// 如果系统时刻回调了至少一小时，即rollover为true时，则将timer集合全部加入到待执行数组中
-    /// 否则将已经超时的timer回调函数加入到待执行数组中
-    auto it = rollover ? m_timers.end() : m_timers.lower_bound(now_timer);
-    /// 将等于now_timer执行时间的timer也包含在expierd待执行数组中，即it后移
-    while(it != m_timers.end() && (*it)->m_next == now_ms) {
-        ++it;
+    std::vector<Timer*>& expired = shard->expired;
+    /// 插入时已经到期的
+    for(Timer* t = shard->takeSlot(DUE_SLOT); t;) {
+        Timer* next = t->m_wheelNext;
+        expired.push_back(t);
+        t = next;
     }
-    /// ZERO_LOG_INFO(g_logger) << (*it).get();
-    expired.insert(expired.begin(), m_timers.begin(), it);
-    m_timers.erase(m_timers.begin(), it);
-    cbs.reserve(expired.size());
+    /// 单调时钟不会回退，直接推进时间轮取出已经超时的timer
+    /// 其他线程缓存的时间可能略早于base，此时不推进
+    shard->advance(now_us, expired);
+    if(expired.empty()) {
+        return;
+    }
+    /// 同一批到期的按到期时间先后交给调度器，与槽的遍历顺序无关；时间相同的按挂上的顺序
+    /// 原地排序，不像stable_sort那样申请临时缓冲
+    std::sort(expired.begin(), expired.end(), [](Timer* a, Timer* b) {
+        return a->m_next < b->m_next || (a->m_next == b->m_next && a->m_seq < b->m_seq);
+    });
+    cbs.reserve(cbs.size() + expired.size());
 
-    for(auto& timer : expired) {
-        cbs.push_back(timer->m_cb);
-        /// ZERO_LOG_INFO(g_logger) << timer.get();
+    for(Timer* timer : expired) {
+        timer->m_wheelNext = nullptr;
         if(timer->m_recurring) {
-            timer->m_next = now_ms + timer->m_ms;
-            m_timers.insert(timer);
-        } else {
+            if(timer->m_state.load(std::memory_order_relaxed) & 1) {
+                /// 执行前再看一次状态，交给调度器之后、开始执行之前被取消的不再执行
+                Timer::ptr self = timer->shared_from_this();
+                std::shared_ptr<Task> cb = timer->m_recurringCb;
+                cbs.push_back([self, cb]() {
+                    if(self->m_state.load(std::memory_order_acquire) & 1) {
+                        (*cb)();
+                    }
+                });
+                timer->m_next = now_us + timer->m_us;
+                timer->updateExpire();
+                shard->link(timer);
+                continue;
+            }
+            /// 已被其他线程取消，取消消息还没处理
             timer->m_cb = nullptr;
+            timer->m_recurringCb.reset();
+        } else {
+            uint64_t expected = timer->m_state.load(std::memory_order_relaxed) | 1;
+            if(timer->m_state.compare_exchange_strong(expected, expected & ~1ull)) {
+                /// 移走后m_cb为空，之后cancel/refresh返回false
+                cbs.push_back(std::move(timer->m_cb));
+            } else {
+                timer->m_cb = nullptr;
+            }
         }
+        /// 回调已经移走或清空，释放时间轮的引用只是回收定时器本身，可以在锁内进行
+        release(timer);
     }
-}
-
-void TimerManager::addTimer(Timer::ptr var, RWMutexType::WriteLock& lock) {
-    auto it = m_timers.insert(var).first;
-    /// 如果新插入的Timer 其执行时间最早则立刻执行
-    bool at_front = (it == m_timers.begin()) && !m_tickled;
-    if(at_front) {
-        m_tickled = true;
-    }
-    lock.unlock();
-    /// 加锁的粒度
-    /// 立刻执行
-    if(at_front) {
-        onTimerInsertedAtFront();
-    }
-}
-
-bool TimerManager::detectClockRollover(uint64_t now_ms) {
-    bool rollover = false;
-    /// 当前系统时间发生改变，且至少回调了一个小时
-    /// 实现确实有瑕疵
-    if(now_ms < m_previousTime && now_ms < (m_previousTime - 60 * 60 * 1000)) {
-        rollover = true;
-    }
-    m_previousTime = now_ms;
-    return rollover;
+    expired.clear();
 }
 
 bool TimerManager::hasTimer() {
-    RWMutexType::ReadLock lock(m_mutex);
-    return !m_timers.empty();
+    for(auto& shard : m_shards) {
+        if(shard->size() || shard->inbox.load(std::memory_order_relaxed)) {
+            return true;
+        }
+    }
+    return false;
 }
 
-}  // namespace zero
\ No newline at end of file
+}  // namespace zero
@@ -1,33 +1,39 @@
 #ifndef __ZERO_TIMER_H__
 #define __ZERO_TIMER_H__
 
+#include "task.h"
 #include "thread.h"
 #include "zero/mutex.h"
+#include <atomic>
 #include <cstdint>
 #include <functional>
 #include <memory>
-#include <set>
 #include <vector>
 
 namespace zero {
 
 class TimerManager;
+class TimerHandle;
 
 class Timer : public std::enable_shared_from_this<Timer> {
     friend class TimerManager;
+    friend class TimerHandle;
 public:
     typedef std::shared_ptr<Timer> ptr;
 
     /**
-     * @brief 取消定时器
+     * @brief 取消定时器，任意线程调用都同步生效：返回true时回调不会再开始执行
+     *        循环定时器已经交给调度器的那次回调在执行前检查状态后跳过，已经在执行的不受影响
+     *        时间轮上的摘除由所属线程完成，其他线程取消时发消息给它
      * 
      * @return true 
-     * @return false 
+     * @return false 已经执行过或已经取消
      */
     bool cancel();
 
     /**
      * @brief 刷新设置的定时器的执行时间
+     *        按线程分片时由非所属线程调用，只要还未执行、未取消就返回true，由所属线程稍后生效
      * 
      * @return true 
      * @return false 
@@ -45,69 +51,156 @@ public:
     bool reset(uint64_t ms, bool from_now);
 
     /**
-     * @brief 获取当前timer的精确执行时间
+     * @brief 重置定时器的执行时间，微秒精度
+     * 
+     * @param us 定时器执行间隔时间 微秒
+     * @param from_now 是否从当前时间开始计算
+     * @return true 
+     * @return false 
+     */
+    bool resetUS(uint64_t us, bool from_now);
+
+    /**
+     * @brief 获取当前timer的精确执行时间，Clock单调时钟的毫秒(向下取整)
+     * 
+     * @return uint64_t 
+     */
+    uint64_t getAccurateTime() { return m_next / 1000; }
+
+    /**
+     * @brief 获取当前timer的精确执行时间，Clock单调时钟的微秒
      * 
      * @return uint64_t 
      */
-    uint64_t getAccurateTime() { return m_next; }
+    uint64_t getAccurateTimeUS() { return m_next; }
+
+    /**
+     * @brief 允许延后执行的时长(微秒)
+     * 
+     * @return uint64_t 
+     */
+    uint64_t getSlackUS() const { return m_slack; }
 
 private:
     /**
      * @brief Construct a new Timer object
      * 
-     * @param ms 定时器执行间隔时间
+     * @param us 定时器执行间隔时间 微秒
      * @param cb 
      * @param recurring 是否循环执行
+     * @param slack 允许延后执行的时长 微秒
      * @param manager 定时器管理器
      */
-    Timer(uint64_t ms, std::function<void()> cb, bool recurring, TimerManager* manager);
+    Timer(uint64_t us, Task cb, bool recurring, uint64_t slack, TimerManager* manager);
 
     /**
-     * @brief Construct a new Timer object
+     * @brief 池化节点，由TimerManager::AllocNode创建，不由shared_ptr管理
      * 
-     * @param next 执行的时间戳 毫秒
      */
-    Timer(uint64_t next);
+    Timer() {}
+
+    /**
+     * @brief 按m_next和松弛时长计算时间轮中使用的到期时间
+     *        在[m_next, m_next + m_slack]中取低位0最多的时刻，窗口重叠的定时器落到同一时刻，一次唤醒一起执行
+     * 
+     */
+    void updateExpire();
 
 private:
     /// 是否循环定时器
     bool m_recurring = false;
-    /// 执行间隔
-    uint64_t m_ms = 0;
-    /// 精确的执行时间
+    /// 执行间隔 微秒
+    uint64_t m_us = 0;
+    /// 所属分片
+    uint32_t m_shard = 0;
+    /// 最低位为1表示一次性定时器未执行、循环定时器未取消，执行和取消抢占同一个状态
+    /// 其余位是池化节点的代数，每次回收加一，过期的TimerHandle因此无法再操作节点
+    std::atomic<uint64_t> m_state = { 1 };
+    /// 是否池化节点
+    bool m_pooled = false;
+    /// 精确的执行时间 微秒
     uint64_t m_next = 0;
-    /// 回调函数
-    std::function<void()> m_cb;
+    /// 允许延后执行的时长 微秒
+    uint64_t m_slack = 0;
+    /// 时间轮中使用的到期时间 微秒，m_next加上松弛对齐后的结果
+    uint64_t m_expire = 0;
+    /// 挂到时间轮的顺序，同一时刻到期时先挂上的先执行
+    uint64_t m_seq = 0;
+    /// 回调函数，到期后移交给调度器，为空表示已执行或已取消
+    Task m_cb;
+    /// 循环定时器的回调，每次到期时共享给调度器执行
+    std::shared_ptr<Task> m_recurringCb;
     /// 定时器管理器
     TimerManager* m_manager = nullptr;
+    /// 时间轮槽位中的侵入式链表，m_wheelPprev指向前一个节点的m_wheelNext或槽头
+    Timer* m_wheelNext = nullptr;
+    Timer** m_wheelPprev = nullptr;
+    /// 所在槽位，-1表示不在时间轮中
+    int m_slot = -1;
+    /// 在时间轮中时持有自身，保证只剩时间轮引用时不被释放
+    Timer::ptr m_self;
+};
+
+/**
+ * @brief 一次性池化定时器的句柄，按值传递，不持有节点
+ *        节点执行或取消后回收复用，句柄记录的代数与节点不一致时所有操作都是空操作
+ *        节点的内存不会释放，句柄比定时器、甚至TimerManager活得久也是安全的
+ * 
+ */
+class TimerHandle {
+    friend class TimerManager;
+public:
+    TimerHandle() {}
 
-private:
     /**
-     * @brief 定时器比较仿函数
+     * @brief 取消定时器，任意线程调用都同步生效：返回true时回调不会再开始执行
+     *        循环定时器已经交给调度器的那次回调在执行前检查状态后跳过，已经在执行的不受影响
      * 
+     * @return true 
+     * @return false 已经执行、已经取消或者是空句柄
      */
-    struct Comparator {
-        /**
-         * @brief 比较定时器的智能指针的大小（按照执行时间进行排序）
-         * 
-         * @param lhs 
-         * @param rhs 
-         * @return true 
-         * @return false 
-         */
-        bool operator()(const Timer::ptr& lhs, const Timer::ptr& rhs) const;
-    };
+    bool cancel();
+
+    /**
+     * @brief 是否关联了定时器(不代表还未执行)
+     * 
+     * @return true 
+     * @return false 
+     */
+    explicit operator bool() const { return m_node != nullptr; }
+
+private:
+    TimerHandle(Timer* node, TimerManager* manager, uint64_t gen, uint32_t shard)
+        : m_node(node), m_manager(manager), m_gen(gen), m_shard(shard) {}
+
+private:
+    Timer* m_node = nullptr;
+    /// 节点被回收后可能属于其他管理器、其他分片，这里单独记录，不读节点上的
+    TimerManager* m_manager = nullptr;
+    /// 添加时节点的代数
+    uint64_t m_gen = 0;
+    /// 节点所在分片
+    uint32_t m_shard = 0;
 };
 
 /**
  * @brief 定时器管理类,内有纯虚函数,需要IOManager类去实现
+ *        分层时间轮：第0层256个1毫秒的槽，之上4层各64个槽，每层粒度是下一层的一圈，覆盖2^32毫秒
+ *        插入、取消都是O(1)，高层的槽在低层转完一圈时逐级下放
+ *        到期时间按微秒保存，槽按毫秒划分；当前毫秒的槽逐个比较微秒，其余的槽整体到期
+ *        设置了松弛时长的定时器到期时间对齐到窗口内的整点，大量低精度定时器合并到少数几个时刻，减少唤醒
+ *
+ *        默认只有一个分片，由互斥锁保护，任意线程都可以驱动(getNextTimer/listExpiredCb)
+ *        initTimerShards之后每个工作线程拥有一个分片：本线程添加、取消、执行都不加锁，
+ *        其他线程的添加/取消/重置通过无锁消息队列交给所属线程，所属线程在驱动分片时处理
  * 
  */
 class TimerManager {
     friend class Timer;
+    friend class TimerHandle;
 
 public:
-    typedef RWMutex RWMutexType;
+    typedef Mutex MutexType;
 
     TimerManager();
 
@@ -119,9 +212,42 @@ public:
      * @param ms 定时器执行间隔时间
      * @param cb 定时器回调函数
      * @param recurring 是否循环定时器
+     * @param slack_ms 允许延后执行的时长，健康检查、保活这类不要求精度的定时器设置后可以和其他定时器合并唤醒
+     * @return Timer::ptr 
+     */
+    Timer::ptr addTimer(uint64_t ms, Task cb, bool recurring = false, uint64_t slack_ms = 0);
+
+    /**
+     * @brief 添加微秒精度的定时器
+     * 
+     * @param us 定时器执行间隔时间 微秒
+     * @param cb 定时器回调函数
+     * @param recurring 是否循环定时器
+     * @param slack_us 允许延后执行的时长 微秒
      * @return Timer::ptr 
      */
-    Timer::ptr addTimer(uint64_t ms, std::function<void()> cb, bool recurring = false);
+    Timer::ptr addTimerUS(uint64_t us, Task cb, bool recurring = false, uint64_t slack_us = 0);
+
+    /**
+     * @brief 添加一次性定时器，节点来自线程本地池，回调就地存放在节点中，不分配内存
+     *        不需要取消时直接丢弃返回的句柄
+     * 
+     * @param ms 定时器执行间隔时间
+     * @param cb 定时器回调函数
+     * @param slack_ms 允许延后执行的时长
+     * @return TimerHandle 
+     */
+    TimerHandle addOnceTimer(uint64_t ms, Task cb, uint64_t slack_ms = 0);
+
+    /**
+     * @brief 添加微秒精度的一次性定时器
+     * 
+     * @param us 定时器执行间隔时间 微秒
+     * @param cb 定时器回调函数
+     * @param slack_us 允许延后执行的时长 微秒
+     * @return TimerHandle 
+     */
+    TimerHandle addOnceTimerUS(uint64_t us, Task cb, uint64_t slack_us = 0);
 
     /**
      * @brief 添加条件定时器
@@ -130,65 +256,327 @@ public:
      * @param cb 
      * @param weak_cond 条件
      * @param recurring 
+     * @param slack_ms 
      * @return Timer::ptr 
      */
-    Timer::ptr addConditionTimer(uint64_t ms, std::function<void()> cb, std::weak_ptr<void> weak_cond, bool recurring = false);
+    template <class F>
+    Timer::ptr addConditionTimer(uint64_t ms, F&& cb, std::weak_ptr<void> weak_cond, bool recurring = false,
+                                 uint64_t slack_ms = 0) {
+        return addTimer(ms, ConditionCb<typename std::decay<F>::type>(std::move(weak_cond), std::forward<F>(cb)), recurring,
+                        slack_ms);
+    }
 
     /**
-     * @brief 到最近一个定时器的执行时间间隔
+     * @brief 到最近一个定时器的执行时间间隔(毫秒，向上取整)
      * 
-     * @return uint64_t 
+     * @return uint64_t 没有定时器返回~0ull
      */
     uint64_t getNextTimer();
 
     /**
-     * @brief 获取超时的timer回调函数集合
+     * @brief 到最近一个定时器的执行时间间隔(微秒)
+     *        当前毫秒内的定时器是精确值，更远的按所在槽的起始时间返回(不会晚于实际时间)，到时再精确计算
+     *        按线程分片时只看当前线程的分片；不拥有分片的线程只能得到有(0)或没有(~0ull)定时器
+     * 
+     * @return uint64_t 没有定时器返回~0ull
+     */
+    uint64_t getNextTimerUS();
+
+    /**
+     * @brief 获取超时的timer回调函数集合，按线程分片时只处理当前线程的分片
+     *        到期的定时器收集在分片复用的数组中，调用方复用cbs时整个过程不分配内存
      * 
      * @param cbs 
      */
-    void listExpiredCb(std::vector<std::function<void()>>& cbs);
+    void listExpiredCb(std::vector<Task>& cbs);
 
     /**
-     * @brief 是否有定时器
+     * @brief 是否有定时器，包括还在消息队列中的
      * 
      * @return true 
      * @return false 
      */
     bool hasTimer();
 
+    /**
+     * @brief 是否按线程分片
+     * 
+     * @return true 
+     * @return false 
+     */
+    bool isTimerSharded() const { return m_sharded; }
+
 protected:
     /**
-     * @brief 当有新的定时器插入到定时器的首部，执行该函数
+     * @brief 需要唤醒驱动该分片的线程重新计算等待时间：
+     *        单分片时新定时器早于最近的到期时间；按线程分片时其他线程向该分片投递了消息
+     * 
+     * @param shard 分片下标
+     */
+    virtual void onTimerInsertedAtFront(size_t shard) = 0;
+
+    /**
+     * @brief 当前线程拥有的分片，只在按线程分片时调用
+     * 
+     * @return int 不拥有分片返回-1
+     */
+    virtual int getTimerShard() { return -1; }
+
+    /**
+     * @brief 不拥有分片的线程添加定时器时选择的分片，默认轮流分配
      * 
+     * @return size_t 
      */
-    virtual void onTimerInsertedAtFront() = 0;
+    virtual size_t pickTimerShard();
 
     /**
-     * @brief 将定时器添加到管理器中
+     * @brief 切换为按线程分片，分片i由getTimerShard()返回i的线程驱动
+     *        只能在还没有定时器、没有线程驱动时调用
      * 
-     * @param var 
-     * @param lock 
+     * @param count 分片数
      */
-    void addTimer(Timer::ptr var, RWMutexType::WriteLock& lock);
+    void initTimerShards(size_t count);
 
 private:
     /**
-     * @brief 检测服务器时间是否被调后了
+     * @brief 条件定时器的回调，条件对象还存在时才执行
+     *        直接持有回调本身而不是再包一层Task，捕获不多时整体仍可就地存放
+     * 
+     * @tparam F 
+     */
+    template <class F>
+    struct ConditionCb {
+        ConditionCb(std::weak_ptr<void> c, F&& f) : cond(std::move(c)), cb(std::move(f)) {}
+
+        ConditionCb(std::weak_ptr<void> c, const F& f) : cond(std::move(c)), cb(f) {}
+
+        void operator()() {
+            std::shared_ptr<void> tmp = cond.lock();
+            if (tmp) {
+                cb();
+            }
+        }
+
+        std::weak_ptr<void> cond;
+        F cb;
+    };
+
+    /// 第0层槽数的位数
+    static const uint32_t TVR_BITS = 8;
+    /// 高层每层槽数的位数
+    static const uint32_t TVN_BITS = 6;
+    static const uint32_t TVR_SIZE = 1 << TVR_BITS;
+    static const uint32_t TVN_SIZE = 1 << TVN_BITS;
+    static const uint32_t LEVELS = 5;
+    /// 所有层的槽位，最后一个槽存放插入时已经到期的定时器
+    static const uint32_t SLOTS = TVR_SIZE + (LEVELS - 1) * TVN_SIZE;
+    static const uint32_t DUE_SLOT = SLOTS;
+    /// 时间轮覆盖的最大时长，更远的定时器先放在最高层，下放时重新计算
+    static const uint64_t MAX_RANGE = 1ull << (TVR_BITS + (LEVELS - 1) * TVN_BITS);
+
+    /**
+     * @brief 其他线程投递给分片所属线程的操作
+     * 
+     */
+    struct Message {
+        enum Type {
+            /// 挂到时间轮
+            ADD,
+            /// 从时间轮摘下并释放回调
+            CANCEL,
+            /// 重新计算到期时间
+            RESET,
+        };
+        Type type = ADD;
+        Timer* timer = nullptr;
+        /// 普通定时器在消息处理前由这里持有，池化节点为空
+        Timer::ptr hold;
+        /// CANCEL：取消时的代数
+        uint64_t gen = 0;
+        /// RESET：新的执行间隔，~0ull表示不变
+        uint64_t us = ~0ull;
+        /// RESET：是否从now开始计算
+        bool fromNow = false;
+        /// RESET：投递时的时间
+        uint64_t now = 0;
+        Message* next = nullptr;
+    };
+
+    /**
+     * @brief 一个时间轮，单分片时由mutex保护，按线程分片时只由所属线程访问
+     *        各分片单独分配且槽位数组有数KB，不同分片的热点字段不会落在同一缓存行
+     * 
+     */
+    struct Shard {
+        Shard();
+
+        /**
+         * @brief 按到期时间把定时器挂到对应的槽
+         * 
+         * @param timer 
+         */
+        void link(Timer* timer);
+
+        /**
+         * @brief 从所在的槽摘下定时器
+         * 
+         * @param timer 
+         */
+        void unlink(Timer* timer);
+
+        /**
+         * @brief 取下整个槽的链表
+         * 
+         * @param slot 
+         * @return Timer* 
+         */
+        Timer* takeSlot(uint32_t slot);
+
+        /**
+         * @brief 最近的到期时间(微秒)，当前毫秒的槽返回精确值，其余返回槽的起始时间
+         * 
+         * @return uint64_t 
+         */
+        uint64_t nextExpiry() const;
+
+        /**
+         * @brief 时间轮推进到now_us所在的毫秒，之前的槽整体到期，当前毫秒的槽取出已到期的，追加到expired
+         * 
+         * @param now_us 
+         * @param expired 
+         */
+        void advance(uint64_t now_us, std::vector<Timer*>& expired);
+
+        /**
+         * @brief 时间轮中的定时器数量
+         * 
+         * @return size_t 
+         */
+        size_t size() const { return count.load(std::memory_order_relaxed); }
+
+        /// 单分片时保护时间轮
+        MutexType mutex;
+        /// 各层的槽，每个槽是侵入式单链表头
+        Timer* slots[SLOTS + 1];
+        /// 非空槽的位图，查找下一个非空槽
+        uint64_t bitmap[SLOTS / 64];
+        /// 当前毫秒刻度，之前的刻度都已处理，该刻度的槽可能还有未到期的定时器
+        uint64_t base = 0;
+        /// 定时器数量，只由驱动线程修改，其他线程读取判断是否还有定时器
+        std::atomic<size_t> count = { 0 };
+        /// 其他线程投递的消息，无锁栈，驱动线程一次全部取走
+        std::atomic<Message*> inbox = { nullptr };
+        /// 单分片时是否已经触发过onTimerInsertedAtFront
+        bool tickled = false;
+        /// 挂到时间轮的次数，给定时器编号
+        uint64_t seq = 0;
+        /// 一次到期处理中取出的定时器，复用容量
+        std::vector<Timer*> expired;
+    };
+
+    /**
+     * @brief 从池中取一个节点，代数已经是新的
+     * 
+     * @return Timer* 
+     */
+    static Timer* AllocNode();
+
+    /**
+     * @brief 回收节点，代数加一
+     * 
+     * @param node 
+     */
+    static void FreeNode(Timer* node);
+
+    /**
+     * @brief 把新定时器挂到时间轮，按单分片、本线程分片、其他线程的分片分别处理
+     * 
+     * @param timer 
+     * @param hold 普通定时器的所有权，交给时间轮持有；池化节点为空
+     * @return uint32_t 挂到的分片
+     */
+    uint32_t insertTimer(Timer* timer, Timer::ptr hold);
+
+    /**
+     * @brief 把新定时器交给时间轮持有并挂上
+     * 
+     * @param shard 
+     * @param timer 
+     * @param hold 
+     */
+    void linkNew(Shard& shard, Timer* timer, Timer::ptr hold);
+
+    /**
+     * @brief 定时器离开时间轮后释放：普通定时器放弃自身引用，池化节点回收
+     * 
+     * @param timer 
+     */
+    void release(Timer* timer);
+
+    /**
+     * @brief 向分片投递消息
+     * 
+     * @param shard 
+     * @param msg 
+     */
+    void post(size_t shard, Message* msg);
+
+    /**
+     * @brief 按投递顺序处理分片收到的消息，只能由驱动线程调用
+     * 
+     * @param shard 
+     */
+    void drain(Shard& shard);
+
+    /**
+     * @brief 取消：摘下定时器并释放回调，需由驱动线程调用
+     * 
+     * @param shard 
+     * @param timer 
+     * @param gen 取消时的代数，池化节点已被回收(代数不同)时什么都不做
+     */
+    void applyCancel(Shard& shard, Timer* timer, uint64_t gen);
+
+    /**
+     * @brief 重新计算到期时间并挂回，需由驱动线程调用
+     * 
+     * @param shard 
+     * @param timer 
+     * @param us 新的执行间隔，~0ull表示不变
+     * @param from_now 是否从now开始计算
+     * @param now 
+     * @return true 
+     * @return false 定时器已执行或已取消
+     */
+    bool applyReset(Shard& shard, Timer* timer, uint64_t us, bool from_now, uint64_t now);
+
+    /**
+     * @brief 取消定时器，Timer::cancel/TimerHandle::cancel抢到状态之后调用
+     * 
+     * @param timer 
+     * @param gen 
+     * @param shard 
+     */
+    void cancelTimer(Timer* timer, uint64_t gen, uint32_t shard);
+
+    /**
+     * @brief 重置定时器
      * 
-     * @param now_ms 
+     * @param timer 
+     * @param us 新的执行间隔，~0ull表示不变
+     * @param from_now 
      * @return true 
      * @return false 
      */
-    bool detectClockRollover(uint64_t now_ms);
+    bool resetTimer(Timer* timer, uint64_t us, bool from_now);
 
 private:
-    RWMutexType m_mutex;
-    /// 定时器集合 最小堆
-    std::set<Timer::ptr, Timer::Comparator> m_timers;
-    /// 是否触发onTimerInsertedAtFront
-    bool m_tickled = false;
-    /// 上次执行时间
-    uint64_t m_previousTime = 0;
+    /// 分片，单分片模式下只有一个
+    std::vector<std::unique_ptr<Shard>> m_shards;
+    /// 是否按线程分片
+    bool m_sharded = false;
+    /// 轮流选择分片
+    std::atomic<size_t> m_shardSeq = { 0 };
 };
 
 }  // namespace zero
@@ -0,0 +1,162 @@
+#ifndef __ZERO_WORK_STEAL_QUEUE_H__
+#define __ZERO_WORK_STEAL_QUEUE_H__
+
+#include "noncopyable.h"
+#include <atomic>
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+namespace zero {
+
+/**
+ * @brief Chase-Lev无锁工作窃取队列(内存序参考Lê et al. 2013)
+ *        只有所属线程可以push/pop(LIFO端)，其他线程通过steal从另一端(FIFO端)窃取
+ *        元素为指针，队列不负责释放
+ *
+ * @tparam T 元素类型，队列中保存T*
+ */
+template <class T>
+class WorkStealQueue : Noncopyable {
+public:
+    /**
+     * @brief Construct a new Work Steal Queue object
+     *
+     * @param capacity 初始容量，向上取整为2的幂
+     */
+    WorkStealQueue(size_t capacity = 256) {
+        size_t cap = 1;
+        while (cap < capacity) {
+            cap <<= 1;
+        }
+        Array* array = new Array(cap);
+        m_garbage.emplace_back(array);
+        m_array.store(array, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 放入队尾，只能由所属线程调用，容量不足时扩容
+     *
+     * @param item
+     */
+    void push(T* item) {
+        int64_t b = m_bottom.load(std::memory_order_relaxed);
+        int64_t t = m_top.load(std::memory_order_acquire);
+        Array* a = m_array.load(std::memory_order_relaxed);
+        if (b - t > ( int64_t )a->mask) {
+            a = grow(a, t, b);
+        }
+        a->put(b, item);
+        std::atomic_thread_fence(std::memory_order_release);
+        m_bottom.store(b + 1, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 从队尾取出，只能由所属线程调用
+     *
+     * @return T* 队列为空返回nullptr
+     */
+    T* pop() {
+        int64_t b = m_bottom.load(std::memory_order_relaxed) - 1;
+        Array* a = m_array.load(std::memory_order_relaxed);
+        m_bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = m_top.load(std::memory_order_relaxed);
+        if (t > b) {
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        T* item = a->get(b);
+        if (t == b) {
+            /// 只剩最后一个元素，与窃取者竞争
+            if (!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                item = nullptr;
+            }
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return item;
+    }
+
+    /**
+     * @brief 从队头窃取，任意线程可调用
+     *
+     * @return T* 队列为空或与其他线程竞争失败返回nullptr
+     */
+    T* steal() {
+        int64_t t = m_top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = m_bottom.load(std::memory_order_acquire);
+        if (t >= b) {
+            return nullptr;
+        }
+        Array* a = m_array.load(std::memory_order_consume);
+        T* item = a->get(t);
+        if (!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            return nullptr;
+        }
+        return item;
+    }
+
+    /**
+     * @brief 近似的元素数量，并发时只作参考
+     *
+     * @return size_t
+     */
+    size_t size() const {
+        int64_t b = m_bottom.load(std::memory_order_relaxed);
+        int64_t t = m_top.load(std::memory_order_relaxed);
+        return b > t ? b - t : 0;
+    }
+
+    bool empty() const { return size() == 0; }
+
+private:
+    /**
+     * @brief 环形数组
+     *
+     */
+    struct Array {
+        Array(size_t cap) : mask(cap - 1), items(new std::atomic<T*>[cap]) {}
+
+        T* get(int64_t i) const { return items[i & mask].load(std::memory_order_relaxed); }
+
+        void put(int64_t i, T* item) { items[i & mask].store(item, std::memory_order_relaxed); }
+
+        size_t mask;
+        std::unique_ptr<std::atomic<T*>[]> items;
+    };
+
+    /**
+     * @brief 容量翻倍
+     *        窃取者可能还在读旧数组，旧数组保留到队列析构时再释放
+     *
+     * @param a
+     * @param t
+     * @param b
+     * @return Array*
+     */
+    Array* grow(Array* a, int64_t t, int64_t b) {
+        Array* na = new Array((a->mask + 1) << 1);
+        for (int64_t i = t; i < b; ++i) {
+            na->put(i, a->get(i));
+        }
+        m_garbage.emplace_back(na);
+        m_array.store(na, std::memory_order_release);
+        return na;
+    }
+
+private:
+    /// 窃取端
+    std::atomic<int64_t> m_top{ 0 };
+    /// 与m_bottom隔开一个缓存行，避免窃取者和所属线程伪共享
+    char m_pad[64];
+    /// 所属线程操作的一端
+    std::atomic<int64_t> m_bottom{ 0 };
+    std::atomic<Array*> m_array;
+    /// 分配过的所有数组，只由所属线程修改
+    std::vector<std::unique_ptr<Array>> m_garbage;
+};
+
+}  // namespace zero
+
+#endif